@@ -38,6 +38,7 @@ typedef struct _object_metadata {
 } object_metadata;
 
 extern object_metadata PVector_metadata;
+extern object_metadata PVectorFatNodeElem_metadata;
 extern object_metadata String_metadata;
 
 /* Generic heap info; not all fields used by all collectors but field offsets
@@ -84,6 +85,12 @@ extern void gc_shutdown();
  */
 extern void gc();
 extern heap_object *gc_alloc(object_metadata *metadata, size_t size);
+/* Register the address of a pointer into the heap. mark_and_compact
+ * treats only the low GC_ROOT_POINTER_BITS bits of a root as the pointer
+ * and preserves anything above them (e.g., a packed vector version) when
+ * it moves the object.
+ */
+#define GC_ROOT_POINTER_BITS	48
 extern void gc_add_root(void **p);
 extern int gc_num_roots();
 extern void gc_set_num_roots(int roots);
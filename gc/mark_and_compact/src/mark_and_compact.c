@@ -22,71 +22,152 @@ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
 SOFTWARE.
 */
 #include <stdio.h>
+#include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
 
 #include <mark_and_compact.h>
 #include <gc.h>
 #include <morecore.h>
 
-static void *gc_raw_alloc(size_t size);
-static void update_roots();
+static void *gc_raw_alloc(Heap_Context *h, size_t size);
+static void grow_heap(Heap_Context *h, size_t size);
+static void update_roots(Heap_Context *h);
 static void gc_chase_ptr_fields(const heap_object *p);
 static void update_ptr_fields(heap_object *p);
 static void mark_object(heap_object *p);
 
-// --------------------------------- D A T A ---------------------------------
+/* A root may carry a tag above the low GC_ROOT_POINTER_BITS bits; see gc.h */
+#define ROOT_POINTER_MASK	(((uintptr_t)1 << GC_ROOT_POINTER_BITS) - 1)
+#define ROOT_TARGET(r)		((heap_object *)((uintptr_t)*(r) & ROOT_POINTER_MASK))
+#define ROOT_TAG(r)			((uintptr_t)*(r) & ~ROOT_POINTER_MASK)
 
-static bool DEBUG = false;
+// --------------------------------- D A T A ---------------------------------
 
 static const int MAX_ROOTS = 100000; // obviously this is ok only for the educational purpose of this code
+static const int MIN_ROOTS = 64;	// roots start out with room for this many and double as needed
 
-/* Track every pointer into the heap; includes globals, args, and locals */
-static heap_object **_roots[MAX_ROOTS];
-
-/* index of next free space in _roots for a root */
-static int num_roots = 0;
-
-static size_t heap_size;
-static void *heap;
-static void *end_of_heap;
-static void *next_free;
-static void *next_free_forwarding; // next_free used during forwarding address computation
+/* Everything the collector knows about one heap. Nothing is shared between
+ * heaps so each can be used by its own thread.
+ */
+struct heap_context {
+	bool debug;
+
+	/* Track every pointer into the heap; includes globals, args, and locals */
+	heap_object ***roots;
+
+	/* index of next free space in roots for a root */
+	int num_roots;
+	int max_roots;	// roots allocated so far
+
+	size_t heap_size;		// bytes in use as heap, up to end_of_heap
+	size_t min_heap_size;	// what it starts at and gc_heap_reset() shrinks it back to
+	size_t max_heap_size;	// bytes reserved, which it grows into as needed
+	void *heap;
+	void *end_of_heap;
+	void *next_free;
+	void *next_free_forwarding; // next_free used during forwarding address computation
+};
+
+/* The heap each thread allocates in unless it has picked one with gc_use_heap() */
+static _Thread_local Heap_Context thread_heap;
+
+/* The heap the gc_xxx() functions work on for this thread */
+static _Thread_local Heap_Context *current;
+
+static inline Heap_Context *heap_context() {
+	if ( current==NULL ) current = &thread_heap;
+	return current;
+}
 
 
 // --------------------------------- G C  I n i t  &  R o o t  M g m t ---------------------------------
 
-void gc_debug(bool debug) { DEBUG = debug; }
+void gc_debug(bool debug) { heap_context()->debug = debug; }
+
+static void heap_init(Heap_Context *h, int size, int max_size) {
+	if ( h->heap!=NULL ) { dropcore(h->heap, h->max_heap_size); }
+	h->heap_size = h->min_heap_size = (size_t)size;
+	h->max_heap_size = (size_t)max_size;
+	h->heap = morecore((size_t)max_size);
+	h->end_of_heap = h->heap + size - 1;
+	h->next_free = h->heap;
+	h->num_roots = 0;
+}
 
 /* Initialize a heap with a certain size for use with the garbage collector */
 void gc_init(int size) {
-	if (heap != NULL ) { gc_shutdown(); }
-    heap_size = (size_t)size;
-    heap = morecore((size_t)size);
-    end_of_heap = heap + size - 1;
-    next_free = heap;
-    num_roots = 0;
+	heap_init(heap_context(), size, size);
 }
 
 /* Announce you are done with the heap managed by the garbage collector */
 void gc_shutdown() {
-	dropcore(heap, heap_size);
+	Heap_Context *h = heap_context();
+	dropcore(h->heap, h->max_heap_size);
+}
+
+Heap_Context *gc_heap_new(int size) {
+	return gc_heap_new_growable(size, size);
+}
+
+Heap_Context *gc_heap_new_growable(int size, int max_size) {
+	Heap_Context *h = calloc(1, sizeof(Heap_Context));
+	heap_init(h, size, max_size);
+	return h;
+}
+
+void gc_heap_reset(Heap_Context *h) {
+	if ( h->heap_size>h->min_heap_size ) { // give the pages it grew into back
+		madvise(h->heap + h->min_heap_size, h->heap_size - h->min_heap_size, MADV_DONTNEED);
+		h->heap_size = h->min_heap_size;
+		h->end_of_heap = h->heap + h->heap_size - 1;
+	}
+	h->next_free = h->heap;
+	h->num_roots = 0;
+}
+
+void gc_heap_free(Heap_Context *h) {
+	if ( h==NULL ) return;
+	if ( current==h ) current = NULL;
+	dropcore(h->heap, h->max_heap_size);
+	free(h->roots);
+	free(h);
+}
+
+Heap_Context *gc_use_heap(Heap_Context *h) {
+	Heap_Context *previous = current;
+	current = h;
+	return previous;
 }
 
 void gc_add_root(void **p)
 {
-	if ( num_roots<MAX_ROOTS ) {
-		_roots[num_roots++] = (heap_object **) p;
+	Heap_Context *h = heap_context();
+	if ( h->num_roots==h->max_roots && h->max_roots<MAX_ROOTS ) {
+		int n = h->max_roots==0 ? MIN_ROOTS : h->max_roots * 2;
+		if ( n>MAX_ROOTS ) n = MAX_ROOTS;
+		heap_object ***roots = realloc(h->roots, (size_t)n * sizeof(heap_object **));
+		if ( roots==NULL ) return;
+		h->roots = roots;
+		h->max_roots = n;
+	}
+	if ( h->num_roots<h->max_roots ) {
+		h->roots[h->num_roots++] = (heap_object **) p;
 	}
 }
 
+void **gc_root(int i) {
+	return (void **)heap_context()->roots[i];
+}
+
 int gc_num_roots() {
-	return num_roots;
+	return heap_context()->num_roots;
 }
 
 void gc_set_num_roots(int roots)
 {
-	num_roots = roots;
+	heap_context()->num_roots = roots;
 }
 
 // --------------------------------- A l l o c a t i o n ---------------------------------
@@ -95,9 +176,10 @@ void gc_set_num_roots(int roots)
  * The object is zeroed out and the header is initialized.
  */
 heap_object *gc_alloc(object_metadata *metadata, size_t size) {
-	if (heap == NULL ) { gc_init(DEFAULT_MAX_HEAP_SIZE); }
+	Heap_Context *h = heap_context();
+	if (h->heap == NULL ) { heap_init(h, DEFAULT_MAX_HEAP_SIZE, DEFAULT_MAX_HEAP_SIZE); }
 	size = align_to_word_boundary(size);
-	heap_object *p = gc_raw_alloc(size);
+	heap_object *p = gc_raw_alloc(h, size);
 
 	if ( p==NULL ) return NULL;
 
@@ -111,51 +193,66 @@ heap_object *gc_alloc(object_metadata *metadata, size_t size) {
 /** Allocate size bytes in the heap by bumping high-water mark; if full, gc() and try again.
  *  Size must include any header size and must be word-aligned.
  */
-static void *gc_raw_alloc(size_t size) {
-	if (next_free + size > end_of_heap) {
+static void *gc_raw_alloc(Heap_Context *h, size_t size) {
+	if (h->next_free + size > h->end_of_heap) {
 		gc(); // try to collect
-		if (next_free + size > end_of_heap) { // try again
+		grow_heap(h, size);
+		if (h->next_free + size > h->end_of_heap) { // try again
 			return NULL;                      // oh well, no room. puke
 		}
 	}
 
-	void *p = next_free; // bump-ptr-allocation
-	next_free += size;
+	void *p = h->next_free; // bump-ptr-allocation
+	h->next_free += size;
 	return p;
 }
 
+/* After a collection, grow a heap made by gc_heap_new_growable() until it
+ * has room for size more bytes and is no more than half full, so it isn't
+ * collected again straight away.
+ */
+static void grow_heap(Heap_Context *h, size_t size) {
+	size_t busy = (size_t)(h->next_free - h->heap) + size;
+	while ( h->heap_size<h->max_heap_size && busy>h->heap_size/2 ) {
+		h->heap_size = h->heap_size*2<h->max_heap_size ? h->heap_size*2 : h->max_heap_size;
+	}
+	h->end_of_heap = h->heap + h->heap_size - 1;
+}
 
 // --------------------------------- C o l l e c t i o n ---------------------------------
 
 static inline void realloc_object(heap_object *p) {
-	void *q = next_free_forwarding; // bump-ptr-allocation
-	next_free_forwarding += p->size;
+	Heap_Context *h = current;
+	void *q = h->next_free_forwarding; // bump-ptr-allocation
+	h->next_free_forwarding += p->size;
 	p->forwarded = q; // p now knows where it will end up after compacting
-	if (DEBUG) if ( p->forwarded!=p ) printf("forward %p to %s@%p (0x%x bytes)\n", p, p->metadata->name, p->forwarded, p->size);
+	if (h->debug) if ( p->forwarded!=p ) printf("forward %p to %s@%p (0x%x bytes)\n", p, p->metadata->name, p->forwarded, p->size);
 }
 
 static inline void move_to_forwarding_addr(heap_object *p) {
-	if (DEBUG) if ( p->forwarded!=p ) printf("    move %p to %p (0x%x bytes)\n", p, p->forwarded, p->size);
+	if (current->debug) if ( p->forwarded!=p ) printf("    move %p to %p (0x%x bytes)\n", p, p->forwarded, p->size);
 	if ( p->forwarded!=p ) {
 		memcpy(p->forwarded, p, p->size);
 	}
 }
 
 static inline void move_live_objects_to_forwarding_addr(heap_object *p) {
+	bool debug = current->debug;
 	if ( p->marked ) {
-		if (DEBUG) printf("live %s@%p (0x%x bytes)\n", p->metadata->name, p, p->size);
+		if (debug) printf("live %s@%p (0x%x bytes)\n", p->metadata->name, p, p->size);
 		p->marked = false;              // reset *before* move or you're changing old object
 		move_to_forwarding_addr(p);     // move objects to compact heap
 	}
 	else {
-		if (DEBUG) printf("dead %s@%p (0x%x bytes)\n", p->metadata->name, p, p->size);
+		if (debug) printf("dead %s@%p (0x%x bytes)\n", p->metadata->name, p, p->size);
 		p->magic = 0;
 	}
 }
 
 bool ptr_is_in_heap(heap_object *p) {
-	return  p >= (heap_object *) heap &&
-			p <= (heap_object *) end_of_heap &&
+	Heap_Context *h = heap_context();
+	return  p >= (heap_object *) h->heap &&
+			p <= (heap_object *) h->end_of_heap &&
 			p->magic == MAGIC_NUMBER;
 }
 
@@ -180,38 +277,42 @@ static inline void unmark_object(heap_object *p) { p->marked = false; }
  *    we overwrite objects and could kill a forwarding address in a live object.
  */
 void gc() {
-    if (DEBUG) printf("GC\n");
+	Heap_Context *h = heap_context();
+	if (h->debug) printf("GC\n");
 
 	gc_mark();
 
 	// reallocate all live objects starting from start_of_heap
-	if (DEBUG) printf("FORWARD\n");
-	next_free_forwarding = heap;
+	if (h->debug) printf("FORWARD\n");
+	h->next_free_forwarding = h->heap;
 	foreach_live(realloc_object);  		// for each marked (live) object, record forwarding address
 
 	// make sure all roots point at new object addresses
-	update_roots();                     // can't move objects before updating roots; roots point at *old* location
+	update_roots(h);                    // can't move objects before updating roots; roots point at *old* location
 
-	if (DEBUG) printf("UPDATE PTR FIELDS\n");
+	if (h->debug) printf("UPDATE PTR FIELDS\n");
 	foreach_live(update_ptr_fields);
 
 	// Now that we know where to move objects, update and move objects
-	if (DEBUG) printf("COMPACT\n");
+	if (h->debug) printf("COMPACT\n");
 	foreach_object(move_live_objects_to_forwarding_addr); // also visits the dead to wack p->magic
 
 	// reset highwater mark *after* we've moved everything around; foreach_object() uses next_free
-	next_free = next_free_forwarding;	// next object to be allocated would occur here
+	h->next_free = h->next_free_forwarding;	// next object to be allocated would occur here
 
-	if (DEBUG) printf("DONE GC\n");
+	if (h->debug) printf("DONE GC\n");
 }
 
-/* Alter roots to point at new location of live objects (compacted) */
-static void update_roots() {
-	if (DEBUG) printf("UPDATE ROOTS\n");
-	for (int i = 0; i < num_roots; i++) {
-		heap_object *p = *_roots[i];
-		if ( p!=NULL ) {
-			if (DEBUG) {
+/* Alter roots to point at new location of live objects (compacted). Roots
+ * may point outside the heap, at constants say, which don't move.
+ */
+static void update_roots(Heap_Context *h) {
+	heap_object ***_roots = h->roots;
+	if (h->debug) printf("UPDATE ROOTS\n");
+	for (int i = 0; i < h->num_roots; i++) {
+		heap_object *p = ROOT_TARGET(_roots[i]);
+		if ( p!=NULL && ptr_is_in_heap(p) ) {
+			if (h->debug) {
 				if (p->forwarded != p) {
 					printf("move root[%d]=%p -> %s@%p (0x%x bytes) to %p\n",
 					       i,
@@ -222,21 +323,22 @@ static void update_roots() {
 					       p->forwarded);
 				}
 			}
-			*_roots[i] = p->forwarded;	// update root to point at new address
+			*_roots[i] = (heap_object *)(ROOT_TAG(_roots[i]) | (uintptr_t)p->forwarded);	// update root to point at new address
 		}
 	}
 }
 
 static void update_ptr_fields(heap_object *p) {
 	int f;
-	if (DEBUG) printf("update %d ptr fields of %s@%p\n", p->metadata->num_ptr_fields, p->metadata->name, p);
+	bool debug = current->debug;
+	if (debug) printf("update %d ptr fields of %s@%p\n", p->metadata->num_ptr_fields, p->metadata->name, p);
 	for (f = 0; f < p->metadata->num_ptr_fields; f++) {
 		int offset_of_ptr_field = p->metadata->field_offsets[f];
 		void *ptr_to_ptr_field = ((void *) p) + offset_of_ptr_field;
 		heap_object **ptr_to_obj_ptr_field = (heap_object **) ptr_to_ptr_field;
 		heap_object *target_obj = *ptr_to_obj_ptr_field;
 		if (target_obj != NULL) {
-			if (DEBUG) {
+			if (debug) {
 				if ( target_obj->forwarded!=target_obj ) {
 					printf("    update ptr (offset %d) from %p to %p\n",
 					       offset_of_ptr_field,
@@ -255,23 +357,25 @@ static void update_ptr_fields(heap_object *p) {
    reachable p.
  */
 void gc_mark() {
-	if (DEBUG) printf("MARK\n");
-    for (int i = 0; i < num_roots; i++) {
-        heap_object *p = *_roots[i];
+	Heap_Context *h = heap_context();
+	heap_object ***_roots = h->roots;
+	if (h->debug) printf("MARK\n");
+    for (int i = 0; i < h->num_roots; i++) {
+        heap_object *p = ROOT_TARGET(_roots[i]);
         if ( p != NULL ) {
             if ( ptr_is_in_heap(p) ) {
-	            if (DEBUG) printf("root[%d]=%p -> %s@%p (0x%x bytes)\n", i, _roots[i], p->metadata->name, p, p->size);
+	            if (h->debug) printf("root[%d]=%p -> %s@%p (0x%x bytes)\n", i, _roots[i], p->metadata->name, p, p->size);
 				mark_object(p);
             }
-	        else if ( DEBUG ) {
-	            if (DEBUG) printf("root[%d]=%p -> %p INVALID\n", i, _roots[i], p);
+	        else if ( h->debug ) {
+	            printf("root[%d]=%p -> %p INVALID\n", i, _roots[i], p);
             }
         }
     }
 }
 
 void gc_unmark() {
-	if (DEBUG) printf("UNMARK\n");
+	if (heap_context()->debug) printf("UNMARK\n");
 	foreach_object(unmark_object);
 }
 
@@ -279,9 +383,10 @@ int gc_num_live_objects() {
 //	gc_unmark();
 	gc_mark();
 
+	Heap_Context *h = heap_context();
 	int n = 0;
-	void *p = heap;
-	while (p >= heap && p < next_free) { // for each marked (live) object, record forwarding address
+	void *p = h->heap;
+	while (p >= h->heap && p < h->next_free) { // for each marked (live) object, record forwarding address
 		if (((heap_object *)p)->marked) {
 			n++;
 		}
@@ -295,7 +400,7 @@ int gc_num_live_objects() {
 /* recursively walk object graph starting from p. */
 static void mark_object(heap_object *p) {
 	if ( !p->marked ) {
-		if (DEBUG) printf("mark    %s@%p (0x%x bytes)\n", p->metadata->name, p, p->size);
+		if (current->debug) printf("mark    %s@%p (0x%x bytes)\n", p->metadata->name, p, p->size);
 		p->marked = true;
 		gc_chase_ptr_fields(p);
 	}
@@ -320,29 +425,31 @@ static void gc_chase_ptr_fields(const heap_object *p) {// check for tracked heap
  * does not do liveness trace.
  */
 Heap_Info get_heap_info() {
-	void *p = heap;
+	Heap_Context *h = heap_context();
+	void *p = h->heap;
 	int busy = 0;
 	int live = gc_num_live_objects();
 	int computed_busy_size = 0;
-	int busy_size = (uint32_t)(next_free - heap);
-	int free_size = (uint32_t)(end_of_heap - next_free + 1);
-	while (p >= heap && p < next_free ) { // stay inbounds, walking heap
+	int busy_size = (uint32_t)(h->next_free - h->heap);
+	int free_size = (uint32_t)(h->end_of_heap - h->next_free + 1);
+	while (p >= h->heap && p < h->next_free ) { // stay inbounds, walking heap
 		// track
 		busy++;
 		computed_busy_size += ((heap_object *)p)->size;
 		p = p + ((heap_object *)p)->size;
 	}
-	return (Heap_Info){heap, end_of_heap, next_free, (uint32_t)heap_size,
+	return (Heap_Info){h->heap, h->end_of_heap, h->next_free, (uint32_t)h->heap_size,
 	                   busy, live, computed_busy_size, 0, busy_size, free_size };
 }
 
 /* Apply function action to each marked (live) object in the heap; assumes live are marked */
 void foreach_live(void (*action)(heap_object *)) {
-	void *p = heap;
-	while (p >= heap && p < next_free) { // for each marked (live) object
+	Heap_Context *h = heap_context();
+	void *p = h->heap;
+	while (p >= h->heap && p < h->next_free) { // for each marked (live) object
 		heap_object *_p = (heap_object *)p;
 		size_t size = _p->size;
-		if (DEBUG) {
+		if (h->debug) {
 			if (_p->magic != MAGIC_NUMBER) printf("INVALID ptr %p in foreach_live()\n", _p);
 		}
 		if ( _p->marked ) {
@@ -353,8 +460,9 @@ void foreach_live(void (*action)(heap_object *)) {
 }
 
 void foreach_object(void (*action)(heap_object *)) {
-	void *p = heap;
-	while (p >= heap && p < next_free) { // for each object in the heap currently allocated
+	Heap_Context *h = heap_context();
+	void *p = h->heap;
+	while (p >= h->heap && p < h->next_free) { // for each object in the heap currently allocated
 		size_t size = ((heap_object *)p)->size;
 		action(p);
 		p = p + size;
@@ -44,6 +44,33 @@ typedef struct heap_object {
 
 extern long gc_heap_highwater();
 
+/* A heap and its roots. Each thread has a default one, which gc_init() sets
+ * up, but any number can be made and run side by side on separate threads.
+ */
+typedef struct heap_context Heap_Context;
+
+extern Heap_Context *gc_heap_new(int size);
+extern void gc_heap_free(Heap_Context *h);
+
+/* A heap that starts at size bytes and, when a collection leaves it more
+ * than half full, doubles up to max_size, all of which is reserved up front.
+ */
+extern Heap_Context *gc_heap_new_growable(int size, int max_size);
+
+/* Drop every object and root in h, shrinking it back to the size it started
+ * at, so it can be used afresh.
+ */
+extern void gc_heap_reset(Heap_Context *h);
+
+/* Make h the heap that gc_alloc(), gc_add_root(), gc() and the rest work on
+ * for the calling thread; returns the one they used before. NULL means the
+ * thread's default heap.
+ */
+extern Heap_Context *gc_use_heap(Heap_Context *h);
+
+/* The address registered as the ith root, 0 <= i < gc_num_roots() */
+extern void **gc_root(int i);
+
 #ifdef __cplusplus
 }
 #endif
@@ -192,6 +192,79 @@ void gc_compacts_vectors() {
 	assert_equal(gc_num_live_objects(), 0);
 }
 
+void separate_heaps() {
+	PVector *p = PVector_alloc(10);
+	gc_add_root((void **)&p);
+	int roots = gc_num_roots();
+
+	Heap_Context *other = gc_heap_new(HEAP_SIZE);
+	Heap_Context *previous = gc_use_heap(other);
+	assert_equal(gc_num_roots(), 0);
+	PVector *q = PVector_alloc(5);
+	gc_add_root((void **)&q);
+	assert_equal(ptr_is_in_heap((heap_object *)p), false);
+	assert_addr_equal(q, get_heap_info().start_of_heap);
+	gc_set_num_roots(0);
+	gc();
+	assert_equal(gc_num_live_objects(), 0);
+	gc_use_heap(previous);
+	gc_heap_free(other);
+
+	assert_equal(gc_num_roots(), roots); // the first heap never saw q
+	assert_equal(gc_num_live_objects(), 1);
+	assert_addr_equal(p, get_heap_info().start_of_heap);
+}
+
+void many_roots() {
+	gc_begin_func();
+
+	const int N = 1000; // the roots array starts small and has to grow
+	PVector *v[N];
+	for (int i=0; i<N; i++) {
+		v[i] = NULL;
+		gc_add_root((void **)&v[i]);
+		if ( i%100==0 ) v[i] = PVector_alloc(i/100%3 + 1);
+	}
+	assert_equal(gc_num_roots(), N);
+	assert_addr_equal(gc_root(N-1), &v[N-1]);
+
+	for (int i=0; i<N; i+=200) { v[i] = NULL; }
+	gc();
+	assert_equal(gc_num_live_objects(), 5);
+	for (int i=100; i<N; i+=200) { assert_equal(v[i]->length, i/100%3 + 1); }
+
+	gc_end_func();
+}
+
+void growable_heap() {
+	Heap_Context *other = gc_heap_new_growable(HEAP_SIZE, 8*HEAP_SIZE);
+	Heap_Context *previous = gc_use_heap(other);
+	assert_equal(get_heap_info().heap_size, HEAP_SIZE);
+
+	const int N = 40; // more than fits in HEAP_SIZE
+	PVector *v[N];
+	for (int i=0; i<N; i++) {
+		v[i] = NULL;
+		gc_add_root((void **)&v[i]);
+		v[i] = PVector_alloc(2);
+		assert_addr_not_equal(v[i], NULL);
+	}
+	assert_equal(gc_num_live_objects(), N);
+	Heap_Info info = get_heap_info();
+	assert_true(info.heap_size>(int)HEAP_SIZE && info.heap_size<=8*(int)HEAP_SIZE);
+	assert_true(info.busy_size<=info.heap_size);
+
+	gc_heap_reset(other);
+	assert_equal(gc_num_roots(), 0);
+	info = get_heap_info();
+	assert_equal(info.heap_size, HEAP_SIZE);
+	assert_equal(info.busy_size, 0);
+	assert_addr_not_equal(PVector_alloc(2), NULL);
+
+	gc_use_heap(previous);
+	gc_heap_free(other);
+}
+
 int main(int argc, char *argv[]) {
 	cunit_setup = setup;
 	cunit_teardown = teardown;
@@ -208,6 +281,9 @@ int main(int argc, char *argv[]) {
 	test(gc_after_single_vector_one_root_then_kill_ptr);
 	test(gc_after_single_vector_two_roots);
 	test(gc_compacts_vectors);
+	test(separate_heaps);
+	test(many_roots);
+	test(growable_heap);
 
 	return 0;
 }
\ No newline at end of file
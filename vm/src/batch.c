@@ -0,0 +1,264 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2015 Terence Parr, Hanzhou Shi, Shuai Yuan, Yuanyuan Zhang
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <setjmp.h>
+#include <pthread.h>
+#include <wich.h>
+#include "vm.h"
+#include "wloader.h"
+#include "decoder.h"
+#include "optimizer.h"
+#include "verifier.h"
+#include "regvm.h"
+#include "output.h"
+#include "vmstack.h"
+#include "batch.h"
+
+typedef struct {
+	char *path;
+	pthread_mutex_t lock;	// held while loading
+	bool loaded;
+	VM *vm;					// NULL if path couldn't be loaded
+} Module;
+
+typedef struct {
+	Module *module;
+	char *output;			// what the script printed, once done
+	size_t output_len;
+	bool done;
+} Job;
+
+/* Worker w's queue holds jobs w, w+workers, w+2*workers, ... at positions
+ * head..tail-1. The owner takes from the head, thieves from the tail.
+ */
+typedef struct {
+	pthread_mutex_t lock;
+	int head;
+	int tail;
+} Queue;
+
+typedef struct {
+	const Batch_Options *options;
+	Job *jobs;
+	Queue *queues;
+	int workers;
+	pthread_mutex_t done_lock;	// guards done flags and failures
+	pthread_cond_t done_cond;	// signalled as each job finishes
+	int failures;
+} Batch;
+
+typedef struct {
+	Batch *batch;
+	int id;
+	VM *vm;
+	pthread_t thread;
+	bool running;
+} Worker;
+
+static int compare_paths(const void *a, const void *b)
+{
+	return strcmp(**(char ***)a, **(char ***)b);
+}
+
+static VM *load(char *path, const Batch_Options *options)
+{
+	VM *vm = NULL;
+	char *ext = strrchr(path, '.');
+	if ( ext!=NULL && strcmp(ext, ".wbc")==0 ) {
+		vm = vm_load_wbc(path);
+	}
+	else {
+		FILE *f = fopen(path, "r");
+		if ( f!=NULL ) vm = vm_load(f);
+	}
+	if ( vm==NULL ) return NULL;
+	if ( options->optimize && !vm_optimize(vm) ) {
+		fprintf(stderr, "can't optimize %s\n", path);
+	}
+	if ( vm->instrs==NULL && !vm_predecode(vm) ) {
+		vm_free(vm);
+		return NULL;
+	}
+#ifdef UNCHECKED
+	vm_verify(vm); // vm_exec() won't run it otherwise
+#endif
+	return vm;
+}
+
+static bool next_job(Batch *b, int w, int *job)
+{
+	for (int k = 0; k < b->workers; k++) {
+		int victim = (w + k) % b->workers;
+		Queue *q = &b->queues[victim];
+		pthread_mutex_lock(&q->lock);
+		bool found = q->head < q->tail;
+		if ( found ) {
+			int pos = k==0 ? q->head++ : --q->tail;
+			*job = victim + pos * b->workers;
+		}
+		pthread_mutex_unlock(&q->lock);
+		if ( found ) return true;
+	}
+	return false;
+}
+
+/* Run the module vm points at, catching the run-time errors that would
+ * otherwise end the process (see vm_fail()). Returns false if there was one,
+ * leaving vm ready for the next script and whatever it printed before the
+ * error in its output.
+ */
+static bool run_script(VM *vm, const Batch_Options *options)
+{
+	sigjmp_buf on_error;
+	Reg_Program *volatile prog = NULL;
+	Heap_Context *caller_heap = gc_use_heap(NULL);
+	gc_use_heap(caller_heap);
+
+	bool ok = sigsetjmp(on_error, 1)==0;
+	if ( ok ) {
+		vm_error_jump = vm_stack_overflow_jump = &on_error;
+		prog = options->registers ? vm_translate_registers(vm) : NULL;
+		if ( prog!=NULL ) vm_exec_registers(prog);
+		else vm_exec(vm, false);
+	}
+	vm_error_jump = vm_stack_overflow_jump = NULL;
+	if ( !ok ) {
+		// tasks may still be running on the scheduler's threads, which we can't stop
+		if ( vm->tasks!=NULL ) exit(1);
+		gc_heap_reset(vm->heap);
+		gc_use_heap(caller_heap);
+		vm->nested_runs = 0;
+	}
+	if ( prog!=NULL ) vm_free_registers(prog);
+	return ok;
+}
+
+static void run_job(Batch *b, VM *vm, Job *job)
+{
+	Module *m = job->module;
+	pthread_mutex_lock(&m->lock);
+	if ( !m->loaded ) {
+		m->vm = load(m->path, b->options);
+		m->loaded = true;
+		if ( m->vm==NULL ) fprintf(stderr, "can't load %s\n", m->path);
+	}
+	pthread_mutex_unlock(&m->lock);
+
+	bool failed = m->vm==NULL;
+	if ( m->vm!=NULL ) {
+		vm_use_module(vm, m->vm);
+		failed = !run_script(vm, b->options);
+		job->output = vm_take_output(vm, &job->output_len);
+	}
+
+	pthread_mutex_lock(&b->done_lock);
+	job->done = true;
+	if ( failed ) b->failures++;
+	pthread_cond_broadcast(&b->done_cond);
+	pthread_mutex_unlock(&b->done_lock);
+}
+
+static void *work(void *arg)
+{
+	Worker *w = arg;
+	int job;
+	while ( next_job(w->batch, w->id, &job) ) {
+		run_job(w->batch, w->vm, &w->batch->jobs[job]);
+	}
+	return NULL;
+}
+
+int vm_run_batch(char **scripts, int n, const Batch_Options *options, FILE *out)
+{
+	Batch b = {0};
+	b.options = options;
+	b.workers = options->workers<1 ? 1 : options->workers;
+	b.jobs = calloc((size_t)n+1, sizeof(Job));
+	pthread_mutex_init(&b.done_lock, NULL);
+	pthread_cond_init(&b.done_cond, NULL);
+
+	// one module per distinct path
+	char ***sorted = malloc(((size_t)n+1) * sizeof(char **));
+	for (int i = 0; i < n; i++) sorted[i] = &scripts[i];
+	qsort(sorted, (size_t)n, sizeof(char **), compare_paths);
+	Module *modules = calloc((size_t)n+1, sizeof(Module));
+	int nmodules = 0;
+	for (int i = 0; i < n; i++) {
+		if ( i==0 || strcmp(*sorted[i], *sorted[i-1])!=0 ) {
+			Module *m = &modules[nmodules++];
+			m->path = *sorted[i];
+			pthread_mutex_init(&m->lock, NULL);
+		}
+		b.jobs[sorted[i] - scripts].module = &modules[nmodules-1];
+	}
+	free(sorted);
+
+	b.queues = calloc((size_t)b.workers, sizeof(Queue));
+	Worker *workers = calloc((size_t)b.workers, sizeof(Worker));
+	int started = 0;
+	for (int w = 0; w < b.workers; w++) {
+		Queue *q = &b.queues[w];
+		pthread_mutex_init(&q->lock, NULL);
+		q->tail = w<n ? (n - w + b.workers - 1) / b.workers : 0;
+		workers[w].batch = &b;
+		workers[w].id = w;
+		workers[w].vm = vm_alloc();
+		workers[w].vm->capture_output = true;
+		workers[w].vm->jit_threshold = options->jit_threshold;
+	}
+	for (int w = 0; w < b.workers; w++) {
+		workers[w].running = pthread_create(&workers[w].thread, NULL, work, &workers[w])==0;
+		if ( workers[w].running ) started++;
+	}
+	if ( started==0 ) work(&workers[0]); // no threads; steal everything ourselves
+
+	// write output in script order as it becomes available
+	for (int i = 0; i < n; i++) {
+		pthread_mutex_lock(&b.done_lock);
+		while ( !b.jobs[i].done ) pthread_cond_wait(&b.done_cond, &b.done_lock);
+		pthread_mutex_unlock(&b.done_lock);
+		fwrite(b.jobs[i].output, 1, b.jobs[i].output_len, out);
+		free(b.jobs[i].output);
+	}
+	fflush(out);
+
+	for (int w = 0; w < b.workers; w++) {
+		if ( workers[w].running ) pthread_join(workers[w].thread, NULL);
+		vm_free(workers[w].vm);
+		pthread_mutex_destroy(&b.queues[w].lock);
+	}
+	for (int i = 0; i < nmodules; i++) {
+		if ( modules[i].vm!=NULL ) vm_free(modules[i].vm);
+		pthread_mutex_destroy(&modules[i].lock);
+	}
+	pthread_mutex_destroy(&b.done_lock);
+	pthread_cond_destroy(&b.done_cond);
+	free(workers);
+	free(b.queues);
+	free(modules);
+	free(b.jobs);
+	return b.failures;
+}
@@ -0,0 +1,60 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2015 Terence Parr, Hanzhou Shi, Shuai Yuan, Yuanyuan Zhang
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+#ifndef BATCH_H_
+#define BATCH_H_
+
+#include <stdio.h>
+#include "vm.h"
+
+typedef struct {
+	int workers;		// threads running scripts
+	int jit_threshold;	// as vm->jit_threshold; 0 turns the JIT off
+	bool optimize;		// run vm_optimize() on each file once it's loaded
+	bool registers;		// run on the register machine when the code translates
+} Batch_Options;
+
+/* Run n scripts (.wasm or .wbc files) on options->workers threads, writing
+ * what each prints to out in the order given, exactly as if they had run one
+ * after the other.
+ *
+ * Each distinct file is loaded once, by the first worker that needs it, and
+ * shared by every run of it. A worker has one VM, with its own stacks and GC
+ * heap, that it points at each script's module in turn (see vm_use_module())
+ * and whose output it captures (see vm_take_output()). Scripts are dealt out
+ * round robin to a queue per worker; a worker takes from the front of its own
+ * queue and, once that's empty, steals from the back of the others'. Error
+ * messages still go straight to stderr.
+ *
+ * A script that fails as it runs, with a stack overflow, an invalid
+ * instruction, a bad JOIN and the like, stops there without taking the batch
+ * down: the error goes to stderr, what it printed up to then goes to out in
+ * its turn and the worker moves on to the next script. The exception is a
+ * script that has spawned tasks, which may still be running on other
+ * threads; that ends the process with exit status 1, as it would on its own.
+ *
+ * Returns the number of scripts that couldn't be loaded or failed as they ran.
+ */
+extern int vm_run_batch(char **scripts, int n, const Batch_Options *options, FILE *out);
+
+#endif
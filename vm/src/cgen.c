@@ -0,0 +1,385 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2015 Terence Parr, Hanzhou Shi, Shuai Yuan, Yuanyuan Zhang
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <wich.h>
+#include "vm.h"
+#include "wloader.h"
+#include "decoder.h"
+#include "superinstructions.h"
+#include "cgen.h"
+
+// state of the generation of one function
+typedef struct {
+	VM *vm;
+	FILE *out;
+	Function_metadata *func;
+	int start, end;		// its instructions in vm->instrs
+	int *depth;			// operand stack depth before each instruction; -1 if unreachable
+	bool *label;		// is instruction a branch target
+	int max_depth;
+	int nvars;			// args + locals
+} Generation;
+
+static void gen_prologue(VM *vm, FILE *out);
+static bool uses_tasks(VM *vm);
+static void gen_spawn(FILE *out);
+static void gen_signature(VM *vm, FILE *out, Function_metadata *func);
+static void gen_function(Generation *g);
+static void gen_instr(Generation *g, int i, int d);
+
+static bool returns_value(Function_metadata *func)
+{
+	return func->return_type>=INT_TYPE && func->return_type<=VECTOR_TYPE;
+}
+
+bool vm_generate_c(VM *vm, FILE *out)
+{
+	if ( vm->instrs==NULL && !vm_predecode(vm) ) return false;
+	if ( vm_function(vm, "main")==NULL ) {
+		fprintf(stderr, "no main function\n");
+		return false;
+	}
+
+	gen_prologue(vm, out);
+	if ( uses_tasks(vm) ) gen_spawn(out);
+	for (int f = 0; f < vm->num_functions; f++) {
+		gen_signature(vm, out, &vm->functions[f]);
+		fprintf(out, ";\n");
+	}
+	bool ok = true;
+	for (int f = 0; ok && f < vm->num_functions; f++) {
+		Generation g = {0};
+		g.vm = vm;
+		g.out = out;
+		g.func = &vm->functions[f];
+		g.start = g.func->entry;
+		g.end = vm_function_end(vm, g.func);
+		int n = g.end - g.start;
+		g.depth = malloc((n+1) * sizeof(int));
+		g.label = calloc((size_t)n+1, sizeof(bool));
+		ok = vm_analyze_stack(vm, g.func, g.depth, g.label, &g.max_depth);
+		if ( ok ) gen_function(&g);
+		free(g.depth);
+		free(g.label);
+	}
+	if ( !ok ) return false;
+
+	fprintf(out, "\nint main(int argc, char *argv[])\n{\n");
+	fprintf(out, "\tinit_strings();\n");
+	fprintf(out, "\tw_main();\n");
+	fprintf(out, "\thalt();\n");
+	fprintf(out, "\treturn 0;\n}\n");
+	return true;
+}
+
+/* Write s as a C string literal */
+static void gen_string(FILE *out, const char *s)
+{
+	fputc('"', out);
+	for (const unsigned char *p = (const unsigned char *)s; *p!='\0'; p++) {
+		if ( *p=='"' || *p=='\\' || *p=='?' ) fprintf(out, "\\%c", *p);
+		else if ( *p=='\n' ) fprintf(out, "\\n");
+		else if ( *p=='\t' ) fprintf(out, "\\t");
+		else if ( *p<' ' || *p>'~' ) fprintf(out, "\\%03o", *p);
+		else fputc(*p, out);
+	}
+	fputc('"', out);
+}
+
+/* The element type, string table and the bits of vm.c the program needs */
+static void gen_prologue(VM *vm, FILE *out)
+{
+	fprintf(out, "/* generated by wcc; do not edit */\n");
+	fprintf(out, "#include <stdio.h>\n");
+	fprintf(out, "#include <stdlib.h>\n");
+	fprintf(out, "#include <string.h>\n");
+	fprintf(out, "#include <wich.h>\n\n");
+	fprintf(out, "typedef union {\n");
+	fprintf(out, "\tint i;\n");
+	fprintf(out, "\tfloat f;\n");
+	fprintf(out, "\tbool b;\n");
+	fprintf(out, "\tString *s;\n");
+	fprintf(out, "\tPVector_ptr vptr;\n");
+	fprintf(out, "} element;\n\n");
+
+	// the string table then DEFAULT_STRING_VALUE, as Strings outside the GC heap like vm->string_pool
+	int n = vm->num_strings + 1;
+	fprintf(out, "static char *literals[] = {\n");
+	for (int k = 0; k < n; k++) {
+		fprintf(out, "\t");
+		gen_string(out, k < vm->num_strings ? vm->strings[k] : DEFAULT_STRING_VALUE);
+		fprintf(out, ",\n");
+	}
+	fprintf(out, "};\n\n");
+	fprintf(out, "static String *strings[%d];\n\n", n);
+	fprintf(out, "static void init_strings()\n{\n");
+	fprintf(out, "\tfor (int k = 0; k < %d; k++) {\n", n);
+	fprintf(out, "\t\tsize_t length = strlen(literals[k]);\n");
+	fprintf(out, "\t\tstrings[k] = calloc(1, sizeof(String) + length + 1);\n");
+	fprintf(out, "\t\tstrings[k]->length = length;\n");
+	fprintf(out, "\t\tmemcpy(strings[k]->str, literals[k], length + 1);\n");
+	fprintf(out, "\t}\n}\n\n");
+
+	fprintf(out, "static void zero_division_error()\n{\n");
+	fprintf(out, "\tfprintf(stderr, \"ZeroDivisionError: Divisor cann't be 0\\n\");\n}\n\n");
+	fprintf(out, "static void halt()\n{\n");
+	fprintf(out, "\tgc();\n");
+	fprintf(out, "\tHeap_Info info = get_heap_info();\n");
+	fprintf(out, "\tif ( info.live!=0 ) fprintf(stderr, \"%%d objects remain after collection\\n\", info.live);\n");
+	fprintf(out, "\texit(0);\n}\n\n");
+}
+
+static bool uses_tasks(VM *vm)
+{
+	for (int i = 0; i < vm->num_instrs; i++) {
+		if ( vm_base_opcode(vm->instrs[i].opcode)==SPAWN ) return true;
+	}
+	return false;
+}
+
+/* Tasks run one after the other: SPAWN makes the call on the spot and keeps
+ * its result for JOIN.
+ */
+static void gen_spawn(FILE *out)
+{
+	fprintf(out, "static element *spawned;\n");
+	fprintf(out, "static int num_spawned;\n\n");
+	fprintf(out, "static int spawn(element result)\n{\n");
+	fprintf(out, "\tspawned = realloc(spawned, (num_spawned+1) * sizeof(element));\n");
+	fprintf(out, "\tspawned[num_spawned] = result;\n");
+	fprintf(out, "\treturn num_spawned++;\n}\n\n");
+}
+
+static void gen_signature(VM *vm, FILE *out, Function_metadata *func)
+{
+	fprintf(out, "static %s w_%s(", returns_value(func) ? "element" : "void", func->name);
+	for (int a = 0; a < func->nargs; a++) {
+		fprintf(out, "%selement l%d", a>0 ? ", " : "", a);
+	}
+	fprintf(out, "%s)", func->nargs==0 ? "void" : "");
+}
+
+static void gen_function(Generation *g)
+{
+	FILE *out = g->out;
+	const Decoded_Instr *code = g->vm->instrs;
+	bool gc_frame = false;
+	g->nvars = g->func->nargs + g->func->nlocals; // vm_predecode() made these cover every local used
+	for (int i = g->start; i < g->end; i++) {
+		if ( g->depth[i - g->start]>=0 && vm_base_opcode(code[i].opcode)==GC_START ) gc_frame = true;
+	}
+
+	fprintf(out, "\n");
+	gen_signature(g->vm, out, g->func);
+	fprintf(out, "\n{\n");
+	for (int k = g->func->nargs; k < g->nvars; k++) fprintf(out, "\telement l%d = {0};\n", k);
+	for (int k = 0; k < g->max_depth; k++) fprintf(out, "\telement s%d;\n", k);
+	if ( gc_frame ) fprintf(out, "\tint save_gc_roots = 0;\n");
+	for (int i = g->start; i < g->end; i++) {
+		int d = g->depth[i - g->start];
+		if ( d<0 ) continue; // unreachable
+		if ( g->label[i - g->start] ) fprintf(out, "L%d: ;\n", i - g->start);
+		gen_instr(g, i, d);
+	}
+	if ( returns_value(g->func) ) fprintf(out, "\tabort(); // no RET\n");
+	fprintf(out, "}\n");
+}
+
+/* A call of func on the d-nargs..d-1 stack entries */
+static void gen_call(FILE *out, Function_metadata *func, int d)
+{
+	fprintf(out, "w_%s(", func->name);
+	for (int a = 0; a < func->nargs; a++) fprintf(out, "%ss%d", a>0 ? ", " : "", d - func->nargs + a);
+	fprintf(out, ")");
+}
+
+/* Instruction i with d operands on the stack; s<d-1> is the top */
+static void gen_instr(Generation *g, int i, int d)
+{
+	FILE *out = g->out;
+	VM *vm = g->vm;
+	const Decoded_Instr *I = &vm->instrs[i];
+	int opcode = vm_base_opcode(I->opcode);
+	int top = d-1, next = d-2;
+	Function_metadata *callee;
+
+	fprintf(out, "\t");
+	switch ( opcode ) {
+		case IADD: fprintf(out, "s%d.i = s%d.i + s%d.i;", next, next, top); break;
+		case ISUB: fprintf(out, "s%d.i = s%d.i - s%d.i;", next, next, top); break;
+		case IMUL: fprintf(out, "s%d.i = s%d.i * s%d.i;", next, next, top); break;
+		case IDIV:
+			fprintf(out, "if ( s%d.i==0 ) zero_division_error(); else s%d.i = s%d.i / s%d.i;", top, next, next, top);
+			break;
+		case FADD: fprintf(out, "s%d.f = s%d.f + s%d.f;", next, next, top); break;
+		case FSUB: fprintf(out, "s%d.f = s%d.f - s%d.f;", next, next, top); break;
+		case FMUL: fprintf(out, "s%d.f = s%d.f * s%d.f;", next, next, top); break;
+		case FDIV:
+			fprintf(out, "if ( s%d.f==0 ) zero_division_error(); else s%d.f = s%d.f / s%d.f;", top, next, next, top);
+			break;
+		case OR:   fprintf(out, "s%d.b = s%d.b || s%d.b;", next, next, top); break;
+		case AND:  fprintf(out, "s%d.b = s%d.b && s%d.b;", next, next, top); break;
+		case INEG: fprintf(out, "s%d.i = -s%d.i;", top, top); break;
+		case FNEG: fprintf(out, "s%d.f = -s%d.f;", top, top); break;
+		case NOT:  fprintf(out, "s%d.b = !s%d.b;", top, top); break;
+		case I2F:  fprintf(out, "s%d.f = s%d.i;", top, top); break;
+		case F2I:  fprintf(out, "s%d.i = (int)s%d.f;", top, top); break;
+		case IEQ:  fprintf(out, "s%d.b = s%d.i == s%d.i;", next, next, top); break;
+		case INEQ: fprintf(out, "s%d.b = s%d.i != s%d.i;", next, next, top); break;
+		case ILT:  fprintf(out, "s%d.b = s%d.i < s%d.i;", next, next, top); break;
+		case ILE:  fprintf(out, "s%d.b = s%d.i <= s%d.i;", next, next, top); break;
+		case IGT:  fprintf(out, "s%d.b = s%d.i > s%d.i;", next, next, top); break;
+		case IGE:  fprintf(out, "s%d.b = s%d.i >= s%d.i;", next, next, top); break;
+		case FEQ:  fprintf(out, "s%d.b = s%d.f == s%d.f;", next, next, top); break;
+		case FNEQ: fprintf(out, "s%d.b = s%d.f != s%d.f;", next, next, top); break;
+		case FLT:  fprintf(out, "s%d.b = s%d.f < s%d.f;", next, next, top); break;
+		case FLE:  fprintf(out, "s%d.b = s%d.f <= s%d.f;", next, next, top); break;
+		case FGT:  fprintf(out, "s%d.b = s%d.f > s%d.f;", next, next, top); break;
+		case FGE:  fprintf(out, "s%d.b = s%d.f >= s%d.f;", next, next, top); break;
+
+		case VADD: fprintf(out, "s%d.vptr = Vector_add(s%d.vptr, s%d.vptr);", next, next, top); break;
+		case VSUB: fprintf(out, "s%d.vptr = Vector_sub(s%d.vptr, s%d.vptr);", next, next, top); break;
+		case VMUL: fprintf(out, "s%d.vptr = Vector_mul(s%d.vptr, s%d.vptr);", next, next, top); break;
+		case VDIV: fprintf(out, "s%d.vptr = Vector_div(s%d.vptr, s%d.vptr);", next, next, top); break;
+		case VADDI: case VSUBI: case VMULI: case VDIVI:
+		case VADDF: case VSUBF: case VMULF: case VDIVF: {
+			char *op = opcode<=VADDF ? "add" : opcode<=VSUBF ? "sub" : opcode<=VMULF ? "mul" : "div";
+			bool scalar_int = opcode==VADDI || opcode==VSUBI || opcode==VMULI || opcode==VDIVI;
+			char field = scalar_int ? 'i' : 'f';
+			if ( opcode==VDIVI || opcode==VDIVF ) {
+				fprintf(out, "if ( s%d.%c==0 ) zero_division_error(); else ", top, field);
+			}
+			fprintf(out, "s%d.vptr = Vector_%s_scalar(s%d.vptr, s%d.%c);", next, op, next, top, field);
+			break;
+		}
+		case SADD:
+			fprintf(out, "s%d.s = String_add(s%d.s, s%d.s);", next, next, top);
+			break;
+		case I2S: fprintf(out, "s%d.s = String_from_int(s%d.i);", top, top); break;
+		case F2S: fprintf(out, "s%d.s = String_from_float((float)s%d.f);", top, top); break;
+		case V2S: fprintf(out, "s%d.s = String_from_vector(s%d.vptr);", top, top); break;
+		case SEQ: case SNEQ: case SGT: case SGE: case SLT: case SLE: {
+			char *op = opcode==SEQ ? "eq" : opcode==SNEQ ? "neq" : opcode==SGT ? "gt" :
+					   opcode==SGE ? "ge" : opcode==SLT ? "lt" : "le";
+			fprintf(out, "s%d.b = String_%s(s%d.s, s%d.s);", next, op, next, top);
+			break;
+		}
+		case VEQ: fprintf(out, "s%d.b = Vector_eq(s%d.vptr, s%d.vptr);", next, top, next); break;
+		case VNEQ: fprintf(out, "s%d.b = Vector_neq(s%d.vptr, s%d.vptr);", next, top, next); break;
+
+		case BR: fprintf(out, "goto L%d;", I->target - g->start); break;
+		case BRF: fprintf(out, "if ( !s%d.b ) goto L%d;", top, I->target - g->start); break;
+
+		case ICONST: fprintf(out, "s%d.i = %d;", d, I->opnd.i); break;
+		case FCONST: fprintf(out, "s%d.f = %a; // %g", d, I->opnd.f, I->opnd.f); break;
+		case SCONST: fprintf(out, "s%d.s = strings[%d];", d, I->opnd.i); break;
+		case ILOAD: case FLOAD: case VLOAD: case SLOAD:
+			fprintf(out, "s%d = l%d;", d, I->opnd.i);
+			break;
+		case STORE: fprintf(out, "l%d = s%d;", I->opnd.i, top); break;
+
+		case VECTOR: {
+			int n = vm->instrs[i-1].opnd.i; // count pushed by the ICONST before
+			int first = top - n;
+			if ( n==0 ) {
+				fprintf(out, "s%d.vptr = PVector_init(0, 0);", first);
+				break;
+			}
+			fprintf(out, "{ double data[%d];", n);
+			for (int j = 0; j < n; j++) fprintf(out, " data[%d] = s%d.f;", j, first+j);
+			fprintf(out, " s%d.vptr = Vector_new(data, %d); }", first, n);
+			break;
+		}
+		case VLOAD_INDEX: fprintf(out, "s%d.f = ith(s%d.vptr, s%d.i-1);", next, next, top); break;
+		case STORE_INDEX: fprintf(out, "set_ith(s%d.vptr, s%d.i-1, s%d.f);", d-3, next, top); break;
+		case SLOAD_INDEX:
+			fprintf(out, "if ( s%d.i-1 >= s%d.s->length ) fprintf(stderr, \"StringIndexOutOfRange: %%d\\n\", (int)s%d.s->length);",
+					top, next, next);
+			fprintf(out, " else s%d.s = String_from_char(s%d.s->str[s%d.i-1]);", next, next, top);
+			break;
+		case PUSH_DFLT_RETV: {
+			int type = g->func->return_type;
+			if ( type==INT_TYPE ) fprintf(out, "s%d.i = %d;", d, DEFAULT_INT_VALUE);
+			else if ( type==FLOAT_TYPE ) fprintf(out, "s%d.f = %a;", d, DEFAULT_FLOAT_VALUE);
+			else if ( type==BOOLEAN_TYPE ) fprintf(out, "s%d.b = %d;", d, DEFAULT_BOOLEAN_VALUE);
+			else if ( type==STRING_TYPE ) fprintf(out, "s%d.s = strings[%d];", d, vm->num_strings);
+			else if ( type==VECTOR_TYPE ) fprintf(out, "s%d.vptr = PVector_init(0, 0);", d);
+			else fprintf(out, ";");
+			break;
+		}
+		case POP: fprintf(out, ";"); break;
+
+		case CALL:
+			callee = &vm->functions[I->opnd.i];
+			if ( returns_value(callee) ) fprintf(out, "s%d = ", d - callee->nargs);
+			gen_call(out, callee, d);
+			fprintf(out, ";");
+			break;
+		case SPAWN:
+			callee = &vm->functions[I->opnd.i];
+			if ( returns_value(callee) ) {
+				fprintf(out, "s%d.i = spawn(", d - callee->nargs);
+				gen_call(out, callee, d);
+				fprintf(out, ");");
+			}
+			else {
+				gen_call(out, callee, d);
+				fprintf(out, "; s%d.i = spawn((element){0});", d - callee->nargs);
+			}
+			break;
+		case JOIN:
+			if ( returns_value(&vm->functions[I->opnd.i]) ) fprintf(out, "s%d = spawned[s%d.i];", top, top);
+			else fprintf(out, ";");
+			break;
+		case RET:
+			if ( returns_value(g->func) ) fprintf(out, "return s%d;", top);
+			else fprintf(out, "return;");
+			break;
+
+		case IPRINT: fprintf(out, "printf(\"%%d\\n\", s%d.i);", top); break;
+		case FPRINT: fprintf(out, "printf(\"%%1.2f\\n\", s%d.f);", top); break;
+		case BPRINT: fprintf(out, "printf(\"%%d\\n\", s%d.b);", top); break;
+		case SPRINT: fprintf(out, "printf(\"%%s\\n\", s%d.s->str);", top); break;
+		case VPRINT: fprintf(out, "print_vector(s%d.vptr);", top); break;
+		case VLEN: fprintf(out, "s%d.i = Vector_len(s%d.vptr);", top, top); break;
+		case SLEN: fprintf(out, "s%d.i = String_len(s%d.s);", top, top); break;
+		case COPY_VECTOR:
+			fprintf(out, "if ( s%d.vptr.vector!=NULL ) s%d.vptr = Vector_copy(s%d.vptr);", top, top, top);
+			fprintf(out, " else fprintf(stderr, \"Vector reference cannot be found\\n\");");
+			break;
+
+		case GC_START: fprintf(out, "save_gc_roots = gc_num_roots();"); break;
+		case GC_END: fprintf(out, "gc_set_num_roots(save_gc_roots);"); break;
+		case SROOT: case VROOT: // there's no stack entry to root below the bottom of the stack
+			if ( d>0 ) fprintf(out, "gc_add_root((void **)&s%d.%s);", top, opcode==SROOT ? "s" : "vptr");
+			else fprintf(out, ";");
+			break;
+
+		case HALT: fprintf(out, "halt();"); break;
+		case NOP: case SNAPSHOT: case YIELD: fprintf(out, ";"); break;
+	}
+	fprintf(out, "\n");
+}
@@ -0,0 +1,44 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2015 Terence Parr, Hanzhou Shi, Shuai Yuan, Yuanyuan Zhang
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+#ifndef CGEN_H_
+#define CGEN_H_
+
+#include "vm.h"
+
+/* Ahead-of-time compilation of a loaded program to C (see wcc.c).
+ *
+ * Each function becomes a C function taking its arguments as element
+ * parameters. Locals and the operand stack, whose depth is known statically
+ * at every instruction, become C variables, branches become gotos and the
+ * vector, string and gc instructions become the same runtime library calls
+ * vm_exec() makes. Tasks run one after the other, each SPAWN making its
+ * call on the spot. The result includes only <wich.h> and links against
+ * wlib_mark_and_compact and the collector it uses.
+ *
+ * Returns false, having written nothing useful, if some function's
+ * stack use can't be determined statically.
+ */
+extern bool vm_generate_c(VM *vm, FILE *out);
+
+#endif
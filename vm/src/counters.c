@@ -0,0 +1,103 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2015 Terence Parr, Hanzhou Shi, Shuai Yuan, Yuanyuan Zhang
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <wich.h>
+#include "vm.h"
+#include "counters.h"
+#include "superinstructions.h"
+
+void vm_count(VM *vm, FILE *out)
+{
+	Exec_Counters *c = calloc(1, sizeof(Exec_Counters));
+	c->pairs = calloc(NUM_HANDLERS+1, sizeof(*c->pairs));
+	c->functions = calloc((size_t)vm->num_functions, sizeof(Function_Counters));
+	c->out = out;
+	vm->counters = c;
+}
+
+static Function_Counters *frame_counters(VM *vm, int i)
+{
+	return &vm->counters->functions[vm->call_stack[i].func - vm->functions];
+}
+
+void vm_count_call(VM *vm)
+{
+	Function_Counters *f = frame_counters(vm, vm->callsp);
+	f->calls++;
+	if ( f->active++==0 ) f->entered = vm->counters->instructions;
+}
+
+static void leave(VM *vm, int i)
+{
+	Function_Counters *f = frame_counters(vm, i);
+	// only the outermost of recursive calls counts, so instructions aren't counted twice
+	if ( --f->active==0 ) f->instructions += vm->counters->instructions - f->entered;
+}
+
+void vm_count_ret(VM *vm)
+{
+	leave(vm, vm->callsp);
+}
+
+static void write_counts(VM *vm, FILE *out)
+{
+	Exec_Counters *c = vm->counters;
+	char *sep = "";
+	fprintf(out, "{\n\t\"instructions\": %lu,\n\t\"opcodes\": {", c->instructions);
+	for (int op = 0; op < NUM_HANDLERS; op++) {
+		if ( c->opcodes[op]==0 ) continue;
+		fprintf(out, "%s\n\t\t\"%s\": %lu", sep, vm_handler_name(op), c->opcodes[op]);
+		sep = ",";
+	}
+	fprintf(out, "\n\t},\n\t\"pairs\": {");
+	sep = "";
+	for (int a = 0; a < NUM_HANDLERS; a++) {
+		for (int b = 0; b < NUM_HANDLERS; b++) {
+			if ( c->pairs[a][b]==0 ) continue;
+			fprintf(out, "%s\n\t\t\"%s %s\": %lu", sep, vm_handler_name(a), vm_handler_name(b), c->pairs[a][b]);
+			sep = ",";
+		}
+	}
+	fprintf(out, "\n\t},\n\t\"functions\": {");
+	sep = "";
+	for (int i = 0; i < vm->num_functions; i++) {
+		Function_Counters *f = &c->functions[i];
+		if ( f->calls==0 ) continue;
+		fprintf(out, "%s\n\t\t\"%s\": { \"calls\": %lu, \"instructions\": %lu }",
+				sep, vm->functions[i].name, f->calls, f->instructions);
+		sep = ",";
+	}
+	fprintf(out, "\n\t}\n}\n");
+}
+
+void vm_count_halt(VM *vm)
+{
+	for (int i = vm->callsp; i >= 0; i--) leave(vm, i);
+	write_counts(vm, vm->counters->out);
+	free(vm->counters->pairs);
+	free(vm->counters->functions);
+	free(vm->counters);
+	vm->counters = NULL;
+}
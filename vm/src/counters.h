@@ -0,0 +1,70 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2015 Terence Parr, Hanzhou Shi, Shuai Yuan, Yuanyuan Zhang
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+#ifndef COUNTERS_H_
+#define COUNTERS_H_
+
+#include <stdio.h>
+#include "vm.h"
+
+typedef struct {
+	unsigned long calls;
+	unsigned long instructions;	// executed while the function was on the call stack, callees included
+	unsigned long entered;		// instruction count at the outermost active call
+	int active;					// calls of the function on the call stack
+} Function_Counters;
+
+typedef struct exec_counters {
+	unsigned long instructions;
+	unsigned long opcodes[NUM_HANDLERS];
+	unsigned long (*pairs)[NUM_HANDLERS];	// pairs[a][b]: b ran right after a; row NUM_HANDLERS is the first instruction
+	Function_Counters *functions;			// indexed like vm->functions
+	FILE *out;
+} Exec_Counters;
+
+/* Have the next vm_exec() run the counting interpreter, which counts every
+ * handler executed (superinstructions are counted as themselves), every pair
+ * of consecutive handlers, and the calls to and instructions executed within
+ * each function. Natively compiled code isn't counted, so the JIT is off for
+ * the run; so is tracing, which takes precedence if asked for. At HALT the
+ * counts are written to out as JSON and freed:
+ *
+ *     {
+ *         "instructions": 1234,
+ *         "opcodes": { "ILOAD": 300, ... },
+ *         "pairs": { "ILOAD ICONST": 100, ... },
+ *         "functions": { "main": { "calls": 1, "instructions": 1234 }, ... }
+ *     }
+ *
+ * Pairs and functions that never ran are left out.
+ */
+extern void vm_count(VM *vm, FILE *out);
+
+/* Called by the counting interpreter on entry to and exit from the function
+ * on top of the call stack and at HALT
+ */
+extern void vm_count_call(VM *vm);
+extern void vm_count_ret(VM *vm);
+extern void vm_count_halt(VM *vm);
+
+#endif
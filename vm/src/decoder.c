@@ -0,0 +1,319 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2015 Terence Parr, Hanzhou Shi, Shuai Yuan, Yuanyuan Zhang
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+#include <wich.h>
+#include "vm.h"
+#include "decoder.h"
+#include "superinstructions.h"
+
+static inline int int32(const byte *data, addr32 ip);
+static inline int int16(const byte *data, addr32 ip);
+static inline float float32(const byte *data, addr32 ip);
+#ifndef PROFILE_NGRAMS
+static void mark_tail_calls(VM *vm);
+#endif
+
+bool vm_predecode(VM *vm)
+{
+	const byte *code = vm->code;
+	bool ok = true;
+
+	// map each byte address to the index of the instruction starting there (or -1)
+	int *index_of = malloc((vm->code_size+1) * sizeof(int));
+	for (int a = 0; a <= vm->code_size; a++) index_of[a] = -1;
+
+	int n = 0;
+	for (addr32 ip = 0; ip < vm->code_size; n++) {
+		index_of[ip] = n;
+		int opcode = code[ip];
+		if ( opcode >= NUM_INSTRS ) {
+			fprintf(stderr, "invalid opcode: %d at ip=%d\n", opcode, ip);
+			free(index_of);
+			return false;
+		}
+		ip += 1 + vm_instructions[opcode].opnd_size;
+	}
+	index_of[vm->code_size] = n; // falling off the end hits the HALT sentinel
+
+	Decoded_Instr *instrs = calloc((size_t)n+1, sizeof(Decoded_Instr));
+	int i = 0;
+	for (addr32 ip = 0; ip < vm->code_size; i++) {
+		Decoded_Instr *I = &instrs[i];
+		I->opcode = code[ip];
+		I->addr = ip;
+		switch ( vm_instructions[I->opcode].opnd_size ) {
+			case 2:
+				I->opnd.i = int16(code, ip+1);
+				break;
+			case 4:
+				I->opnd.i = int32(code, ip+1); // FCONST too; same bits
+				break;
+			default:
+				break;
+		}
+		if ( I->opcode==BR || I->opcode==BRF ) {
+			int target = (int)ip + I->opnd.i; // offsets are relative to the branch instruction
+			if ( target<0 || target>vm->code_size || index_of[target]<0 ) {
+				fprintf(stderr, "invalid branch target %d at ip=%d\n", target, ip);
+				ok = false;
+				target = vm->code_size;
+			}
+			I->target = (addr32)index_of[target];
+		}
+		ip += 1 + vm_instructions[I->opcode].opnd_size;
+	}
+	instrs[n].opcode = HALT;
+	instrs[n].addr = (addr32)vm->code_size;
+
+	for (int f = 0; f < vm->num_functions; f++) {
+		Function_metadata *func = &vm->functions[f];
+		if ( func->address>vm->code_size || index_of[func->address]<0 ) {
+			fprintf(stderr, "invalid address %d for function %s\n", func->address, func->name);
+			ok = false;
+			func->entry = (addr32)n;
+			continue;
+		}
+		func->entry = (addr32)index_of[func->address];
+	}
+
+	free(index_of);
+	free(vm->instrs);
+	vm->instrs = instrs;
+	vm->num_instrs = n;
+
+	// frames hold exactly nargs+nlocals elements but the compiler's locals
+	// count can come up short; cover every local the code uses
+	for (int f = 0; f < vm->num_functions; f++) {
+		Function_metadata *func = &vm->functions[f];
+		int end = vm_function_end(vm, func);
+		for (int i = func->entry; i < end; i++) {
+			int opcode = instrs[i].opcode;
+			bool local = opcode==ILOAD || opcode==FLOAD || opcode==SLOAD || opcode==VLOAD || opcode==STORE;
+			if ( local && instrs[i].opnd.i>=func->nargs+func->nlocals ) {
+				func->nlocals = instrs[i].opnd.i + 1 - func->nargs;
+			}
+		}
+	}
+
+#ifndef PROFILE_NGRAMS // profile the plain instruction stream
+	vm_fuse_superinstructions(vm);
+	mark_tail_calls(vm);
+#endif
+	return ok;
+}
+
+#ifndef PROFILE_NGRAMS
+/* A CALL followed by RET, or by GC_END and RET, returns the callee's result
+ * as is so the callee can take over the caller's frame. Like a
+ * superinstruction, only the CALL is rewritten. Without a GC_END the roots
+ * a function registered would outlive its frame, so in that case only
+ * functions that root nothing qualify.
+ */
+static void mark_tail_calls(VM *vm)
+{
+	Decoded_Instr *code = vm->instrs;
+	for (int f = 0; f < vm->num_functions; f++) {
+		Function_metadata *func = &vm->functions[f];
+		int end = vm_function_end(vm, func);
+		bool roots = false;
+		for (int i = func->entry; i < end; i++) {
+			int opcode = vm_base_opcode(code[i].opcode);
+			if ( opcode==SROOT || opcode==VROOT ) roots = true;
+		}
+		for (int i = func->entry; i+1 < end; i++) {
+			if ( code[i].opcode!=CALL ) continue;
+			bool ret = code[i+1].opcode==RET && !roots;
+			bool gc_ret = i+2<end && code[i+1].opcode==GC_END && code[i+2].opcode==RET;
+			if ( ret || gc_ret ) code[i].opcode = TAIL_CALL;
+		}
+	}
+}
+#endif
+
+int vm_function_end(VM *vm, Function_metadata *func)
+{
+	int end = vm->num_instrs;
+	for (int f = 0; f < vm->num_functions; f++) {
+		int e = vm->functions[f].entry;
+		if ( e>func->entry && e<end ) end = e;
+	}
+	return end;
+}
+
+bool vm_stack_effect(VM *vm, Function_metadata *func, const Decoded_Instr *code, int i, int *pops, int *pushes)
+{
+	int opcode = vm_base_opcode(code[i].opcode);
+	bool returns_value = func->return_type>=INT_TYPE && func->return_type<=VECTOR_TYPE;
+	*pops = 0;
+	*pushes = 0;
+	switch ( opcode ) {
+		case IADD: case ISUB: case IMUL: case IDIV:
+		case FADD: case FSUB: case FMUL: case FDIV:
+		case VADD: case VADDI: case VADDF: case VSUB: case VSUBI: case VSUBF:
+		case VMUL: case VMULI: case VMULF: case VDIV: case VDIVI: case VDIVF:
+		case SADD: case OR: case AND:
+		case IEQ: case INEQ: case ILT: case ILE: case IGT: case IGE:
+		case FEQ: case FNEQ: case FLT: case FLE: case FGT: case FGE:
+		case SEQ: case SNEQ: case SGT: case SGE: case SLT: case SLE:
+		case VEQ: case VNEQ:
+		case VLOAD_INDEX: case SLOAD_INDEX:
+			*pops = 2; *pushes = 1;
+			break;
+		case INEG: case FNEG: case NOT:
+		case I2F: case F2I: case I2S: case F2S: case V2S:
+		case VLEN: case SLEN: case COPY_VECTOR:
+			*pops = 1; *pushes = 1;
+			break;
+		case ICONST: case FCONST: case SCONST:
+		case ILOAD: case FLOAD: case VLOAD: case SLOAD:
+			*pushes = 1;
+			break;
+		case STORE: case BRF: case POP:
+		case IPRINT: case FPRINT: case BPRINT: case SPRINT: case VPRINT:
+			*pops = 1;
+			break;
+		case STORE_INDEX:
+			*pops = 3;
+			break;
+		case VECTOR:
+			if ( i==0 || vm_base_opcode(code[i-1].opcode)!=ICONST ) return false;
+			*pops = 1 + code[i-1].opnd.i;
+			*pushes = 1;
+			break;
+		case PUSH_DFLT_RETV:
+			*pushes = returns_value;
+			break;
+		case CALL: {
+			Function_metadata *callee = &vm->functions[code[i].opnd.i];
+			*pops = callee->nargs;
+			*pushes = callee->return_type>=INT_TYPE && callee->return_type<=VECTOR_TYPE;
+			break;
+		}
+		case SPAWN: // pushes the task's handle
+			*pops = vm->functions[code[i].opnd.i].nargs;
+			*pushes = 1;
+			break;
+		case JOIN: {
+			Function_metadata *callee = &vm->functions[code[i].opnd.i];
+			*pops = 1;
+			*pushes = callee->return_type>=INT_TYPE && callee->return_type<=VECTOR_TYPE;
+			break;
+		}
+		case RET:
+			*pops = returns_value;
+			break;
+		case HALT: case BR: case NOP: case SNAPSHOT: case YIELD:
+		case GC_START: case GC_END: case SROOT: case VROOT:
+			break;
+		default:
+			return false;
+	}
+	return true;
+}
+
+bool vm_analyze_stack(VM *vm, Function_metadata *func, int *depth, bool *label, int *max_depth)
+{
+	const Decoded_Instr *code = vm->instrs;
+	int start = func->entry;
+	int end = vm_function_end(vm, func);
+	int n = end - start;
+	int *work = malloc((n+1) * sizeof(int));
+	int nwork = 0;
+	bool ok = true;
+
+	for (int i = 0; i <= n; i++) depth[i] = -1;
+	*max_depth = 0;
+	depth[0] = 0;
+	work[nwork++] = start;
+	while ( ok && nwork>0 ) {
+		int i = work[--nwork];
+		int d = depth[i - start];
+		int pops, pushes;
+		if ( !vm_stack_effect(vm, func, code, i, &pops, &pushes) || pops>d ) {
+			fprintf(stderr, "can't analyze %s: bad stack at %s ip=%d\n",
+					func->name, vm_handler_name(code[i].opcode), code[i].addr);
+			ok = false;
+			break;
+		}
+		d = d - pops + pushes;
+		if ( d>*max_depth ) *max_depth = d;
+
+		int succ[2], nsucc = 0;
+		switch ( vm_base_opcode(code[i].opcode) ) {
+			case RET:
+				if ( d!=0 ) {
+					fprintf(stderr, "can't analyze %s: %d values left on stack at ip=%d\n",
+							func->name, d, code[i].addr);
+					ok = false;
+				}
+				break;
+			case HALT:
+				break;
+			case BR:
+				succ[nsucc++] = code[i].target;
+				break;
+			case BRF:
+				succ[nsucc++] = code[i].target;
+				succ[nsucc++] = i+1;
+				break;
+			default:
+				succ[nsucc++] = i+1;
+				break;
+		}
+		for (int s = 0; ok && s < nsucc; s++) {
+			int j = succ[s];
+			if ( j<start || j>=end ) {
+				fprintf(stderr, "can't analyze %s: control leaves function at ip=%d\n",
+						func->name, code[i].addr);
+				ok = false;
+			}
+			else if ( depth[j - start]<0 ) {
+				depth[j - start] = d;
+				work[nwork++] = j;
+			}
+			else if ( depth[j - start]!=d ) {
+				fprintf(stderr, "can't analyze %s: inconsistent stack depth at ip=%d\n",
+						func->name, code[j].addr);
+				ok = false;
+			}
+			if ( ok && j!=i+1 ) label[j - start] = true;
+		}
+	}
+	free(work);
+	return ok;
+}
+
+static inline int int32(const byte *data, addr32 ip)
+{
+	return *((word32 *)&data[ip]);
+}
+
+static inline float float32(const byte *data, addr32 ip)
+{
+	return *((float *)&data[ip]);
+}
+
+static inline int int16(const byte *data, addr32 ip)
+{
+	return *((short *)&data[ip]); // could be negative value
+}
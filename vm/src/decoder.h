@@ -0,0 +1,58 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2015 Terence Parr, Hanzhou Shi, Shuai Yuan, Yuanyuan Zhang
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+#include "vm.h"
+
+/* Translate vm->code into vm->instrs, an array of fixed-width Decoded_Instr
+ * records that vm_exec() runs from. Operands are decoded once here rather
+ * than on every execution, branch targets are resolved to instruction
+ * indexes and each function learns the index of its first instruction.
+ * A function's nlocals grows to cover every local its code uses. Common
+ * instruction sequences are then fused into superinstructions and calls in
+ * tail position become TAIL_CALLs.
+ * Returns false if the byte code is malformed.
+ */
+extern bool vm_predecode(VM *vm);
+
+/* Index just past the last instruction of func; function bodies are the runs
+ * of instructions between function entry points.
+ */
+extern int vm_function_end(VM *vm, Function_metadata *func);
+
+/* How many operands instruction code[i] of func pops and pushes, for analyses
+ * that track the operand stack depth statically. A function returns by
+ * leaving its value (if it has a non-void return type) on the stack for the
+ * caller. VECTOR pops its element count and then that many elements, so the
+ * count must come from the ICONST at code[i-1]. Returns false if the effect
+ * can't be determined.
+ */
+extern bool vm_stack_effect(VM *vm, Function_metadata *func, const Decoded_Instr *code, int i, int *pops, int *pushes);
+
+/* Find the operand stack depth before each reachable instruction of func with
+ * a worklist pass over its control flow graph; depth[k] and label[k] describe
+ * instruction func->entry+k and must have room for every instruction up to
+ * vm_function_end(). Unreachable instructions get depth -1 and label[k] is set
+ * for branch targets. Fails unless every instruction has a single depth and
+ * RET leaves nothing but the return value, which holds for compiler output.
+ */
+extern bool vm_analyze_stack(VM *vm, Function_metadata *func, int *depth, bool *label, int *max_depth);
@@ -0,0 +1,492 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2015 Terence Parr, Hanzhou Shi, Shuai Yuan, Yuanyuan Zhang
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stddef.h>
+#include <wich.h>
+#include "vm.h"
+#include "decoder.h"
+#include "superinstructions.h"
+#include "jit.h"
+
+#if defined(__x86_64__)
+#include <sys/mman.h>
+
+/* Register use in native code; rbx, r12-r14 survive calls into C.
+ *
+ *   rbx  address of the top of the operand stack, &vm->stack[vm->sp]
+ *   r12  frame->locals
+ *   r13  vm
+ *   r14  frame
+ *
+ * vm->sp is only kept up to date around calls out of native code.
+ */
+enum { RAX=0, RCX=1, RDX=2, RBX=3, RSP=4, RBP=5, RSI=6, RDI=7,
+	   R8=8, R9=9, R10=10, R11=11, R12=12, R13=13, R14=14, R15=15 };
+
+// condition codes for Jcc and SETcc
+enum { CC_AE=0x3, CC_E=0x4, CC_NE=0x5, CC_A=0x7, CC_P=0xA, CC_NP=0xB,
+	   CC_L=0xC, CC_GE=0xD, CC_LE=0xE, CC_G=0xF };
+
+#define ESIZE ((int)sizeof(element))
+
+typedef struct {
+	byte *buf;
+	int n, max;
+	int *native_pc;		// offset in buf of each instruction of the function
+	int *fixups;		// offsets of rel32 branch displacements to patch...
+	int *targets;		// ...with the offset of these instructions
+	int nfixups;
+} Code;
+
+static void emit1(Code *c, int x)
+{
+	if ( c->n>=c->max ) {
+		c->max = c->max==0 ? 1024 : c->max*2;
+		c->buf = realloc(c->buf, (size_t)c->max);
+	}
+	c->buf[c->n++] = (byte)x;
+}
+
+static void emit4(Code *c, int x)
+{
+	for (int i = 0; i < 4; i++) emit1(c, (x >> (8*i)) & 0xFF);
+}
+
+static void emit8(Code *c, unsigned long long x)
+{
+	for (int i = 0; i < 8; i++) emit1(c, (int)((x >> (8*i)) & 0xFF));
+}
+
+static void emitn(Code *c, const char *bytes, int n)
+{
+	for (int i = 0; i < n; i++) emit1(c, (byte)bytes[i]);
+}
+
+/* Emit op reg,[base+disp32] (or the reverse, depending on op). prefix is a
+ * mandatory prefix such as F3 or 0; op2 is the second opcode byte after 0F
+ * or -1.
+ */
+static void mem(Code *c, int prefix, bool w, int op, int op2, int reg, int base, int disp)
+{
+	if ( prefix ) emit1(c, prefix);
+	int rex = 0x40 | (w ? 8 : 0) | ((reg & 8) ? 4 : 0) | ((base & 8) ? 1 : 0);
+	if ( rex!=0x40 ) emit1(c, rex);
+	emit1(c, op);
+	if ( op2>=0 ) emit1(c, op2);
+	emit1(c, 0x80 | ((reg & 7) << 3) | (base & 7));
+	if ( (base & 7)==RSP ) emit1(c, 0x24); // r12 as base needs a SIB byte
+	emit4(c, disp);
+}
+
+#define LOAD32(reg, base, disp)		mem(c, 0, false, 0x8B, -1, reg, base, disp)
+#define STORE32(base, disp, reg)	mem(c, 0, false, 0x89, -1, reg, base, disp)
+#define LOAD64(reg, base, disp)		mem(c, 0, true, 0x8B, -1, reg, base, disp)
+#define STORE64(base, disp, reg)	mem(c, 0, true, 0x89, -1, reg, base, disp)
+#define LEA(reg, base, disp)		mem(c, 0, true, 0x8D, -1, reg, base, disp)
+#define MOVSS_LOAD(x, base, disp)	mem(c, 0xF3, false, 0x0F, 0x10, x, base, disp)
+#define MOVSS_STORE(base, disp, x)	mem(c, 0xF3, false, 0x0F, 0x11, x, base, disp)
+#define SSE_OP(op, x, base, disp)	mem(c, 0xF3, false, 0x0F, op, x, base, disp)
+#define PUSH_SLOT()					emitn(c, "\x48\x83\xC3", 3), emit1(c, ESIZE)	// add rbx,ESIZE
+#define POP_SLOT()					emitn(c, "\x48\x83\xEB", 3), emit1(c, ESIZE)	// sub rbx,ESIZE
+
+static void copy_element(Code *c, int dst_base, int dst_disp, int src_base, int src_disp)
+{
+	if ( ESIZE==16 ) {
+		mem(c, 0, false, 0x0F, 0x10, 0, src_base, src_disp);	// movups xmm0,src
+		mem(c, 0, false, 0x0F, 0x11, 0, dst_base, dst_disp);	// movups dst,xmm0
+	}
+	else {
+		LOAD64(RAX, src_base, src_disp);
+		STORE64(dst_base, dst_disp, RAX);
+	}
+}
+
+static void call(Code *c, void *f)
+{
+	emitn(c, "\x48\xB8", 2);		// mov rax,f
+	emit8(c, (unsigned long long)f);
+	emitn(c, "\xFF\xD0", 2);		// call rax
+}
+
+static int shift()
+{
+	int s = 0;
+	while ( (1 << s)<ESIZE ) s++;
+	return s;
+}
+
+// vm->sp = rbx - vm->stack
+static void store_sp(Code *c)
+{
+	emitn(c, "\x48\x89\xD8", 3);			// mov rax,rbx
+	LOAD64(RCX, R13, offsetof(VM, stack));
+	emitn(c, "\x48\x29\xC8", 3);			// sub rax,rcx
+	emitn(c, "\x48\xC1\xF8", 3);			// sar rax,shift
+	emit1(c, shift());
+	STORE32(R13, offsetof(VM, sp), RAX);
+}
+
+// rbx = &vm->stack[vm->sp]
+static void load_sp(Code *c)
+{
+	mem(c, 0, true, 0x63, -1, RAX, R13, offsetof(VM, sp));	// movsxd rax,vm->sp
+	emitn(c, "\x48\xC1\xE0", 3);			// shl rax,shift
+	emit1(c, shift());
+	LOAD64(RBX, R13, offsetof(VM, stack));
+	emitn(c, "\x48\x01\xC3", 3);			// add rbx,rax
+}
+
+static void branch(Code *c, int cc, int target)
+{
+	if ( cc<0 ) emit1(c, 0xE9);				// jmp rel32
+	else { emit1(c, 0x0F); emit1(c, 0x80 | cc); } // jcc rel32
+	c->fixups = realloc(c->fixups, (c->nfixups+1) * sizeof(int));
+	c->targets = realloc(c->targets, (c->nfixups+1) * sizeof(int));
+	c->fixups[c->nfixups] = c->n;
+	c->targets[c->nfixups] = target;
+	c->nfixups++;
+	emit4(c, 0);
+}
+
+// forward branch within a template; returns where to patch
+static int local_branch(Code *c, int cc)
+{
+	if ( cc<0 ) emit1(c, 0xE9);
+	else { emit1(c, 0x0F); emit1(c, 0x80 | cc); }
+	emit4(c, 0);
+	return c->n - 4;
+}
+
+static void patch_here(Code *c, int at)
+{
+	int rel = c->n - (at + 4);
+	memcpy(&c->buf[at], &rel, 4);
+}
+
+static void int_binary(Code *c, int op)	// [rbx-ESIZE] op= [rbx]
+{
+	LOAD32(RAX, RBX, 0);
+	POP_SLOT();
+	mem(c, 0, false, op, -1, RAX, RBX, 0);
+}
+
+static void int_compare(Code *c, int cc)
+{
+	int_binary(c, 0x39);							// cmp [rbx],eax
+	mem(c, 0, false, 0x0F, 0x90 | cc, 0, RBX, 0);	// setcc [rbx]
+}
+
+static void float_binary(Code *c, int op)
+{
+	MOVSS_LOAD(0, RBX, -ESIZE);
+	SSE_OP(op, 0, RBX, 0);
+	POP_SLOT();
+	MOVSS_STORE(RBX, 0, 0);
+}
+
+/* a op b for a=[rbx-ESIZE], b=[rbx]; swap to test b op' a */
+static void float_compare(Code *c, int cc, bool swap)
+{
+	MOVSS_LOAD(0, RBX, swap ? 0 : -ESIZE);
+	mem(c, 0, false, 0x0F, 0x2E, 0, RBX, swap ? -ESIZE : 0);	// ucomiss xmm0,other
+	if ( cc==CC_E || cc==CC_NE ) { // unordered (NaN) compares unequal
+		emit1(c, 0x0F); emit1(c, 0x90 | cc); emit1(c, 0xC0);		// setcc al
+		emit1(c, 0x0F); emit1(c, 0x90 | (cc==CC_E ? CC_NP : CC_P)); emit1(c, 0xC1); // setnp/setp cl
+		emitn(c, cc==CC_E ? "\x20\xC8" : "\x08\xC8", 2);		// and/or al,cl
+	}
+	else {
+		emit1(c, 0x0F); emit1(c, 0x90 | cc); emit1(c, 0xC0);
+	}
+	POP_SLOT();
+	mem(c, 0, false, 0x88, -1, RAX, RBX, 0);	// mov [rbx],al
+}
+
+static void prologue(Code *c)
+{
+	emitn(c, "\x53\x41\x54\x41\x55\x41\x56\x41\x57", 9);	// push rbx,r12-r15; aligns rsp
+	emitn(c, "\x49\x89\xFD", 3);						// mov r13,rdi
+	emitn(c, "\x49\x89\xF6", 3);						// mov r14,rsi
+	LOAD64(R12, R14, offsetof(Activation_Record, locals));
+	load_sp(c);
+}
+
+static void epilogue(Code *c)
+{
+	store_sp(c);
+	emitn(c, "\x41\x5F\x41\x5E\x41\x5D\x41\x5C\x5B\xC3", 10);	// pop r15-r12,rbx; ret
+}
+
+/* Let the interpreter's implementation run the instruction */
+static void slow_op(Code *c, int opcode, int opnd)
+{
+	store_sp(c);
+	emitn(c, "\x4C\x89\xEF", 3);			// mov rdi,r13
+	emit1(c, 0xBE); emit4(c, opcode);		// mov esi,opcode
+	emit1(c, 0xBA); emit4(c, opnd);			// mov edx,opnd
+	LOAD64(RCX, R13, offsetof(VM, stack));
+	LOAD32(R8, R13, offsetof(VM, sp));
+	call(c, (void *)vm_exec_slow_op);
+	STORE32(R13, offsetof(VM, sp), RAX);
+	load_sp(c);
+}
+
+/* Tail recursion becomes a loop: the args replace the frame's, the locals
+ * are cleared as vm_call() would and we jump back to the first instruction.
+ * Tail calls to other functions nest like any other call.
+ */
+static void self_tail_call(Code *c, Function_metadata *func, const Decoded_Instr *I)
+{
+	if ( I[1].opcode==GC_END ) { // the frame's roots go with it
+		LOAD32(RDI, R14, offsetof(Activation_Record, save_gc_roots));
+		call(c, (void *)gc_set_num_roots);
+	}
+	for (int k = 0; k < func->nargs; k++) {
+		copy_element(c, R12, k*ESIZE, RBX, (k - func->nargs + 1)*ESIZE);
+	}
+	emitn(c, "\x31\xC0", 2);							// xor eax,eax
+	for (int k = func->nargs; k <= func->nargs+func->nlocals; k++) {
+		for (int w = 0; w < ESIZE; w += 8) STORE64(R12, k*ESIZE + w, RAX);
+	}
+	LEA(RBX, R12, (func->nargs+func->nlocals)*ESIZE);
+	branch(c, -1, 0);
+}
+
+static bool compile_instr(Code *c, VM *vm, Function_metadata *func, const Decoded_Instr *I, int start, int end)
+{
+	int opcode = vm_base_opcode(I->opcode);
+	int at;
+	switch ( opcode ) {
+		case IADD: int_binary(c, 0x01); break;		// add [rbx],eax
+		case ISUB: int_binary(c, 0x29); break;		// sub [rbx],eax
+		case IMUL:
+			LOAD32(RAX, RBX, -ESIZE);
+			mem(c, 0, false, 0x0F, 0xAF, RAX, RBX, 0);	// imul eax,[rbx]
+			POP_SLOT();
+			STORE32(RBX, 0, RAX);
+			break;
+		case IDIV: {
+			LOAD32(RCX, RBX, 0);
+			POP_SLOT();
+			emitn(c, "\x85\xC9", 2);					// test ecx,ecx
+			at = local_branch(c, CC_NE);
+			call(c, (void *)vm_zero_division_error);	// leaves the dividend
+			int done = local_branch(c, -1);
+			patch_here(c, at);
+			LOAD32(RAX, RBX, 0);
+			emitn(c, "\x99\xF7\xF9", 3);				// cdq; idiv ecx
+			STORE32(RBX, 0, RAX);
+			patch_here(c, done);
+			break;
+		}
+		case FADD: float_binary(c, 0x58); break;
+		case FSUB: float_binary(c, 0x5C); break;
+		case FMUL: float_binary(c, 0x59); break;
+		case FDIV: {
+			emitn(c, "\x0F\x57\xC9", 3);				// xorps xmm1,xmm1
+			mem(c, 0, false, 0x0F, 0x2E, 1, RBX, 0);	// ucomiss xmm1,[rbx]
+			int nonzero = local_branch(c, CC_NE);
+			int nan = local_branch(c, CC_P);
+			POP_SLOT();
+			call(c, (void *)vm_zero_division_error);
+			int done = local_branch(c, -1);
+			patch_here(c, nonzero);
+			patch_here(c, nan);
+			float_binary(c, 0x5E);
+			patch_here(c, done);
+			break;
+		}
+		case OR:
+		case AND:
+			mem(c, 0, false, 0x8A, -1, RAX, RBX, 0);	// mov al,[rbx]
+			POP_SLOT();
+			mem(c, 0, false, opcode==OR ? 0x08 : 0x20, -1, RAX, RBX, 0); // or/and [rbx],al
+			break;
+		case INEG: mem(c, 0, false, 0xF7, -1, 3, RBX, 0); break;	// neg dword [rbx]
+		case FNEG: mem(c, 0, false, 0x81, -1, 6, RBX, 0); emit4(c, (int)0x80000000); break; // xor sign
+		case NOT:  mem(c, 0, false, 0x80, -1, 6, RBX, 0); emit1(c, 1); break;	// xor byte [rbx],1
+		case I2F:
+			SSE_OP(0x2A, 0, RBX, 0);					// cvtsi2ss xmm0,[rbx]
+			MOVSS_STORE(RBX, 0, 0);
+			break;
+		case F2I:
+			SSE_OP(0x2C, RAX, RBX, 0);					// cvttss2si eax,[rbx]
+			STORE32(RBX, 0, RAX);
+			break;
+		case IEQ:  int_compare(c, CC_E); break;
+		case INEQ: int_compare(c, CC_NE); break;
+		case ILT:  int_compare(c, CC_L); break;
+		case ILE:  int_compare(c, CC_LE); break;
+		case IGT:  int_compare(c, CC_G); break;
+		case IGE:  int_compare(c, CC_GE); break;
+		case FEQ:  float_compare(c, CC_E, false); break;
+		case FNEQ: float_compare(c, CC_NE, false); break;
+		case FLT:  float_compare(c, CC_A, true); break;
+		case FLE:  float_compare(c, CC_AE, true); break;
+		case FGT:  float_compare(c, CC_A, false); break;
+		case FGE:  float_compare(c, CC_AE, false); break;
+		case BR:
+		case BRF:
+			if ( I->target<start || I->target>=end ) return false;
+			if ( opcode==BR ) {
+				branch(c, -1, I->target - start);
+				break;
+			}
+			mem(c, 0, false, 0x8A, -1, RAX, RBX, 0);	// mov al,[rbx]
+			POP_SLOT();
+			emitn(c, "\x84\xC0", 2);					// test al,al
+			branch(c, CC_E, I->target - start);
+			break;
+		case ICONST:
+		case FCONST:
+			PUSH_SLOT();
+			mem(c, 0, false, 0xC7, -1, 0, RBX, 0);		// mov dword [rbx],imm32
+			emit4(c, I->opnd.i);
+			break;
+		case SCONST:
+			emitn(c, "\x48\xB8", 2);					// mov rax,string
+			emit8(c, (unsigned long long)vm->string_objects[I->opnd.i]);
+			PUSH_SLOT();
+			STORE64(RBX, 0, RAX);
+			break;
+		case ILOAD:
+		case FLOAD:
+			LOAD32(RAX, R12, I->opnd.i * ESIZE);
+			PUSH_SLOT();
+			STORE32(RBX, 0, RAX);
+			break;
+		case SLOAD:
+			LOAD64(RAX, R12, I->opnd.i * ESIZE);
+			PUSH_SLOT();
+			STORE64(RBX, 0, RAX);
+			break;
+		case VLOAD:
+			PUSH_SLOT();
+			copy_element(c, RBX, 0, R12, I->opnd.i * ESIZE);
+			break;
+		case STORE:
+			copy_element(c, R12, I->opnd.i * ESIZE, RBX, 0);
+			POP_SLOT();
+			break;
+		case POP:
+			POP_SLOT();
+			break;
+		case NOP:
+			break;
+		case CALL:
+			if ( I->opcode==TAIL_CALL && &vm->functions[I->opnd.i]==func ) {
+				self_tail_call(c, func, I);
+				break;
+			}
+			store_sp(c);
+			emitn(c, "\x4C\x89\xEF", 3);				// mov rdi,r13
+			emit1(c, 0xBE); emit4(c, I->opnd.i);		// mov esi,f
+			call(c, (void *)vm_jit_call);
+			load_sp(c);
+			break;
+		case RET:
+			epilogue(c);
+			break;
+		case GC_START:
+			call(c, (void *)gc_num_roots);
+			STORE32(R14, offsetof(Activation_Record, save_gc_roots), RAX);
+			break;
+		case GC_END:
+			LOAD32(RDI, R14, offsetof(Activation_Record, save_gc_roots));
+			call(c, (void *)gc_set_num_roots);
+			break;
+		case SROOT:
+		case VROOT:
+			emitn(c, "\x48\x89\xDF", 3);				// mov rdi,rbx
+			call(c, (void *)gc_add_root);
+			break;
+		case PUSH_DFLT_RETV:
+			slow_op(c, opcode, func->return_type);
+			break;
+		case HALT:
+		case SNAPSHOT: // stays interpreted so vm_snapshot() sees its frame
+		case SPAWN:
+		case YIELD:
+		case JOIN:		// a task can only suspend in interpreted frames; see tasks.h
+			return false;
+		default:
+			slow_op(c, opcode, 0);
+			break;
+	}
+	return true;
+}
+
+bool vm_jit_compile(VM *vm, Function_metadata *func)
+{
+	int start = func->entry;
+	int end = vm_function_end(vm, func);
+	Code code = {0};
+	Code *c = &code;
+	bool ok = end>start;
+	c->native_pc = malloc((end-start+1) * sizeof(int));
+
+	prologue(c);
+	for (int i = start; ok && i < end; i++) {
+		c->native_pc[i - start] = c->n;
+		ok = compile_instr(c, vm, func, &vm->instrs[i], start, end);
+	}
+	c->native_pc[end - start] = c->n;
+	emitn(c, "\x0F\x0B", 2); // ud2; compiled code doesn't fall into the next function
+
+	void *native = NULL;
+	if ( ok ) {
+		for (int f = 0; f < c->nfixups; f++) {
+			int rel = c->native_pc[c->targets[f]] - (c->fixups[f] + 4);
+			memcpy(&c->buf[c->fixups[f]], &rel, 4);
+		}
+		native = mmap(NULL, (size_t)c->n, PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANON, -1, 0);
+		if ( native==MAP_FAILED ) {
+			native = NULL;
+		}
+		else {
+			memcpy(native, c->buf, (size_t)c->n);
+			if ( mprotect(native, (size_t)c->n, PROT_READ|PROT_EXEC)!=0 ) { // W^X systems may refuse
+				munmap(native, (size_t)c->n);
+				native = NULL;
+			}
+		}
+	}
+	free(c->buf);
+	free(c->native_pc);
+	free(c->fixups);
+	free(c->targets);
+	func->native = native;
+	func->native_size = native!=NULL ? (size_t)c->n : 0;
+	return native!=NULL;
+}
+
+#else
+
+bool vm_jit_compile(VM *vm, Function_metadata *func)
+{
+	return false;
+}
+
+#endif
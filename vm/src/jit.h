@@ -0,0 +1,51 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2015 Terence Parr, Hanzhou Shi, Shuai Yuan, Yuanyuan Zhang
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+#ifndef JIT_H_
+#define JIT_H_
+
+#include "vm.h"
+
+/* A baseline template JIT for x86-64. vm_call() counts calls per function
+ * and, once a function has been called vm->jit_threshold times, compiles
+ * its instructions one template at a time into native code that works on
+ * the same operand stack and activation records as vm_exec(). Integer and
+ * float arithmetic, loads, stores and branches are inline; everything else
+ * calls the routines the interpreter uses. Calls out of native code go
+ * through vm_jit_call(), so callees run natively or interpreted as
+ * appropriate. On other architectures nothing is compiled.
+ */
+
+typedef void (*Native_Function)(VM *vm, Activation_Record *frame);
+
+/* Compile func, setting func->native. Returns false (leaving func to the
+ * interpreter) if the function contains something the JIT can't handle.
+ */
+extern bool vm_jit_compile(VM *vm, Function_metadata *func);
+
+/* Call function f from native code: the arguments are on the operand stack
+ * and the return value, if any, is left there.
+ */
+extern void vm_jit_call(VM *vm, int f);
+
+#endif
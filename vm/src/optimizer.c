@@ -0,0 +1,384 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2015 Terence Parr, Hanzhou Shi, Shuai Yuan, Yuanyuan Zhang
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <wich.h>
+#include "vm.h"
+#include "decoder.h"
+#include "superinstructions.h"
+#include "optimizer.h"
+
+// an instruction of the code being optimized
+typedef struct {
+	int opcode;
+	union {
+		int i;
+		float f;
+	} opnd;
+	int target;		// BR/BRF: index of target instruction
+	bool label;		// starts a basic block: a branch target or function entry
+	bool live;		// still part of the code
+} Op;
+
+// state of the optimization of the whole program
+typedef struct {
+	VM *vm;
+	Op *ops;		// vm->instrs with plain opcodes; ops[n] is the HALT sentinel
+	int n;
+} Optimization;
+
+static bool fold(Optimization *o, int start, int end);
+static bool thread_jumps(Optimization *o, int start, int end);
+static bool remove_unreachable(Optimization *o, int start, int end);
+static void find_labels(Optimization *o);
+static void emit(Optimization *o);
+
+bool vm_optimize(VM *vm)
+{
+	if ( vm->instrs==NULL && !vm_predecode(vm) ) return false;
+	Optimization o = {0};
+	o.vm = vm;
+	o.n = vm->num_instrs;
+	o.ops = calloc((size_t)o.n+1, sizeof(Op));
+	for (int i = 0; i <= o.n; i++) {
+		const Decoded_Instr *I = &vm->instrs[i];
+		o.ops[i].opcode = vm_base_opcode(I->opcode);
+		o.ops[i].opnd.i = I->opnd.i;
+		o.ops[i].target = I->target;
+		o.ops[i].live = true;
+	}
+
+	// branches that leave their function can't be relocated
+	for (int f = 0; f < vm->num_functions; f++) {
+		Function_metadata *func = &vm->functions[f];
+		int end = vm_function_end(vm, func);
+		for (int i = func->entry; i < end; i++) {
+			Op *op = &o.ops[i];
+			if ( (op->opcode==BR || op->opcode==BRF) && (op->target<func->entry || op->target>=end) ) {
+				free(o.ops);
+				return false;
+			}
+		}
+		if ( func->entry>=o.n ) {
+			free(o.ops);
+			return false;
+		}
+	}
+
+	bool changed = true;
+	while ( changed ) {
+		changed = false;
+		find_labels(&o);
+		for (int f = 0; f < vm->num_functions; f++) {
+			Function_metadata *func = &vm->functions[f];
+			int end = vm_function_end(vm, func);
+			// fold first; it relies on the labels, which the others can move
+			changed |= fold(&o, func->entry, end);
+			changed |= thread_jumps(&o, func->entry, end);
+			changed |= remove_unreachable(&o, func->entry, end);
+		}
+	}
+
+	emit(&o);
+	free(o.ops);
+	vm->verified = false;
+	return vm_predecode(vm);
+}
+
+static inline int next_live(Optimization *o, int i, int end)
+{
+	while ( i<end && !o->ops[i].live ) i++;
+	return i;
+}
+
+// only 0 and 1 are safe to treat as booleans; the VM looks at one byte
+static inline bool boolean(int a) { return a==0 || a==1; }
+
+/* x = op x, if x is a constant op can fold */
+static bool fold_unary(Op *x, Op *op)
+{
+	if ( x->opcode==ICONST ) {
+		int a = x->opnd.i;
+		switch ( op->opcode ) {
+			case INEG: x->opnd.i = (int)(0u - (unsigned)a); return true;
+			case NOT:
+				if ( !boolean(a) ) return false;
+				x->opnd.i = !a;
+				return true;
+			case I2F: x->opcode = FCONST; x->opnd.f = (float)a; return true;
+			default: return false;
+		}
+	}
+	if ( x->opcode==FCONST ) {
+		float a = x->opnd.f;
+		switch ( op->opcode ) {
+			case FNEG: x->opnd.f = -a; return true;
+			case F2I:
+				if ( !(a>=(float)INT_MIN && a<(float)INT_MAX) ) return false;
+				x->opcode = ICONST;
+				x->opnd.i = (int)a;
+				return true;
+			default: return false;
+		}
+	}
+	return false;
+}
+
+/* x = x op y, if both are constants op can fold; run time errors stay */
+static bool fold_binary(Op *x, Op *y, Op *op)
+{
+	if ( x->opcode==ICONST && y->opcode==ICONST ) {
+		int a = x->opnd.i, b = y->opnd.i;
+		int r;
+		switch ( op->opcode ) {
+			case IADD: r = (int)((unsigned)a + (unsigned)b); break;
+			case ISUB: r = (int)((unsigned)a - (unsigned)b); break;
+			case IMUL: r = (int)((unsigned)a * (unsigned)b); break;
+			case IDIV:
+				if ( b==0 || (a==INT_MIN && b==-1) ) return false;
+				r = a / b;
+				break;
+			case IEQ: r = a==b; break;
+			case INEQ: r = a!=b; break;
+			case ILT: r = a<b; break;
+			case ILE: r = a<=b; break;
+			case IGT: r = a>b; break;
+			case IGE: r = a>=b; break;
+			case OR:
+				if ( !boolean(a) || !boolean(b) ) return false;
+				r = a || b;
+				break;
+			case AND:
+				if ( !boolean(a) || !boolean(b) ) return false;
+				r = a && b;
+				break;
+			default: return false;
+		}
+		x->opnd.i = r;
+		return true;
+	}
+	if ( x->opcode==FCONST && y->opcode==FCONST ) {
+		float a = x->opnd.f, b = y->opnd.f;
+		int r;
+		switch ( op->opcode ) {
+			case FADD: x->opnd.f = a + b; return true;
+			case FSUB: x->opnd.f = a - b; return true;
+			case FMUL: x->opnd.f = a * b; return true;
+			case FDIV:
+				if ( b==0 ) return false;
+				x->opnd.f = a / b;
+				return true;
+			case FEQ: r = a==b; break;
+			case FNEQ: r = a!=b; break;
+			case FLT: r = a<b; break;
+			case FLE: r = a<=b; break;
+			case FGT: r = a>b; break;
+			case FGE: r = a>=b; break;
+			default: return false;
+		}
+		x->opcode = ICONST; // booleans are ints in the byte code
+		x->opnd.i = r;
+		return true;
+	}
+	return false;
+}
+
+/* Fold constants within basic blocks; the result replaces the first
+ * instruction of a sequence, which keeps any label.
+ */
+static bool fold(Optimization *o, int start, int end)
+{
+	Op *ops = o->ops;
+	bool changed = false;
+	int i = next_live(o, start, end);
+	while ( i<end ) {
+		Op *x = &ops[i];
+		int j = next_live(o, i+1, end);
+		int k = next_live(o, j+1, end);
+		if ( x->opcode==NOP ) {
+			x->live = false;
+			changed = true;
+			i = j;
+			continue;
+		}
+		if ( j<end && !ops[j].label ) {
+			Op *op = &ops[j];
+			if ( fold_unary(x, op) ) {
+				op->live = false;
+				changed = true;
+				continue; // the result may fold further
+			}
+			if ( x->opcode==ICONST && boolean(x->opnd.i) && op->opcode==BRF ) {
+				if ( x->opnd.i ) op->live = false; // never taken
+				else op->opcode = BR;
+				x->live = false;
+				changed = true;
+				i = next_live(o, i, end);
+				continue;
+			}
+			if ( k<end && !ops[k].label && fold_binary(x, op, &ops[k]) ) {
+				op->live = false;
+				ops[k].live = false;
+				changed = true;
+				continue;
+			}
+		}
+		i = j;
+	}
+	return changed;
+}
+
+/* Send branches to other branches straight to the final target and drop
+ * branches to the next instruction.
+ */
+static bool thread_jumps(Optimization *o, int start, int end)
+{
+	Op *ops = o->ops;
+	bool changed = false;
+	for (int i = next_live(o, start, end); i < end; i = next_live(o, i+1, end)) {
+		Op *op = &ops[i];
+		if ( op->opcode!=BR && op->opcode!=BRF ) continue;
+		int t = next_live(o, op->target, end);
+		for (int hops = 0; t<end && ops[t].opcode==BR && hops<end-start; hops++) { // BR to itself loops
+			t = next_live(o, ops[t].target, end);
+		}
+		if ( t!=op->target ) {
+			op->target = t;
+			changed = true;
+		}
+		if ( t==next_live(o, i+1, end) ) {
+			if ( op->opcode==BR ) op->live = false;
+			else op->opcode = POP; // the condition still has to go
+			changed = true;
+		}
+	}
+	return changed;
+}
+
+/* Remove what no path from the function's entry reaches */
+static bool remove_unreachable(Optimization *o, int start, int end)
+{
+	Op *ops = o->ops;
+	int n = end - start;
+	bool *reached = calloc((size_t)n+1, sizeof(bool));
+	int *work = malloc((n+1) * sizeof(int));
+	int nwork = 0;
+	int entry = next_live(o, start, end);
+	if ( entry<end ) {
+		reached[entry - start] = true;
+		work[nwork++] = entry;
+	}
+	while ( nwork>0 ) {
+		int i = work[--nwork];
+		int succ[2], nsucc = 0;
+		switch ( ops[i].opcode ) {
+			case RET: case HALT:
+				break;
+			case BR:
+				succ[nsucc++] = next_live(o, ops[i].target, end);
+				break;
+			case BRF:
+				succ[nsucc++] = next_live(o, ops[i].target, end);
+				succ[nsucc++] = next_live(o, i+1, end);
+				break;
+			default:
+				succ[nsucc++] = next_live(o, i+1, end);
+				break;
+		}
+		for (int s = 0; s < nsucc; s++) {
+			int j = succ[s];
+			if ( j>=start && j<end && !reached[j - start] ) {
+				reached[j - start] = true;
+				work[nwork++] = j;
+			}
+		}
+	}
+	bool changed = false;
+	for (int i = start; i < end; i++) {
+		if ( ops[i].live && !reached[i - start] ) {
+			ops[i].live = false;
+			changed = true;
+		}
+	}
+	free(work);
+	free(reached);
+	return changed;
+}
+
+static void find_labels(Optimization *o)
+{
+	for (int i = 0; i <= o->n; i++) o->ops[i].label = false;
+	for (int i = 0; i < o->n; i++) {
+		Op *op = &o->ops[i];
+		if ( op->live && (op->opcode==BR || op->opcode==BRF) ) {
+			o->ops[next_live(o, op->target, o->n)].label = true;
+		}
+	}
+	for (int f = 0; f < o->vm->num_functions; f++) {
+		o->ops[next_live(o, o->vm->functions[f].entry, o->n)].label = true;
+	}
+}
+
+/* Write the live instructions over vm->code */
+static void emit(Optimization *o)
+{
+	VM *vm = o->vm;
+	int *addr = malloc((o->n+1) * sizeof(int)); // a removed instruction's is that of the next one left
+	int size = 0;
+	for (int i = 0; i < o->n; i++) {
+		addr[i] = size;
+		if ( o->ops[i].live ) size += 1 + vm_instructions[o->ops[i].opcode].opnd_size;
+	}
+	addr[o->n] = size;
+
+	byte *code = vm->code;
+	for (int i = 0; i < o->n; i++) {
+		Op *op = &o->ops[i];
+		if ( !op->live ) continue;
+		int a = addr[i];
+		int opnd = op->opnd.i;
+		if ( op->opcode==BR || op->opcode==BRF ) opnd = addr[op->target] - a; // relative to the branch
+		code[a] = (byte)op->opcode;
+		switch ( vm_instructions[op->opcode].opnd_size ) {
+			case 2: {
+				short s = (short)opnd;
+				memcpy(&code[a+1], &s, 2);
+				break;
+			}
+			case 4:
+				memcpy(&code[a+1], &opnd, 4);
+				break;
+			default:
+				break;
+		}
+	}
+	code[size] = HALT; // sentinel
+	vm->code_size = size;
+	for (int f = 0; f < vm->num_functions; f++) {
+		vm->functions[f].address = (addr32)addr[vm->functions[f].entry];
+	}
+	free(addr);
+}
@@ -0,0 +1,42 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2015 Terence Parr, Hanzhou Shi, Shuai Yuan, Yuanyuan Zhang
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+#ifndef OPTIMIZER_H_
+#define OPTIMIZER_H_
+
+#include "vm.h"
+
+/* Optional load-time optimization of the byte code. Working on the basic
+ * blocks of each function, it folds arithmetic, comparisons, conversions
+ * and conditional branches on constants, points branches to other branches
+ * straight at their final target, drops branches to the next instruction
+ * and NOPs, and removes code no path from the function's entry reaches
+ * (such as the PUSH_DFLT_RETV the compiler puts after a return).
+ *
+ * The code is rewritten in place, as it can only shrink, with branch
+ * offsets and each function's address relocated, and then pre-decoded
+ * again. Returns false, leaving the code alone, if it's malformed.
+ */
+extern bool vm_optimize(VM *vm);
+
+#endif
@@ -0,0 +1,199 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2015 Terence Parr, Hanzhou Shi, Shuai Yuan, Yuanyuan Zhang
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <wich.h>
+#include "vm.h"
+#include "output.h"
+
+static const int MAX_NUMBER_LEN = 320; // "%1.2f" of the largest double
+
+static void write_output(VM *vm, const char *s, size_t len)
+{
+	if ( vm->capture_output ) {
+		size_t n = vm->captured_len + len;
+		if ( n>vm->captured_max ) {
+			vm->captured_max = n>2*vm->captured_max ? n : 2*vm->captured_max;
+			vm->captured = realloc(vm->captured, vm->captured_max);
+		}
+		memcpy(vm->captured+vm->captured_len, s, len);
+		vm->captured_len = n;
+	}
+	else fwrite(s, 1, len, stdout);
+}
+
+void vm_flush_output(VM *vm)
+{
+	if ( vm->output_len==0 ) return;
+	write_output(vm, vm->output, (size_t)vm->output_len);
+	vm->output_len = 0;
+}
+
+void vm_write_output(VM *vm, const char *s, size_t len)
+{
+	vm_flush_output(vm);
+	write_output(vm, s, len);
+}
+
+char *vm_take_output(VM *vm, size_t *len)
+{
+	vm_flush_output(vm);
+	char *s = vm->captured;
+	*len = vm->captured_len;
+	vm->captured = NULL;
+	vm->captured_len = vm->captured_max = 0;
+	return s;
+}
+
+// room for n more bytes
+static char *reserve(VM *vm, int n)
+{
+	if ( vm->output_len+n>OUTPUT_BUFFER_SIZE ) vm_flush_output(vm);
+	return vm->output + vm->output_len;
+}
+
+// digits of u, right to left from end; returns the first
+static char *format_unsigned(char *end, unsigned long long u)
+{
+	do {
+		*--end = (char)('0' + u % 10);
+		u /= 10;
+	} while ( u!=0 );
+	return end;
+}
+
+static int format_int(char *p, int i)
+{
+	char digits[24];
+	char *end = digits + sizeof(digits);
+	char *start = format_unsigned(end, i<0 ? (unsigned long long)-(long long)i : (unsigned long long)i);
+	int n = 0;
+	if ( i<0 ) p[n++] = '-';
+	memcpy(p+n, start, (size_t)(end-start));
+	return n + (int)(end-start);
+}
+
+/* f as "%1.2f" would write it. A double is m*2^e with m below 2^53. With
+ * e>=0, f is a whole number; otherwise m*100 fits in 64 bits, and dividing
+ * it by 2^k leaves a quotient q, f's value in hundredths, and a remainder r.
+ * Rounding q on r, halfway cases to even, is exactly what printf does. Huge
+ * values, infinities and NaNs go to snprintf.
+ */
+static int format_fixed2(char *p, double f)
+{
+	unsigned long long bits;
+	memcpy(&bits, &f, sizeof(bits));
+	int exponent = (int)((bits >> 52) & 0x7ff);
+	unsigned long long m = bits & ((1ULL << 52) - 1);
+	if ( exponent!=0 ) m |= 1ULL << 52;
+	int e = (exponent==0 ? 1 : exponent) - 1075; // f = m * 2^e
+	if ( exponent==0x7ff || e>10 ) return snprintf(p, (size_t)MAX_NUMBER_LEN, "%1.2f", f);
+
+	unsigned long long q; // |f| in hundredths, rounded
+	unsigned long long whole;
+	if ( e>=0 ) {
+		whole = m << e;
+		q = 0;
+	}
+	else {
+		int k = -e;
+		if ( k>=61 ) q = 0; // m*100 < 2^60 is under half of 2^k
+		else {
+			unsigned long long scaled = m * 100;
+			unsigned long long r = scaled & ((1ULL << k) - 1);
+			unsigned long long half = 1ULL << (k-1);
+			q = scaled >> k;
+			if ( r>half || (r==half && (q & 1)) ) q++;
+		}
+		whole = q / 100;
+	}
+	int n = 0;
+	if ( bits >> 63 ) p[n++] = '-';
+	char digits[24];
+	char *end = digits + sizeof(digits);
+	char *start = format_unsigned(end, whole);
+	memcpy(p+n, start, (size_t)(end-start));
+	n += (int)(end-start);
+	p[n++] = '.';
+	p[n++] = (char)('0' + q / 10 % 10);
+	p[n++] = (char)('0' + q % 10);
+	return n;
+}
+
+void vm_print_int(VM *vm, int i)
+{
+	char *p = reserve(vm, MAX_NUMBER_LEN);
+	int n = format_int(p, i);
+	p[n++] = '\n';
+	vm->output_len += n;
+}
+
+void vm_print_float(VM *vm, double f)
+{
+	char *p = reserve(vm, MAX_NUMBER_LEN);
+	int n = format_fixed2(p, f);
+	p[n++] = '\n';
+	vm->output_len += n;
+}
+
+void vm_print_string(VM *vm, String *s)
+{
+	if ( s==NULL ) {
+		fprintf(stderr, "NullPointerError: NULL string object cannot be printed out\n");
+		return;
+	}
+	int len = (int)s->length;
+	if ( len+1>OUTPUT_BUFFER_SIZE ) { // too big to buffer
+		vm_write_output(vm, s->str, (size_t)len);
+		vm_write_output(vm, "\n", 1);
+		return;
+	}
+	char *p = reserve(vm, len+1);
+	memcpy(p, s->str, (size_t)len);
+	p[len] = '\n';
+	vm->output_len += len+1;
+}
+
+void vm_print_vector(VM *vm, PVector_ptr v)
+{
+	if ( v.vector==NULL ) {
+		fprintf(stderr, "NullPointerError: NULL Vector object Cannot be printed out\n");
+		return;
+	}
+	char *p = reserve(vm, 1);
+	*p = '[';
+	vm->output_len++;
+	for (size_t i = 0; i < v.vector->length; i++) {
+		p = reserve(vm, MAX_NUMBER_LEN+2);
+		int n = 0;
+		if ( i>0 ) { p[n++] = ','; p[n++] = ' '; }
+		n += format_fixed2(p+n, ith(v, (int)i));
+		vm->output_len += n;
+	}
+	p = reserve(vm, 2);
+	p[0] = ']';
+	p[1] = '\n';
+	vm->output_len += 2;
+}
@@ -0,0 +1,55 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2015 Terence Parr, Hanzhou Shi, Shuai Yuan, Yuanyuan Zhang
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+#ifndef OUTPUT_H_
+#define OUTPUT_H_
+
+#include "vm.h"
+
+static const int OUTPUT_BUFFER_SIZE = 64*1024;
+
+/* What IPRINT, FPRINT, BPRINT, SPRINT and VPRINT write. Output collects in
+ * vm->output and goes to stdout only when the buffer fills, at HALT and
+ * before the VM stops the program with an error, so printing doesn't
+ * allocate or call into stdio per value. Numbers are formatted by hand, but
+ * the bytes are the same as printf's "%d\n" and "%1.2f\n", and vectors are
+ * written element by element as "[1.00, 2.00]\n".
+ */
+extern void vm_print_int(VM *vm, int i);
+extern void vm_print_float(VM *vm, double f);
+extern void vm_print_string(VM *vm, String *s);
+extern void vm_print_vector(VM *vm, PVector_ptr v);
+extern void vm_flush_output(VM *vm);
+
+/* With vm->capture_output set, flushing appends to vm->captured instead of
+ * writing to stdout. vm_take_output() flushes and hands back everything
+ * captured so far, setting *len to its size; the caller frees it.
+ */
+extern char *vm_take_output(VM *vm, size_t *len);
+
+/* Write len bytes of s after whatever vm has printed, to stdout or, with
+ * vm->capture_output set, to vm->captured.
+ */
+extern void vm_write_output(VM *vm, const char *s, size_t len);
+
+#endif
@@ -0,0 +1,136 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2015 Terence Parr, Hanzhou Shi, Shuai Yuan, Yuanyuan Zhang
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <sys/time.h>
+#include <wich.h>
+#include "vm.h"
+#include "profiler.h"
+
+static const int MAX_PROFILE_DEPTH = 256;	// innermost frames kept per sample
+static const int PROFILE_POOL_SIZE = 4*1024*1024;	// ints of sample data; committed as it's touched
+
+/* Each sample is its depth followed by the index of the function of each
+ * frame, outermost first; -1 marks frames the handler couldn't identify.
+ */
+static int *pool;
+static volatile int pool_used;
+static volatile int num_samples;
+static volatile int num_dropped;
+static VM *volatile profiled;
+static struct sigaction previous_handler;
+
+static void sample(int sig)
+{
+	VM *vm = profiled;
+	if ( vm==NULL ) return;
+	int top = vm->callsp;
+	if ( top<0 || top>=MAX_CALL_STACK ) return;
+	int depth = top+1<MAX_PROFILE_DEPTH ? top+1 : MAX_PROFILE_DEPTH;
+	if ( pool_used+depth+1>PROFILE_POOL_SIZE ) {
+		num_dropped++;
+		return;
+	}
+	int *s = &pool[pool_used];
+	s[0] = depth;
+	for (int k = 0; k < depth; k++) {
+		Function_metadata *func = vm->call_stack[top - depth + 1 + k].func;
+		bool valid = func>=vm->functions && func<vm->functions+vm->num_functions;
+		s[1+k] = valid ? (int)(func - vm->functions) : -1;
+	}
+	pool_used += depth+1;
+	num_samples++;
+}
+
+bool vm_profile_start(VM *vm, int hz)
+{
+	if ( profiled!=NULL || hz<=0 ) return false;
+	if ( pool==NULL ) pool = calloc((size_t)PROFILE_POOL_SIZE, sizeof(int));
+	pool_used = num_samples = num_dropped = 0;
+	profiled = vm;
+
+	struct sigaction sa;
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_handler = sample;
+	sa.sa_flags = SA_RESTART;
+	sigemptyset(&sa.sa_mask);
+	sigaction(SIGPROF, &sa, &previous_handler);
+
+	struct itimerval timer;
+	timer.it_interval.tv_sec = 0;
+	timer.it_interval.tv_usec = hz>1000000 ? 1 : 1000000 / hz;
+	timer.it_value = timer.it_interval;
+	if ( setitimer(ITIMER_PROF, &timer, NULL)!=0 ) {
+		sigaction(SIGPROF, &previous_handler, NULL);
+		profiled = NULL;
+		return false;
+	}
+	return true;
+}
+
+static int *samples_base;
+
+static int compare_samples(const void *a, const void *b)
+{
+	const int *x = &samples_base[*(const int *)a];
+	const int *y = &samples_base[*(const int *)b];
+	if ( x[0]!=y[0] ) return x[0] - y[0];
+	return memcmp(&x[1], &y[1], (size_t)x[0] * sizeof(int));
+}
+
+static void print_stack(FILE *out, VM *vm, const int *s)
+{
+	if ( s[0]==MAX_PROFILE_DEPTH ) fprintf(out, "[truncated];");
+	for (int k = 0; k < s[0]; k++) {
+		fprintf(out, "%s%s", k>0 ? ";" : "", s[1+k]>=0 ? vm->functions[s[1+k]].name : "[unknown]");
+	}
+}
+
+void vm_profile_stop(FILE *out)
+{
+	struct itimerval off;
+	memset(&off, 0, sizeof(off));
+	setitimer(ITIMER_PROF, &off, NULL);
+	sigaction(SIGPROF, &previous_handler, NULL);
+	VM *vm = profiled;
+	profiled = NULL;
+	if ( vm==NULL ) return;
+
+	// sort the samples so that identical stacks are adjacent, then count them
+	int *index = malloc(((size_t)num_samples+1) * sizeof(int));
+	for (int p = 0, i = 0; i < num_samples; p += pool[p]+1, i++) index[i] = p;
+	samples_base = pool;
+	qsort(index, (size_t)num_samples, sizeof(int), compare_samples);
+	for (int i = 0; i < num_samples; ) {
+		int j = i+1;
+		while ( j<num_samples && compare_samples(&index[i], &index[j])==0 ) j++;
+		print_stack(out, vm, &pool[index[i]]);
+		fprintf(out, " %d\n", j - i);
+		i = j;
+	}
+	if ( num_dropped>0 ) fprintf(stderr, "profiler: %d samples dropped; buffer full\n", num_dropped);
+	free(index);
+}
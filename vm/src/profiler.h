@@ -0,0 +1,49 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2015 Terence Parr, Hanzhou Shi, Shuai Yuan, Yuanyuan Zhang
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+#ifndef PROFILER_H_
+#define PROFILER_H_
+
+#include <stdio.h>
+#include "vm.h"
+
+static const int PROFILE_HZ = 1000;	// default sampling rate
+
+/* A sampling profiler for code run by vm_exec(). While it's on, a SIGPROF
+ * timer interrupts the program hz times per second of CPU time and records
+ * the function of every frame on vm->call_stack, innermost last. Frames of
+ * natively compiled functions are on that stack too, so they are sampled
+ * like interpreted ones. Nothing is added to the interpreter's loop; the
+ * cost is the handler's walk of the call stack at each tick.
+ *
+ * vm_profile_stop() writes the samples in the folded stack format that
+ * flame graph tools read, one line per distinct stack with its count:
+ *
+ *     main;fib;fib 42
+ *
+ * Only one VM can be profiled at a time.
+ */
+extern bool vm_profile_start(VM *vm, int hz);
+extern void vm_profile_stop(FILE *out);
+
+#endif
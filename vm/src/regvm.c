@@ -0,0 +1,703 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2015 Terence Parr, Hanzhou Shi, Shuai Yuan, Yuanyuan Zhang
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <wich.h>
+#include "vm.h"
+#include "wloader.h"
+#include "decoder.h"
+#include "superinstructions.h"
+#include "regvm.h"
+#include "output.h"
+
+static const int MAX_REG_STACK = 64*1024;	// elements of register frames
+
+static char *reg_opcode_names[] = {
+	"HALT", "MOVE",
+	"IADD", "ISUB", "IMUL", "IDIV", "FADD", "FSUB", "FMUL", "FDIV", "OR", "AND",
+	"IEQ", "INEQ", "ILT", "ILE", "IGT", "IGE", "FEQ", "FNEQ", "FLT", "FLE", "FGT", "FGE",
+	"INEG", "FNEG", "NOT", "I2F", "F2I",
+	"VLOAD_INDEX", "STORE_INDEX",
+	"BR", "BRF",
+	"IEQ_BRF", "INEQ_BRF", "ILT_BRF", "ILE_BRF", "IGT_BRF", "IGE_BRF",
+	"CALL", "TAIL_CALL", "RET", "GC_START", "GC_END", "ROOT", "STACK_OP"
+};
+
+// state of the translation of one function
+typedef struct {
+	VM *vm;
+	Reg_Function *rf;
+	int start, end;		// its instructions in vm->instrs
+	int *depth;			// operand stack depth before each instruction; -1 if unreachable
+	bool *label;		// is instruction a branch target
+	int max_depth;
+	int *vstack;		// register holding each operand stack entry
+	int sp;				// virtual stack depth
+	int block_start;	// first instruction emitted since the last label
+	int *pc_of;			// index in rf->code of each instruction
+	int ncode, max_code;
+} Translation;
+
+static void collect_constants(Translation *t);
+static bool translate_function(Translation *t);
+
+Reg_Program *vm_translate_registers(VM *vm)
+{
+	Reg_Program *prog = calloc(1, sizeof(Reg_Program));
+	prog->vm = vm;
+	prog->functions = calloc((size_t)vm->num_functions, sizeof(Reg_Function));
+	for (int f = 0; f < vm->num_functions; f++) {
+		Translation t = {0};
+		t.vm = vm;
+		t.rf = &prog->functions[f];
+		t.rf->func = &vm->functions[f];
+		t.start = t.rf->func->entry;
+		t.end = vm_function_end(vm, t.rf->func);
+		int n = t.end - t.start;
+		t.depth = malloc((n+1) * sizeof(int));
+		t.label = calloc((size_t)n+1, sizeof(bool));
+		t.pc_of = malloc((n+1) * sizeof(int));
+		bool ok = vm_analyze_stack(vm, t.rf->func, t.depth, t.label, &t.max_depth);
+		if ( ok ) {
+			collect_constants(&t);
+			t.vstack = malloc((t.max_depth+1) * sizeof(int));
+			ok = translate_function(&t);
+			free(t.vstack);
+		}
+		free(t.depth);
+		free(t.label);
+		free(t.pc_of);
+		if ( !ok ) {
+			vm_free_registers(prog);
+			return NULL;
+		}
+	}
+	return prog;
+}
+
+void vm_free_registers(Reg_Program *prog)
+{
+	if ( prog==NULL ) return;
+	for (int f = 0; f < prog->vm->num_functions; f++) {
+		free(prog->functions[f].code);
+		free(prog->functions[f].consts);
+	}
+	free(prog->functions);
+	free(prog);
+}
+
+static bool returns_value(Function_metadata *func)
+{
+	return func->return_type>=INT_TYPE && func->return_type<=VECTOR_TYPE;
+}
+
+static int add_constant(Reg_Function *rf, element value)
+{
+	for (int k = 0; k < rf->nconsts; k++) {
+		if ( memcmp(&rf->consts[k], &value, sizeof(element))==0 ) return k;
+	}
+	rf->consts = realloc(rf->consts, (rf->nconsts+1) * sizeof(element));
+	rf->consts[rf->nconsts] = value;
+	return rf->nconsts++;
+}
+
+/* Constants of a scalar PUSH_DFLT_RETV; the rest need a fresh object each time */
+static bool default_value(int type, element *value)
+{
+	memset(value, 0, sizeof(element));
+	if ( type==INT_TYPE ) value->i = DEFAULT_INT_VALUE;
+	else if ( type==FLOAT_TYPE ) value->f = DEFAULT_FLOAT_VALUE;
+	else if ( type==BOOLEAN_TYPE ) value->b = DEFAULT_BOOLEAN_VALUE;
+	else return false;
+	return true;
+}
+
+/* Returns the register for the value that instruction i pushes if it's a constant, else -1 */
+static int constant_register(Translation *t, int i)
+{
+	const Decoded_Instr *I = &t->vm->instrs[i];
+	Reg_Function *rf = t->rf;
+	element value;
+	memset(&value, 0, sizeof(element));
+	switch ( vm_base_opcode(I->opcode) ) {
+		case ICONST:
+			value.i = I->opnd.i;
+			break;
+		case FCONST:
+			value.f = I->opnd.f;
+			break;
+		case SCONST:
+			value.s = t->vm->string_objects[I->opnd.i];
+			break;
+		case PUSH_DFLT_RETV:
+			if ( !default_value(rf->func->return_type, &value) ) return -1;
+			break;
+		default:
+			return -1;
+	}
+	return rf->nvars + add_constant(rf, value);
+}
+
+static void collect_constants(Translation *t)
+{
+	Reg_Function *rf = t->rf;
+	rf->nvars = rf->func->nargs + rf->func->nlocals; // vm_predecode() made these cover every local used
+	for (int i = t->start; i < t->end; i++) {
+		if ( t->depth[i - t->start]>=0 ) constant_register(t, i);
+	}
+	rf->temps = rf->nvars + rf->nconsts;
+	rf->nregs = rf->temps + t->max_depth;
+}
+
+static Reg_Instr *emit(Translation *t, int opcode, int a, int b, int c)
+{
+	Reg_Function *rf = t->rf;
+	if ( t->ncode>=t->max_code ) {
+		t->max_code = t->max_code==0 ? 64 : t->max_code*2;
+		rf->code = realloc(rf->code, t->max_code * sizeof(Reg_Instr));
+	}
+	Reg_Instr *R = &rf->code[t->ncode++];
+	R->opcode = opcode;
+	R->a = a;
+	R->b = b;
+	R->c = c;
+	return R;
+}
+
+static inline int push(Translation *t, int reg) { t->vstack[t->sp] = reg; return t->vstack[t->sp++]; }
+static inline int push_temp(Translation *t) { return push(t, t->rf->temps + t->sp); }
+static inline int pop(Translation *t) { return t->vstack[--t->sp]; }
+
+/* Copy stack entry k into its temporary if it's still just a register name */
+static void materialize(Translation *t, int k)
+{
+	int temp = t->rf->temps + k;
+	if ( t->vstack[k]!=temp ) {
+		emit(t, R_MOVE, temp, t->vstack[k], 0);
+		t->vstack[k] = temp;
+	}
+}
+
+/* Put the whole virtual stack into the temporaries, where stack code and
+ * other blocks expect it.
+ */
+static void flush(Translation *t)
+{
+	for (int k = 0; k < t->sp; k++) materialize(t, k);
+}
+
+/* The last instruction emitted in this block, if it wrote its result to register a */
+static Reg_Instr *producer_of(Translation *t, int a)
+{
+	if ( t->ncode<=t->block_start ) return NULL;
+	Reg_Instr *R = &t->rf->code[t->ncode-1];
+	if ( R->opcode<R_MOVE || R->opcode>R_VLOAD_INDEX || R->a!=a ) return NULL;
+	return R;
+}
+
+/* The register instruction doing the work of a stack instruction, if there is one */
+static int reg_opcode(int opcode)
+{
+	switch ( opcode ) {
+		case IADD: return R_IADD;
+		case ISUB: return R_ISUB;
+		case IMUL: return R_IMUL;
+		case IDIV: return R_IDIV;
+		case FADD: return R_FADD;
+		case FSUB: return R_FSUB;
+		case FMUL: return R_FMUL;
+		case FDIV: return R_FDIV;
+		case OR:   return R_OR;
+		case AND:  return R_AND;
+		case IEQ:  return R_IEQ;
+		case INEQ: return R_INEQ;
+		case ILT:  return R_ILT;
+		case ILE:  return R_ILE;
+		case IGT:  return R_IGT;
+		case IGE:  return R_IGE;
+		case FEQ:  return R_FEQ;
+		case FNEQ: return R_FNEQ;
+		case FLT:  return R_FLT;
+		case FLE:  return R_FLE;
+		case FGT:  return R_FGT;
+		case FGE:  return R_FGE;
+		case INEG: return R_INEG;
+		case FNEG: return R_FNEG;
+		case NOT:  return R_NOT;
+		case I2F:  return R_I2F;
+		case F2I:  return R_F2I;
+		default:   return R_STACK_OP;
+	}
+}
+
+static bool translate_function(Translation *t)
+{
+	VM *vm = t->vm;
+	Reg_Function *rf = t->rf;
+	const Decoded_Instr *code = vm->instrs;
+	bool live = false;	// can control reach the current instruction from the previous one
+
+	for (int i = t->start; i < t->end; i++) {
+		int d = t->depth[i - t->start];
+		if ( d<0 ) continue; // unreachable
+		if ( !live || t->label[i - t->start] ) {
+			if ( live ) flush(t);
+			t->sp = 0;
+			for (int k = 0; k < d; k++) push_temp(t);
+			t->block_start = t->ncode;
+		}
+		t->pc_of[i - t->start] = t->ncode;
+		live = true;
+
+		const Decoded_Instr *I = &code[i];
+		int opcode = vm_base_opcode(I->opcode);
+		int a, b, c, r;
+		switch ( opcode ) {
+			case IADD: case ISUB: case IMUL: case IDIV:
+			case FADD: case FSUB: case FMUL: case FDIV:
+			case OR: case AND:
+			case IEQ: case INEQ: case ILT: case ILE: case IGT: case IGE:
+			case FEQ: case FNEQ: case FLT: case FLE: case FGT: case FGE:
+				c = pop(t);
+				b = pop(t);
+				a = push_temp(t);
+				emit(t, reg_opcode(opcode), a, b, c);
+				break;
+			case INEG: case FNEG: case NOT: case I2F: case F2I:
+				b = pop(t);
+				a = push_temp(t);
+				emit(t, reg_opcode(opcode), a, b, 0);
+				break;
+			case ICONST: case FCONST: case SCONST:
+				push(t, constant_register(t, i));
+				break;
+			case ILOAD: case FLOAD: case VLOAD: case SLOAD:
+				push(t, I->opnd.i);
+				break;
+			case STORE: {
+				b = pop(t);
+				a = I->opnd.i;
+				for (int k = 0; k < t->sp; k++) { // entries still naming the local need their old value
+					if ( t->vstack[k]==a ) materialize(t, k);
+				}
+				Reg_Instr *R = producer_of(t, b);
+				if ( b==rf->temps+t->sp && R!=NULL ) R->a = a; // compute straight into the local
+				else if ( b!=a ) emit(t, R_MOVE, a, b, 0);
+				break;
+			}
+			case VLOAD_INDEX:
+				c = pop(t);
+				b = pop(t);
+				a = push_temp(t);
+				emit(t, R_VLOAD_INDEX, a, b, c);
+				break;
+			case STORE_INDEX:
+				c = pop(t);
+				b = pop(t);
+				a = pop(t);
+				emit(t, R_STORE_INDEX, a, b, c);
+				break;
+			case POP:
+				pop(t);
+				break;
+			case NOP:
+			case SNAPSHOT: // register frames can't be saved; see snapshot.h
+				break;
+			case SPAWN: case YIELD: case JOIN: // tasks run on the stack machine; see tasks.h
+				return false;
+			case BR:
+				flush(t);
+				emit(t, R_BR, I->target, 0, 0); // instruction index; fixed up below
+				live = false;
+				break;
+			case BRF: {
+				a = pop(t);
+				Reg_Instr *R = producer_of(t, a);
+				if ( a==rf->temps+t->sp && R!=NULL && R->opcode>=R_IEQ && R->opcode<=R_IGE ) {
+					// fuse with the comparison; flushing can't touch its operands, which sat above a
+					Reg_Instr cmp = *R;
+					t->ncode--;
+					flush(t);
+					emit(t, R_IEQ_BRF + (cmp.opcode-R_IEQ), cmp.b, cmp.c, I->target);
+				}
+				else {
+					flush(t);
+					emit(t, R_BRF, a, I->target, 0);
+				}
+				break;
+			}
+			case CALL: {
+				Function_metadata *callee = &vm->functions[I->opnd.i];
+				flush(t);
+				t->sp -= callee->nargs;
+				if ( I->opcode==TAIL_CALL ) {
+					emit(t, R_TAIL_CALL, I->opnd.i, rf->temps+t->sp, I[1].opcode==GC_END);
+				}
+				else {
+					emit(t, R_CALL, I->opnd.i, rf->temps+t->sp, 0);
+				}
+				if ( returns_value(callee) ) push_temp(t);
+				break;
+			}
+			case RET:
+				emit(t, R_RET, returns_value(rf->func) ? pop(t) : -1, 0, 0);
+				live = false;
+				break;
+			case HALT:
+				emit(t, R_HALT, 0, 0, 0);
+				live = false;
+				break;
+			case GC_START:
+				emit(t, R_GC_START, 0, 0, 0);
+				break;
+			case GC_END:
+				emit(t, R_GC_END, 0, 0, 0);
+				break;
+			case SROOT: case VROOT:
+				if ( t->sp>0 ) {
+					materialize(t, t->sp-1);
+					emit(t, R_ROOT, rf->temps+t->sp-1, 0, 0);
+				}
+				break;
+			case PUSH_DFLT_RETV:
+				r = constant_register(t, i);
+				if ( r>=0 ) { push(t, r); break; }
+				if ( returns_value(rf->func) ) {
+					flush(t);
+					emit(t, R_STACK_OP, PUSH_DFLT_RETV, t->sp-1, rf->func->return_type);
+					push_temp(t);
+				}
+				break;
+			default: {
+				int pops, pushes;
+				vm_stack_effect(vm, rf->func, code, i, &pops, &pushes);
+				flush(t);
+				emit(t, R_STACK_OP, opcode, t->sp-1, 0);
+				t->sp -= pops;
+				for (int k = 0; k < pushes; k++) push_temp(t);
+				break;
+			}
+		}
+	}
+
+	// branch targets were emitted as instruction indexes
+	for (int p = 0; p < t->ncode; p++) {
+		Reg_Instr *R = &rf->code[p];
+		if ( R->opcode==R_BR ) R->a = t->pc_of[R->a - t->start];
+		else if ( R->opcode==R_BRF ) R->b = t->pc_of[R->b - t->start];
+		else if ( R->opcode>=R_IEQ_BRF && R->opcode<=R_IGE_BRF ) R->c = t->pc_of[R->c - t->start];
+	}
+	rf->ncode = t->ncode;
+	return true;
+}
+
+typedef struct {
+	Reg_Function *func;
+	const Reg_Instr *retpc;
+	element *regs;
+	int save_gc_roots;
+} Reg_Frame;
+
+/* Initialize the locals and constants of a frame at regs; the args are already there */
+static inline void enter(Reg_Function *rf, element *regs)
+{
+	int nargs = rf->func->nargs;
+	memset(regs + nargs, 0, (rf->nvars - nargs) * sizeof(element));
+	memcpy(regs + rf->nvars, rf->consts, rf->nconsts * sizeof(element));
+}
+
+/* Dispatch works as in vm_exec(): threaded if possible, else a switch */
+#if defined(THREADED_DISPATCH) && defined(__GNUC__)
+#define CASE(op)			L_##op:
+#define INVALID_OPCODE		L_INVALID:
+#define DISPATCH()			goto *dispatch_table[pc->opcode]
+#define DISPATCH_LOOP		DISPATCH();
+#define END_DISPATCH_LOOP
+#else
+#define CASE(op)			case op:
+#define INVALID_OPCODE		default:
+#define DISPATCH()			continue
+#define DISPATCH_LOOP		for (;;) switch (pc->opcode) {
+#define END_DISPATCH_LOOP	}
+#endif
+
+#define NEXT				{ pc++; DISPATCH(); }
+#define JUMP(target)		{ pc = code + (target); DISPATCH(); }
+#define A					regs[pc->a]
+#define B					regs[pc->b]
+#define C					regs[pc->c]
+
+void vm_exec_registers(Reg_Program *prog)
+{
+#if defined(THREADED_DISPATCH) && defined(__GNUC__)
+	static const void *dispatch_table[256] = {
+		[0 ... 255] = &&L_INVALID,
+		[R_HALT] = &&L_R_HALT, [R_MOVE] = &&L_R_MOVE,
+		[R_IADD] = &&L_R_IADD, [R_ISUB] = &&L_R_ISUB, [R_IMUL] = &&L_R_IMUL, [R_IDIV] = &&L_R_IDIV,
+		[R_FADD] = &&L_R_FADD, [R_FSUB] = &&L_R_FSUB, [R_FMUL] = &&L_R_FMUL, [R_FDIV] = &&L_R_FDIV,
+		[R_OR] = &&L_R_OR, [R_AND] = &&L_R_AND,
+		[R_IEQ] = &&L_R_IEQ, [R_INEQ] = &&L_R_INEQ, [R_ILT] = &&L_R_ILT,
+		[R_ILE] = &&L_R_ILE, [R_IGT] = &&L_R_IGT, [R_IGE] = &&L_R_IGE,
+		[R_FEQ] = &&L_R_FEQ, [R_FNEQ] = &&L_R_FNEQ, [R_FLT] = &&L_R_FLT,
+		[R_FLE] = &&L_R_FLE, [R_FGT] = &&L_R_FGT, [R_FGE] = &&L_R_FGE,
+		[R_INEG] = &&L_R_INEG, [R_FNEG] = &&L_R_FNEG, [R_NOT] = &&L_R_NOT, [R_I2F] = &&L_R_I2F, [R_F2I] = &&L_R_F2I,
+		[R_VLOAD_INDEX] = &&L_R_VLOAD_INDEX, [R_STORE_INDEX] = &&L_R_STORE_INDEX,
+		[R_BR] = &&L_R_BR, [R_BRF] = &&L_R_BRF,
+		[R_IEQ_BRF] = &&L_R_IEQ_BRF, [R_INEQ_BRF] = &&L_R_INEQ_BRF, [R_ILT_BRF] = &&L_R_ILT_BRF,
+		[R_ILE_BRF] = &&L_R_ILE_BRF, [R_IGT_BRF] = &&L_R_IGT_BRF, [R_IGE_BRF] = &&L_R_IGE_BRF,
+		[R_CALL] = &&L_R_CALL, [R_TAIL_CALL] = &&L_R_TAIL_CALL, [R_RET] = &&L_R_RET,
+		[R_GC_START] = &&L_R_GC_START, [R_GC_END] = &&L_R_GC_END, [R_ROOT] = &&L_R_ROOT,
+		[R_STACK_OP] = &&L_R_STACK_OP,
+	};
+#endif
+	VM *vm = prog->vm;
+	Heap_Context *caller_heap = gc_use_heap(vm->heap);
+	element *reg_stack = calloc((size_t)MAX_REG_STACK, sizeof(element));
+	Reg_Frame *frames = calloc((size_t)MAX_CALL_STACK, sizeof(Reg_Frame));
+	int save_gc_roots = gc_num_roots();
+	bool failed = false;
+
+	Function_metadata *const main = vm_function(vm, "main");
+	register Reg_Frame *frame = frames;
+	frame->func = &prog->functions[main - vm->functions];
+	frame->regs = reg_stack;
+	enter(frame->func, reg_stack);
+
+	register element *regs = frame->regs;
+	register const Reg_Instr *code = frame->func->code;
+	register const Reg_Instr *pc = code;
+
+	DISPATCH_LOOP
+			CASE(R_MOVE)
+				A = B;
+				NEXT;
+			CASE(R_IADD)
+				A.i = B.i + C.i;
+				NEXT;
+			CASE(R_ISUB)
+				A.i = B.i - C.i;
+				NEXT;
+			CASE(R_IMUL)
+				A.i = B.i * C.i;
+				NEXT;
+			CASE(R_IDIV)
+				if ( C.i==0 ) {
+					vm_zero_division_error();
+					A = B;
+					NEXT;
+				}
+				A.i = B.i / C.i;
+				NEXT;
+			CASE(R_FADD)
+				A.f = B.f + C.f;
+				NEXT;
+			CASE(R_FSUB)
+				A.f = B.f - C.f;
+				NEXT;
+			CASE(R_FMUL)
+				A.f = B.f * C.f;
+				NEXT;
+			CASE(R_FDIV)
+				if ( C.f==0 ) {
+					vm_zero_division_error();
+					A = B;
+					NEXT;
+				}
+				A.f = B.f / C.f;
+				NEXT;
+			CASE(R_OR)
+				A.b = B.b || C.b;
+				NEXT;
+			CASE(R_AND)
+				A.b = B.b && C.b;
+				NEXT;
+			CASE(R_IEQ)
+				A.b = B.i == C.i;
+				NEXT;
+			CASE(R_INEQ)
+				A.b = B.i != C.i;
+				NEXT;
+			CASE(R_ILT)
+				A.b = B.i < C.i;
+				NEXT;
+			CASE(R_ILE)
+				A.b = B.i <= C.i;
+				NEXT;
+			CASE(R_IGT)
+				A.b = B.i > C.i;
+				NEXT;
+			CASE(R_IGE)
+				A.b = B.i >= C.i;
+				NEXT;
+			CASE(R_FEQ)
+				A.b = B.f == C.f;
+				NEXT;
+			CASE(R_FNEQ)
+				A.b = B.f != C.f;
+				NEXT;
+			CASE(R_FLT)
+				A.b = B.f < C.f;
+				NEXT;
+			CASE(R_FLE)
+				A.b = B.f <= C.f;
+				NEXT;
+			CASE(R_FGT)
+				A.b = B.f > C.f;
+				NEXT;
+			CASE(R_FGE)
+				A.b = B.f >= C.f;
+				NEXT;
+			CASE(R_INEG)
+				A.i = -B.i;
+				NEXT;
+			CASE(R_FNEG)
+				A.f = -B.f;
+				NEXT;
+			CASE(R_NOT)
+				A.b = !B.b;
+				NEXT;
+			CASE(R_I2F)
+				A.f = B.i;
+				NEXT;
+			CASE(R_F2I)
+				A.i = (int)B.f;
+				NEXT;
+			CASE(R_VLOAD_INDEX)
+				A.f = ith(VPTR(B), C.i-1);
+				NEXT;
+			CASE(R_STORE_INDEX)
+				set_ith(VPTR(A), B.i-1, C.f);
+				NEXT;
+			CASE(R_BR)
+				JUMP(pc->a);
+			CASE(R_BRF)
+				if ( !A.b ) JUMP(pc->b);
+				NEXT;
+			CASE(R_IEQ_BRF)
+				if ( !(A.i == B.i) ) JUMP(pc->c);
+				NEXT;
+			CASE(R_INEQ_BRF)
+				if ( !(A.i != B.i) ) JUMP(pc->c);
+				NEXT;
+			CASE(R_ILT_BRF)
+				if ( !(A.i < B.i) ) JUMP(pc->c);
+				NEXT;
+			CASE(R_ILE_BRF)
+				if ( !(A.i <= B.i) ) JUMP(pc->c);
+				NEXT;
+			CASE(R_IGT_BRF)
+				if ( !(A.i > B.i) ) JUMP(pc->c);
+				NEXT;
+			CASE(R_IGE_BRF)
+				if ( !(A.i >= B.i) ) JUMP(pc->c);
+				NEXT;
+			CASE(R_CALL) {
+				Reg_Function *callee = &prog->functions[pc->a];
+				element *base = &B; // callee's args are already here
+				if ( frame+1==frames+MAX_CALL_STACK || base+callee->nregs>reg_stack+MAX_REG_STACK ) {
+					fprintf(stderr, "call stack overflow calling %s\n", callee->func->name);
+					failed = true;
+					goto halt;
+				}
+				frame++;
+				frame->func = callee;
+				frame->retpc = pc+1;
+				frame->regs = base;
+				enter(callee, base);
+				regs = base;
+				code = pc = callee->code;
+				DISPATCH();
+			}
+			CASE(R_TAIL_CALL) {
+				Reg_Function *callee = &prog->functions[pc->a];
+				if ( frame->regs+callee->nregs>reg_stack+MAX_REG_STACK ) {
+					fprintf(stderr, "call stack overflow calling %s\n", callee->func->name);
+					failed = true;
+					goto halt;
+				}
+				if ( pc->c ) gc_set_num_roots(frame->save_gc_roots);
+				memmove(frame->regs, &B, callee->func->nargs * sizeof(element));
+				frame->func = callee; // returns to our caller
+				enter(callee, frame->regs);
+				code = pc = callee->code;
+				DISPATCH();
+			}
+			CASE(R_RET)
+				if ( frame==frames ) goto halt;
+				if ( pc->a>=0 ) regs[0] = A; // where the caller's stack code wants it
+				pc = frame->retpc;
+				frame--;
+				regs = frame->regs;
+				code = frame->func->code;
+				DISPATCH();
+			CASE(R_GC_START)
+				frame->save_gc_roots = gc_num_roots();
+				NEXT;
+			CASE(R_GC_END)
+				gc_set_num_roots(frame->save_gc_roots);
+				NEXT;
+			CASE(R_ROOT)
+				gc_add_root((void **)&A.s);
+				NEXT;
+			CASE(R_STACK_OP)
+				vm_exec_slow_op(vm, pc->a, pc->c, regs + frame->func->temps, pc->b);
+				NEXT;
+			CASE(R_HALT)
+				goto halt;
+			INVALID_OPCODE
+				fprintf(stderr, "invalid register opcode: %d in %s\n", pc->opcode, frame->func->func->name);
+				failed = true;
+				goto halt;
+	END_DISPATCH_LOOP
+halt:
+	vm_flush_output(vm);
+	if ( !failed ) vm_gc_check();
+	gc_set_num_roots(save_gc_roots); // don't leave roots into the frames
+	free(frames);
+	free(reg_stack);
+	gc_use_heap(caller_heap);
+	if ( failed ) vm_fail(vm);
+}
+
+char *vm_reg_opcode_name(int opcode)
+{
+	if ( opcode<0 || opcode>=NUM_REG_OPCODES ) return "?";
+	return reg_opcode_names[opcode];
+}
+
+void vm_print_registers(Reg_Program *prog)
+{
+	VM *vm = prog->vm;
+	for (int f = 0; f < vm->num_functions; f++) {
+		Reg_Function *rf = &prog->functions[f];
+		Function_metadata *func = rf->func;
+		fprintf(stderr, "%s: args=%d locals=%d consts=%d temps=%d\n", func->name,
+				func->nargs, rf->nvars - func->nargs, rf->nconsts, rf->nregs - rf->temps);
+		for (int p = 0; p < rf->ncode; p++) {
+			Reg_Instr *R = &rf->code[p];
+			fprintf(stderr, "%04d:  %-15s%d %d %d\n", p, vm_reg_opcode_name(R->opcode), R->a, R->b, R->c);
+		}
+	}
+}
@@ -0,0 +1,101 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2015 Terence Parr, Hanzhou Shi, Shuai Yuan, Yuanyuan Zhang
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+#ifndef REGVM_H_
+#define REGVM_H_
+
+#include "vm.h"
+
+/* A register-based alternative to vm_exec(). Each function's stack code is
+ * translated into three-address instructions whose operands name slots in the
+ * function's register frame:
+ *
+ *     [ args | locals | constants | temporaries ]
+ *
+ * Temporary k holds operand stack entry k, but the translator keeps a virtual
+ * stack so that loads and constants are just register names and most
+ * instructions read their operands straight from locals and constants.
+ * A callee's frame starts at the caller's temporary holding its first
+ * argument, so arguments are passed in place and the return value lands where
+ * the stack code expects it. Instructions backed by the runtime library run
+ * through vm_exec_slow_op() on the temporaries.
+ */
+
+typedef enum {
+	R_HALT,
+	R_MOVE,			// a = b
+	R_IADD, R_ISUB, R_IMUL, R_IDIV,	// a = b op c
+	R_FADD, R_FSUB, R_FMUL, R_FDIV,
+	R_OR, R_AND,
+	R_IEQ, R_INEQ, R_ILT, R_ILE, R_IGT, R_IGE,
+	R_FEQ, R_FNEQ, R_FLT, R_FLE, R_FGT, R_FGE,
+	R_INEG, R_FNEG, R_NOT, R_I2F, R_F2I,	// a = op b
+	R_VLOAD_INDEX,	// a = b[c]
+	R_STORE_INDEX,	// a[b] = c
+	R_BR,			// goto a
+	R_BRF,			// if !a goto b
+	R_IEQ_BRF, R_INEQ_BRF, R_ILT_BRF, R_ILE_BRF, R_IGT_BRF, R_IGE_BRF, // if !(a op b) goto c
+	R_CALL,			// call function a with frame at register b
+	R_TAIL_CALL,	// replace the current frame with one for function a, args at register b; c: end GC frame
+	R_RET,			// return a (-1 if none)
+	R_GC_START,
+	R_GC_END,
+	R_ROOT,			// add register a to the GC roots
+	R_STACK_OP,		// run bytecode a with operand c on temporaries 0..b
+	NUM_REG_OPCODES
+} REG_OPCODE;
+
+typedef struct {
+	int opcode;
+	int a, b, c;	// registers, instruction indexes or immediates; see REG_OPCODE
+} Reg_Instr;
+
+typedef struct {
+	Function_metadata *func;
+	Reg_Instr *code;
+	int ncode;
+	int nvars;			// args + locals; more than func->nlocals if the code uses more
+	int nconsts;
+	element *consts;	// initial values of the constant registers
+	int temps;			// first temporary register; nvars+nconsts
+	int nregs;			// frame size
+} Reg_Function;
+
+typedef struct {
+	VM *vm;
+	Reg_Function *functions;	// parallel to vm->functions
+} Reg_Program;
+
+/* Translate the (pre-decoded) code of vm. Returns NULL if some function can't
+ * be translated, such as when the operand stack depth isn't the same along
+ * every path to an instruction or it uses tasks (see tasks.h); run such
+ * programs with vm_exec().
+ */
+extern Reg_Program *vm_translate_registers(VM *vm);
+extern void vm_exec_registers(Reg_Program *prog);
+extern void vm_free_registers(Reg_Program *prog);
+
+extern char *vm_reg_opcode_name(int opcode);
+extern void vm_print_registers(Reg_Program *prog);
+
+#endif
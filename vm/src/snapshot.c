@@ -0,0 +1,441 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2015 Terence Parr, Hanzhou Shi, Shuai Yuan, Yuanyuan Zhang
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <wich.h>
+#include <mark_and_compact.h>
+#include "vm.h"
+#include "wloader.h"
+#include "output.h"
+#include "verifier.h"
+#include "snapshot.h"
+
+static const char SNAPSHOT_MAGIC[4] = {'S', 'N', 'A', 'P'};
+static const int SNAPSHOT_VERSION = 1;
+
+/* A pointer in a snapshot is 0 for NULL or, tagged in its low two bits, an
+ * offset into the saved heap or an index into vm->string_objects. Bits above
+ * GC_ROOT_POINTER_BITS, such as a packed vector's version, are kept as is.
+ */
+static const word HEAP_REF = 1;
+static const word STRING_REF = 2;
+#define REF_MASK	(((word)1 << GC_ROOT_POINTER_BITS) - 1)
+
+#ifdef PACKED_ELEMENTS
+#define VECTOR_WORD(e)	((word *)&(e).v)
+#else
+#define VECTOR_WORD(e)	((word *)&(e).vptr.vector)
+#endif
+
+/* What a saved object's metadata field holds instead of a pointer */
+static object_metadata *const kinds[] = {&PVector_metadata, &PVectorFatNodeElem_metadata, &String_metadata};
+#define NUM_KINDS	(sizeof(kinds) / sizeof(kinds[0]))
+
+typedef struct {
+	char magic[4];
+	int32_t version;
+	int32_t element_size;	// sizeof(element); snapshots don't move between builds
+	int32_t num_instrs;
+	int32_t ip, sp, fp, callsp;
+	int32_t nslots;			// operand stack elements saved
+	int32_t num_pointers;	// words in the saved stack holding pointers
+	int32_t num_roots;
+	int32_t num_objects;
+	uint64_t heap_size;		// bytes of heap objects
+} Snapshot_Header;			// then callsp+1 frames, the stack, the heap, pointers and roots
+
+typedef struct {
+	int32_t func;			// index into vm->functions
+	uint32_t retaddr;
+	int32_t save_gc_roots;
+	int32_t locals;			// index into vm->stack
+} Snapshot_Frame;
+
+/* Objects in the VM's heap and where the ones reached go in the snapshot */
+typedef struct {
+	VM *vm;
+	heap_object **objects;	// every object in the heap, in address order
+	int num_objects;
+	long *offset;			// offset[i] is where objects[i] goes in the saved heap, or -1
+	int *order;				// indexes of the objects reached, in saved heap order
+	int num_reached;
+	size_t heap_size;		// bytes reached so far
+} Snapshot;
+
+static inline size_t align8(size_t n) { return (n + 7) & ~(size_t)7; }
+
+/* PVectors keep their fat node lists out of their metadata, so count them here */
+static int num_ptr_fields(heap_object *p)
+{
+	int n = p->metadata->num_ptr_fields;
+	if ( p->metadata==&PVector_metadata ) n += (int)((PVector *)p)->length;
+	return n;
+}
+
+static word *ptr_field(heap_object *p, int i)
+{
+	int n = p->metadata->num_ptr_fields;
+	if ( i<n ) return (word *)((char *)p + p->metadata->field_offsets[i]);
+	return (word *)&((PVector *)p)->nodes[i-n].head;
+}
+
+static int find_object(Snapshot *s, word p)
+{
+	int lo = 0, hi = s->num_objects - 1;
+	while ( lo<=hi ) {
+		int mid = (lo + hi) / 2;
+		word q = (word)s->objects[mid];
+		if ( q==p ) return mid;
+		if ( q<p ) lo = mid + 1;
+		else hi = mid - 1;
+	}
+	return -1;
+}
+
+/* Set *ref to how the snapshot refers to p, reaching p first if need be;
+ * false if p isn't an object or interned string.
+ */
+static bool encode(Snapshot *s, word p, word *ref)
+{
+	int i = find_object(s, p);
+	if ( i>=0 ) {
+		if ( s->offset[i]<0 ) {
+			s->offset[i] = (long)s->heap_size;
+			s->heap_size += s->objects[i]->size;
+			s->order[s->num_reached++] = i;
+		}
+		*ref = (word)s->offset[i] << 2 | HEAP_REF;
+		return true;
+	}
+	for (int k = 0; k <= s->vm->num_strings; k++) { // string_objects[num_strings] is the empty string
+		if ( (word)s->vm->string_objects[k]==p ) {
+			*ref = (word)k << 2 | STRING_REF;
+			return true;
+		}
+	}
+	return false;
+}
+
+/* Store the pointer at from, less any tag, as a reference in to */
+static bool encode_word(Snapshot *s, const word *from, word *to)
+{
+	word ref;
+	if ( (*from & REF_MASK)==0 || !encode(s, *from & REF_MASK, &ref) ) return false;
+	*to = (*from & ~REF_MASK) | ref;
+	return true;
+}
+
+/* Turn the reference at w back into a pointer */
+static bool decode_word(VM *vm, char *heap, size_t heap_size, word *w)
+{
+	word ref = *w & REF_MASK;
+	word at = ref >> 2;
+	if ( ref==0 ) return true;
+	if ( (ref & 3)==HEAP_REF && at<heap_size ) *w = (*w & ~REF_MASK) | (word)(heap + at);
+	else if ( (ref & 3)==STRING_REF && at<=(word)vm->num_strings ) *w = (*w & ~REF_MASK) | (word)vm->string_objects[at];
+	else return false;
+	return true;
+}
+
+static int kind_of(heap_object *p)
+{
+	for (int k = 0; k < (int)NUM_KINDS; k++) {
+		if ( p->metadata==kinds[k] ) return k;
+	}
+	return -1;
+}
+
+/* Encode the strings and vectors among frame k's args, locals and operands
+ * in stack, noting where they are in pointers. The verifier knows which
+ * slots they are; a caller is stopped at the CALL whose args are now its
+ * callee's.
+ */
+static bool encode_frame(Snapshot *s, int k, element *stack, int32_t *pointers, int *num_pointers)
+{
+	VM *vm = s->vm;
+	Activation_Record *r = &vm->call_stack[k];
+	Function_metadata *func = r->func;
+	int nvars = func->nargs + func->nlocals;
+	int i = k<vm->callsp ? (int)vm->call_stack[k+1].retaddr - 1 : (int)vm->ip;
+	int depth;
+	char *types = i>=0 && i<vm->num_instrs ? vm_frame_types(vm, func, i, &depth) : NULL;
+	if ( types==NULL ) return false;
+	int nopnds = depth;
+	if ( k<vm->callsp ) nopnds -= vm->functions[vm->instrs[i].opnd.i].nargs;
+	bool ok = k<vm->callsp || (int)(r->locals - vm->stack) + nvars + depth==vm->sp;
+	for (int j = 0; ok && j < nvars + nopnds; j++) {
+		if ( types[j]!='s' && types[j]!='v' ) continue;
+		element *e = j<nvars ? &r->locals[j] : &r->locals[j+1]; // operands start above a null element
+		word *w = types[j]=='s' ? (word *)&e->s : VECTOR_WORD(*e);
+		if ( (*w & REF_MASK)==0 ) continue;
+		size_t at = (size_t)((char *)w - (char *)vm->stack);
+		ok = encode_word(s, w, (word *)((char *)stack + at));
+		pointers[(*num_pointers)++] = (int32_t)at;
+	}
+	free(types);
+	return ok;
+}
+
+static bool snapshot_error(char *filename, const char *why)
+{
+	fprintf(stderr, "can't snapshot to %s: %s\n", filename, why);
+	return false;
+}
+
+static bool write_snapshot(Snapshot *s, FILE *f, int32_t *pointers, int num_pointers, int nslots, element *stack)
+{
+	VM *vm = s->vm;
+	if ( !vm_save_wbc(vm, f) ) return false;
+	for (long pos = ftell(f); pos%8!=0; pos++) fputc(0, f);
+
+	Snapshot_Header h;
+	memcpy(h.magic, SNAPSHOT_MAGIC, 4);
+	h.version = SNAPSHOT_VERSION;
+	h.element_size = (int32_t)sizeof(element);
+	h.num_instrs = vm->num_instrs;
+	h.ip = (int32_t)vm->ip;
+	h.sp = vm->sp;
+	h.fp = vm->fp;
+	h.callsp = vm->callsp;
+	h.nslots = nslots;
+	h.num_pointers = num_pointers;
+	h.num_roots = gc_num_roots();
+	h.num_objects = s->num_reached;
+	h.heap_size = s->heap_size;
+	fwrite(&h, sizeof(h), 1, f);
+	for (int i = 0; i <= vm->callsp; i++) {
+		Activation_Record *r = &vm->call_stack[i];
+		Snapshot_Frame frame = {(int32_t)(r->func - vm->functions), r->retaddr, r->save_gc_roots,
+								(int32_t)(r->locals - vm->stack)};
+		fwrite(&frame, sizeof(frame), 1, f);
+	}
+	fwrite(stack, sizeof(element), (size_t)nslots, f);
+
+	size_t max = 0;
+	for (int j = 0; j < s->num_reached; j++) {
+		if ( s->objects[s->order[j]]->size>max ) max = s->objects[s->order[j]]->size;
+	}
+	heap_object *q = malloc(max);
+	for (int j = 0; j < s->num_reached; j++) {
+		heap_object *p = s->objects[s->order[j]];
+		memcpy(q, p, p->size);
+		q->metadata = (object_metadata *)(word)kind_of(p);
+		q->marked = false;
+		q->forwarded = NULL;
+		for (int i = 0; i < num_ptr_fields(p); i++) {
+			word *field = ptr_field(p, i);
+			if ( *field!=0 ) encode(s, *field, (word *)((char *)q + ((char *)field - (char *)p)));
+		}
+		fwrite(q, p->size, 1, f);
+	}
+	free(q);
+
+	fwrite(pointers, sizeof(int32_t), (size_t)num_pointers, f);
+	for (int i = 0; i < h.num_roots; i++) {
+		int32_t root = (int32_t)((char *)gc_root(i) - (char *)vm->stack);
+		fwrite(&root, sizeof(root), 1, f);
+	}
+	return !ferror(f);
+}
+
+/* Find what's reachable from the stack, giving each object its place in a
+ * compacted heap, then write it all out. The VM's own heap is left alone.
+ */
+bool vm_snapshot(VM *vm, char *filename)
+{
+	for (int i = 0; i <= vm->callsp; i++) {
+		if ( vm->call_stack[i].func->native!=NULL ) return snapshot_error(filename, "native code is running");
+	}
+	if ( vm->tasks!=NULL ) return snapshot_error(filename, "tasks are running");
+	vm_flush_output(vm); // or a restored VM would print it again
+
+	Heap_Context *caller_heap = gc_use_heap(vm->heap);
+	int nslots = vm->sp + 1;
+	int num_roots = gc_num_roots();
+	for (int i = 0; i < num_roots; i++) {
+		word r = (word)gc_root(i) - (word)vm->stack;
+		if ( r>=(word)MAX_OPND_STACK * sizeof(element) || r%sizeof(element)!=0 ) {
+			gc_use_heap(caller_heap);
+			return snapshot_error(filename, "a root isn't on the operand stack");
+		}
+		if ( (int)(r / sizeof(element))>=nslots ) nslots = (int)(r / sizeof(element)) + 1;
+	}
+
+	Snapshot s = {vm};
+	Heap_Info info = get_heap_info();
+	s.objects = malloc(((size_t)info.busy + 1) * sizeof(heap_object *));
+	for (char *p = info.start_of_heap; p < (char *)info.next_free; p += ((heap_object *)p)->size) {
+		s.objects[s.num_objects++] = (heap_object *)p;
+	}
+	s.offset = malloc(((size_t)s.num_objects + 1) * sizeof(long));
+	for (int i = 0; i < s.num_objects; i++) s.offset[i] = -1;
+	s.order = malloc(((size_t)s.num_objects + 1) * sizeof(int));
+
+	element *stack = malloc(((size_t)nslots + 1) * sizeof(element));
+	memcpy(stack, vm->stack, (size_t)nslots * sizeof(element));
+	int32_t *pointers = malloc(((size_t)nslots + 1) * sizeof(int32_t));
+	int num_pointers = 0;
+	bool ok = true;
+	for (int k = 0; ok && k <= vm->callsp; k++) {
+		ok = encode_frame(&s, k, stack, pointers, &num_pointers);
+	}
+	if ( !ok ) snapshot_error(filename, "can't tell which slots hold strings and vectors");
+	for (int j = 0; ok && j < s.num_reached; j++) { // breadth first; reaching objects adds to s.order
+		heap_object *p = s.objects[s.order[j]];
+		ok = kind_of(p)>=0;
+		for (int i = 0; ok && i < num_ptr_fields(p); i++) {
+			word ref;
+			ok = *ptr_field(p, i)==0 || encode(&s, *ptr_field(p, i), &ref);
+		}
+		if ( !ok ) snapshot_error(filename, "the heap is corrupt");
+	}
+
+	if ( ok ) {
+		FILE *f = fopen(filename, "wb");
+		if ( f==NULL ) ok = snapshot_error(filename, "can't open it");
+		else {
+			ok = write_snapshot(&s, f, pointers, num_pointers, nslots, stack);
+			ok = fclose(f)==0 && ok;
+			if ( !ok ) {
+				snapshot_error(filename, "write failed");
+				remove(filename);
+			}
+		}
+	}
+	free(pointers);
+	free(stack);
+	free(s.order);
+	free(s.offset);
+	free(s.objects);
+	gc_use_heap(caller_heap);
+	return ok;
+}
+
+/* Rebuild the saved heap in vm's fresh one: allocating the objects in order
+ * lays them out at the same offsets, so every reference can be relocated as
+ * soon as it's copied.
+ */
+static bool restore_heap(VM *vm, byte *saved, size_t heap_size, int num_objects)
+{
+	Heap_Info info = get_heap_info();
+	char *heap = info.start_of_heap;
+	if ( info.next_free!=info.start_of_heap || heap_size>(size_t)((char *)info.end_of_heap - heap) ) return false;
+	size_t at = 0;
+	for (int j = 0; j < num_objects; j++) {
+		heap_object *p = (heap_object *)&saved[at];
+		word kind = (word)p->metadata;
+		if ( kind>=NUM_KINDS || p->size<sizeof(heap_object) || p->size%sizeof(word)!=0 || p->size>heap_size-at ) {
+			return false;
+		}
+		if ( kinds[kind]==&PVector_metadata &&
+			 ((PVector *)p)->length>(p->size - sizeof(PVector)) / sizeof(PVectorFatNode) ) {
+			return false;
+		}
+		heap_object *q = gc_alloc(kinds[kind], p->size);
+		if ( (char *)q!=heap + at ) return false;
+		memcpy(q + 1, p + 1, p->size - sizeof(heap_object));
+		for (int i = 0; i < num_ptr_fields(q); i++) {
+			if ( !decode_word(vm, heap, heap_size, ptr_field(q, i)) ) return false;
+		}
+		at += p->size;
+	}
+	return at==heap_size;
+}
+
+static bool restore_state(VM *vm, size_t offset)
+{
+	byte *image = vm->image;
+	size_t size = vm->image_size;
+	if ( offset+sizeof(Snapshot_Header)>size ) return false;
+	Snapshot_Header *h = (Snapshot_Header *)&image[offset];
+	if ( memcmp(h->magic, SNAPSHOT_MAGIC, 4)!=0 || h->version!=SNAPSHOT_VERSION ||
+		 h->element_size!=(int32_t)sizeof(element) || h->num_instrs!=vm->num_instrs ||
+		 h->callsp<-1 || h->callsp>=MAX_CALL_STACK || h->nslots<0 || h->nslots>MAX_OPND_STACK ||
+		 h->sp<-1 || h->sp>=h->nslots || h->fp<-1 || h->fp>=h->nslots || h->ip<0 || h->ip>h->num_instrs ||
+		 h->num_pointers<0 || h->num_roots<0 || h->num_objects<0 || h->heap_size>size ) {
+		return false;
+	}
+	size_t frames = offset + sizeof(Snapshot_Header);
+	size_t stack = frames + (size_t)(h->callsp + 1) * sizeof(Snapshot_Frame);
+	size_t heap = stack + (size_t)h->nslots * sizeof(element);
+	size_t refs = heap + h->heap_size;
+	if ( refs>size || (size - refs) / sizeof(int32_t)<(size_t)h->num_pointers + (size_t)h->num_roots ) return false;
+
+	for (int i = 0; i <= h->callsp; i++) {
+		Snapshot_Frame *frame = (Snapshot_Frame *)&image[frames] + i;
+		if ( frame->func<0 || frame->func>=vm->num_functions || frame->retaddr>(uint32_t)vm->num_instrs ) {
+			return false;
+		}
+		Function_metadata *func = &vm->functions[frame->func];
+		if ( frame->locals<0 || frame->locals>h->nslots - (func->nargs + func->nlocals) ||
+			 frame->save_gc_roots<0 || frame->save_gc_roots>h->num_roots ) {
+			return false;
+		}
+		Activation_Record *r = &vm->call_stack[i];
+		r->func = func;
+		r->retaddr = frame->retaddr;
+		r->save_gc_roots = frame->save_gc_roots;
+		r->locals = &vm->stack[frame->locals];
+	}
+	memcpy(vm->stack, &image[stack], (size_t)h->nslots * sizeof(element));
+	if ( !restore_heap(vm, &image[heap], h->heap_size, h->num_objects) ) return false;
+
+	int32_t *pointers = (int32_t *)&image[refs];
+	int32_t *roots = pointers + h->num_pointers;
+	size_t stack_size = (size_t)h->nslots * sizeof(element);
+	char *start_of_heap = get_heap_info().start_of_heap;
+	for (int i = 0; i < h->num_pointers; i++) {
+		if ( pointers[i]<0 || pointers[i]%sizeof(word)!=0 || (size_t)pointers[i]+sizeof(word)>stack_size ||
+			 !decode_word(vm, start_of_heap, h->heap_size, (word *)((char *)vm->stack + pointers[i])) ) {
+			return false;
+		}
+	}
+	for (int i = 0; i < h->num_roots; i++) {
+		if ( roots[i]<0 || roots[i]%sizeof(element)!=0 || (size_t)roots[i]>=stack_size ) return false;
+		gc_add_root((void **)((char *)vm->stack + roots[i]));
+	}
+	vm->ip = (addr32)h->ip;
+	vm->sp = h->sp;
+	vm->fp = h->fp;
+	vm->callsp = h->callsp;
+	return true;
+}
+
+VM *vm_restore(char *filename)
+{
+	VM *vm = vm_load_wbc(filename);
+	if ( vm==NULL ) return NULL;
+	// the state follows the code and its HALT sentinel
+	size_t offset = align8((size_t)(vm->code - (byte *)vm->image) + (size_t)vm->code_size + 1);
+	Heap_Context *caller_heap = gc_use_heap(vm->heap);
+	bool ok = restore_state(vm, offset);
+	gc_use_heap(caller_heap);
+	if ( !ok ) {
+		fprintf(stderr, "%s isn't a snapshot from this VM\n", filename);
+		vm_free(vm);
+		return NULL;
+	}
+	return vm;
+}
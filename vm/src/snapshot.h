@@ -0,0 +1,62 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2015 Terence Parr, Hanzhou Shi, Shuai Yuan, Yuanyuan Zhang
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+#ifndef SNAPSHOT_H_
+#define SNAPSHOT_H_
+
+#include "vm.h"
+
+/* Snapshots (.snap files) let a program that spends its first phase building
+ * the same strings and vectors every run do that once: the program executes
+ * SNAPSHOT once it's set up, and later runs restore the VM as it was there
+ * and carry on from the instruction after it.
+ *
+ * A snapshot is a .wbc image of the code, strings and functions (see
+ * wloader.c) followed, on an 8-byte boundary, by the VM's state in native
+ * byte order: registers, call stack, the operand stack as far as any root
+ * reaches, the heap objects reachable from the stack, laid end to end as
+ * mark-and-compact would leave them, and the roots as offsets into the
+ * stack. Pointers are stored as offsets into that compacted heap, or as
+ * indexes into the string table for interned strings, so restoring copies
+ * the heap into a fresh one and relocates each pointer in a single pass.
+ *
+ * Which args, locals and operands hold strings and vectors comes from the
+ * verifier (see vm_frame_types()), so the code must verify. A snapshot can
+ * only be taken while every frame is interpreted and before any task is
+ * spawned (see tasks.h); the JIT leaves functions containing SNAPSHOT alone,
+ * and the register machine and compiled C treat it as a NOP. It's read back
+ * only by the same build of the VM, and output printed before the SNAPSHOT
+ * isn't printed again.
+ */
+
+/* Save vm's state to filename; returns false, after saying why on stderr,
+ * if it can't.
+ */
+extern bool vm_snapshot(VM *vm, char *filename);
+
+/* A VM in the state saved in filename, ready for vm_resume(), or NULL if
+ * filename can't be read or isn't a snapshot from this build.
+ */
+extern VM *vm_restore(char *filename);
+
+#endif
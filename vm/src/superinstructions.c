@@ -0,0 +1,163 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2015 Terence Parr, Hanzhou Shi, Shuai Yuan, Yuanyuan Zhang
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+#include <wich.h>
+#include "vm.h"
+#include "superinstructions.h"
+
+#define UNPAREN(...) __VA_ARGS__
+
+VM_SUPERINSTRUCTION vm_superinstructions[] = {
+#define SUPER(name, n, ops, body) {#name, name, n, {UNPAREN ops}},
+#include "superinstructions.def"
+#undef SUPER
+	{NULL, 0, 0, {0}}
+};
+
+const int NUM_SUPERINSTRUCTIONS = TAIL_CALL - (LAST_BYTECODE+1);
+
+// must agree with the DO_xxx macros in vm.c
+static const int fusable[] = {
+	IADD, ISUB, IMUL, FADD, FSUB, FMUL, OR, AND, INEG, FNEG, NOT, I2F, F2I,
+	IEQ, INEQ, ILT, ILE, IGT, IGE, FEQ, FNEQ, FLT, FLE, FGT, FGE,
+	BR, BRF, ICONST, FCONST, SCONST, ILOAD, FLOAD, VLOAD, SLOAD, STORE,
+	VLOAD_INDEX, STORE_INDEX, POP, NOP
+};
+
+bool vm_fusable(int opcode)
+{
+	for (int i = 0; i < sizeof(fusable)/sizeof(fusable[0]); i++) {
+		if ( fusable[i]==opcode ) return true;
+	}
+	return false;
+}
+
+char *vm_handler_name(int opcode)
+{
+	if ( opcode<=LAST_BYTECODE ) return vm_instructions[opcode].name;
+	if ( opcode==TAIL_CALL ) return "TAIL_CALL";
+	return vm_superinstructions[opcode - (LAST_BYTECODE+1)].name;
+}
+
+int vm_base_opcode(int opcode)
+{
+	if ( opcode<=LAST_BYTECODE ) return opcode;
+	if ( opcode==TAIL_CALL ) return CALL;
+	return vm_superinstructions[opcode - (LAST_BYTECODE+1)].ops[0];
+}
+
+static bool matches(const Decoded_Instr *code, int n, VM_SUPERINSTRUCTION *s)
+{
+	if ( s->length>n ) return false;
+	for (int j = 0; j < s->length; j++) {
+		if ( code[j].opcode!=s->ops[j] ) return false;
+	}
+	return true;
+}
+
+void vm_fuse_superinstructions(VM *vm)
+{
+	Decoded_Instr *code = vm->instrs;
+	int n = vm->num_instrs;
+	int i = 0;
+	while ( i<n ) {
+		VM_SUPERINSTRUCTION *best = NULL;
+		for (int s = 0; s < NUM_SUPERINSTRUCTIONS; s++) { // longest match wins
+			VM_SUPERINSTRUCTION *super = &vm_superinstructions[s];
+			if ( (best==NULL || super->length>best->length) && matches(&code[i], n-i, super) ) {
+				best = super;
+			}
+		}
+		if ( best!=NULL ) {
+			code[i].opcode = best->opcode;
+			i += best->length;
+		}
+		else {
+			i++;
+		}
+	}
+}
+
+// --------------------------------- P r o f i l e ---------------------------------
+
+#define NGRAM_TABLE_SIZE 4096 // power of 2
+
+static Ngram ngrams[NGRAM_TABLE_SIZE];
+static int num_ngrams = 0;
+
+static int window[MAX_SUPER_LEN];	// opcodes of the last straight-line instructions executed
+static int window_len = 0;
+static long last_ip = -1;
+
+static unsigned int ngram_hash(const int *ops, int n)
+{
+	unsigned int h = (unsigned int)n;
+	for (int j = 0; j < n; j++) h = h * 31 + ops[j];
+	return h;
+}
+
+static void add_ngram(const int *ops, int n)
+{
+	unsigned int h = ngram_hash(ops, n) & (NGRAM_TABLE_SIZE-1);
+	while ( ngrams[h].n!=0 ) {
+		if ( ngrams[h].n==n && memcmp(ngrams[h].ops, ops, n*sizeof(int))==0 ) {
+			ngrams[h].count++;
+			return;
+		}
+		h = (h + 1) & (NGRAM_TABLE_SIZE-1);
+	}
+	if ( num_ngrams>=NGRAM_TABLE_SIZE-1 ) return; // full; ignore new sequences
+	ngrams[h].n = n;
+	memcpy(ngrams[h].ops, ops, n*sizeof(int));
+	ngrams[h].count = 1;
+	num_ngrams++;
+}
+
+/* Record the instruction about to execute at ip; only sequences that also sit
+ * next to each other in the code (no taken branches, calls or returns in
+ * between) are candidates for fusion.
+ */
+void vm_count_ngram(const Decoded_Instr *code, addr32 ip)
+{
+	if ( ip!=last_ip+1 ) window_len = 0;
+	last_ip = ip;
+	if ( window_len==MAX_SUPER_LEN ) {
+		memmove(window, window+1, (MAX_SUPER_LEN-1)*sizeof(int));
+		window_len--;
+	}
+	window[window_len++] = code[ip].opcode;
+	for (int n = 2; n <= window_len; n++) {
+		add_ngram(&window[window_len-n], n);
+	}
+}
+
+Ngram *vm_ngrams(int *n)
+{
+	Ngram *result = calloc((size_t)num_ngrams+1, sizeof(Ngram));
+	int k = 0;
+	for (int h = 0; h < NGRAM_TABLE_SIZE; h++) {
+		if ( ngrams[h].n!=0 ) result[k++] = ngrams[h];
+	}
+	*n = k;
+	return result;
+}
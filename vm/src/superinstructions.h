@@ -0,0 +1,64 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2015 Terence Parr, Hanzhou Shi, Shuai Yuan, Yuanyuan Zhang
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+#ifndef SUPERINSTRUCTIONS_H_
+#define SUPERINSTRUCTIONS_H_
+
+#include "vm.h"
+
+/* A superinstruction executes a sequence of instructions with a single
+ * dispatch. Only the first Decoded_Instr of a sequence is rewritten; the
+ * others keep their opcodes and operands (the fused handler reads them) so
+ * branches into the middle of a sequence still work.
+ */
+typedef struct {
+	char *name;
+	int opcode;
+	int length;
+	int ops[MAX_SUPER_LEN];
+} VM_SUPERINSTRUCTION;
+
+typedef struct {
+	int n;
+	int ops[MAX_SUPER_LEN];
+	unsigned long count;	// number of times sequence executed
+} Ngram;
+
+extern VM_SUPERINSTRUCTION vm_superinstructions[];
+extern const int NUM_SUPERINSTRUCTIONS;
+
+/* Rewrite the first instruction of each known sequence in vm->instrs */
+extern void vm_fuse_superinstructions(VM *vm);
+
+/* Name and first component opcode of any handler id, fused or not */
+extern char *vm_handler_name(int opcode);
+extern int vm_base_opcode(int opcode);
+
+/* Can opcode be part of a superinstruction; i.e., does vm.c have a DO_ body for it? */
+extern bool vm_fusable(int opcode);
+
+/* n-gram profile; filled in by vm_exec() built with PROFILE_NGRAMS */
+extern void vm_count_ngram(const Decoded_Instr *code, addr32 ip);
+extern Ngram *vm_ngrams(int *n);
+
+#endif
@@ -0,0 +1,427 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2015 Terence Parr, Hanzhou Shi, Shuai Yuan, Yuanyuan Zhang
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <wich.h>
+#include <morecore.h>
+#include "vm.h"
+#include "verifier.h"
+#include "output.h"
+#include "tasks.h"
+
+static const int TASK_HEAP_SIZE = 64*1024;	// what a task's heap starts at; it grows as needed
+
+typedef struct task {
+	int func;				// index of the function it runs
+	VM *vm;					// NULL once joined
+	bool started;
+	bool done;
+	VM *joiner;				// the VM that first JOINed it, if any
+	struct task *joining;	// the unfinished task it suspended JOINing, if any
+	struct task *waiters;	// tasks suspended JOINing it, linked through next_waiter
+	struct task *next_waiter;
+} Task;
+
+/* Ready tasks in a ring, oldest at head. The owner takes from the tail,
+ * thieves from the head.
+ */
+typedef struct {
+	pthread_mutex_t lock;
+	Task **tasks;
+	int head;
+	int count;
+	int max;
+} Deque;
+
+typedef struct {
+	struct scheduler *scheduler;
+	int id;
+	pthread_t thread;
+	bool running;
+} Worker;
+
+typedef struct scheduler {
+	pthread_mutex_t lock;	// guards all but the deques, which have their own locks
+	pthread_cond_t cond;	// signalled as tasks become ready, broadcast as they finish
+	Task **tasks;			// by handle
+	int num_tasks;
+	int max_tasks;
+	char **arg_types;		// per function, once it's spawned; see vm_frame_types()
+	Deque *deques;			// one per worker then one for other threads
+	Worker *workers;
+	int num_workers;
+	int ready;				// tasks on the deques no thread has claimed yet
+	bool stopping;
+	VM **pool;				// VMs of joined tasks, for SPAWN to reuse
+	int num_pooled;
+	int max_pooled;
+} Scheduler;
+
+static _Thread_local Worker *current_worker; // the worker this thread is, if any
+
+static void task_error(VM *vm, const char *what, int handle)
+{
+	fprintf(stderr, "JOIN of %s task %d\n", what, handle);
+	vm_fail(vm);
+}
+
+static void push(Deque *q, Task *t, bool oldest)
+{
+	pthread_mutex_lock(&q->lock);
+	if ( q->count==q->max ) {
+		int max = q->max==0 ? 16 : 2*q->max;
+		Task **tasks = malloc(max * sizeof(Task *));
+		for (int k = 0; k < q->count; k++) tasks[k] = q->tasks[(q->head + k) % q->max];
+		free(q->tasks);
+		q->tasks = tasks;
+		q->head = 0;
+		q->max = max;
+	}
+	if ( oldest ) {
+		q->head = (q->head + q->max - 1) % q->max;
+		q->tasks[q->head] = t;
+	}
+	else q->tasks[(q->head + q->count) % q->max] = t;
+	q->count++;
+	pthread_mutex_unlock(&q->lock);
+}
+
+static Task *pop(Deque *q, bool newest)
+{
+	Task *t = NULL;
+	pthread_mutex_lock(&q->lock);
+	if ( q->count>0 ) {
+		if ( newest ) t = q->tasks[(q->head + q->count - 1) % q->max];
+		else {
+			t = q->tasks[q->head];
+			q->head = (q->head + 1) % q->max;
+		}
+		q->count--;
+	}
+	pthread_mutex_unlock(&q->lock);
+	return t;
+}
+
+// this thread's deque
+static int home(Scheduler *s)
+{
+	return current_worker!=NULL && current_worker->scheduler==s ? current_worker->id : s->num_workers;
+}
+
+// s->lock is held
+static void make_ready(Scheduler *s, Task *t, bool oldest)
+{
+	push(&s->deques[home(s)], t, oldest);
+	s->ready++;
+	pthread_cond_signal(&s->cond);
+}
+
+/* A task off some deque. The caller has claimed one by decrementing s->ready,
+ * so there's a task for it even if others get to the deques first.
+ */
+static Task *take(Scheduler *s)
+{
+	int me = home(s);
+	int n = s->num_workers + 1;
+	for (;;) {
+		Task *t = pop(&s->deques[me], true);
+		for (int k = 1; t==NULL && k < n; k++) t = pop(&s->deques[(me + k) % n], false);
+		if ( t!=NULL ) return t;
+	}
+}
+
+/* Run t until it finishes or suspends, then see to those waiting for it or
+ * what it's waiting for.
+ */
+static void run(Scheduler *s, Task *t)
+{
+	bool done = vm_run_task(t->vm, t->started ? NULL : &t->vm->functions[t->func]);
+	t->started = true;
+	pthread_mutex_lock(&s->lock);
+	if ( done ) {
+		t->done = true;
+		Task *w = t->waiters;
+		while ( w!=NULL ) {
+			Task *next = w->next_waiter;
+			make_ready(s, w, false);
+			w = next;
+		}
+		t->waiters = NULL;
+		pthread_cond_broadcast(&s->cond);
+	}
+	else if ( t->joining!=NULL ) {
+		if ( t->joining->done ) make_ready(s, t, false);
+		else {
+			t->next_waiter = t->joining->waiters;
+			t->joining->waiters = t;
+		}
+		t->joining = NULL;
+	}
+	else make_ready(s, t, true); // YIELDed; let the others go first
+	pthread_mutex_unlock(&s->lock);
+}
+
+/* Claim and run one ready task, if there is one; s->lock is held */
+static bool run_ready(Scheduler *s)
+{
+	if ( s->ready==0 ) return false;
+	s->ready--;
+	pthread_mutex_unlock(&s->lock);
+	run(s, take(s));
+	pthread_mutex_lock(&s->lock);
+	return true;
+}
+
+/* Run ready tasks on this thread until t is done */
+static void wait_for(Scheduler *s, Task *t)
+{
+	pthread_mutex_lock(&s->lock);
+	while ( !t->done ) {
+		if ( !run_ready(s) ) pthread_cond_wait(&s->cond, &s->lock);
+	}
+	pthread_mutex_unlock(&s->lock);
+}
+
+static void *work(void *arg)
+{
+	Worker *w = arg;
+	Scheduler *s = w->scheduler;
+	current_worker = w;
+	pthread_mutex_lock(&s->lock);
+	while ( !s->stopping ) {
+		if ( !run_ready(s) ) pthread_cond_wait(&s->cond, &s->lock);
+	}
+	pthread_mutex_unlock(&s->lock);
+	return NULL;
+}
+
+static Scheduler *scheduler_new(VM *vm)
+{
+	Scheduler *s = calloc(1, sizeof(Scheduler));
+	pthread_mutex_init(&s->lock, NULL);
+	pthread_cond_init(&s->cond, NULL);
+	s->arg_types = calloc((size_t)vm->num_functions+1, sizeof(char *));
+	s->num_workers = vm->workers>0 ? vm->workers : (int)sysconf(_SC_NPROCESSORS_ONLN);
+	if ( s->num_workers<1 ) s->num_workers = 1;
+	s->deques = calloc((size_t)s->num_workers+1, sizeof(Deque));
+	for (int d = 0; d <= s->num_workers; d++) pthread_mutex_init(&s->deques[d].lock, NULL);
+	s->workers = calloc((size_t)s->num_workers, sizeof(Worker));
+	for (int w = 0; w < s->num_workers; w++) { // with no threads, tasks run as they're joined
+		s->workers[w].scheduler = s;
+		s->workers[w].id = w;
+		s->workers[w].running = pthread_create(&s->workers[w].thread, NULL, work, &s->workers[w])==0;
+	}
+	return s;
+}
+
+/* e as the given verifier type, with a string or vector copied into the
+ * current heap
+ */
+static element copy_value(element e, char type)
+{
+	if ( type=='s' && e.s!=NULL ) e.s = String_new(e.s->str);
+	else if ( type=='v' && VPTR(e).vector!=NULL ) SET_VPTR(e, PVector_flatten(VPTR(e)));
+	return e;
+}
+
+/* The types of function f's args, worked out the first time it's spawned */
+static char *arg_types(Scheduler *s, VM *vm, int f)
+{
+	pthread_mutex_lock(&s->lock);
+	if ( s->arg_types[f]==NULL ) {
+		int depth;
+		s->arg_types[f] = vm_frame_types(vm, &vm->functions[f], vm->functions[f].entry, &depth);
+	}
+	char *types = s->arg_types[f];
+	pthread_mutex_unlock(&s->lock);
+	return types;
+}
+
+/* A VM for a task to run module's code: a joined task's, if there is one */
+static VM *task_vm(Scheduler *s, VM *module)
+{
+	pthread_mutex_lock(&s->lock);
+	VM *vm = s->num_pooled>0 ? s->pool[--s->num_pooled] : NULL;
+	pthread_mutex_unlock(&s->lock);
+	if ( vm==NULL ) {
+		vm = vm_alloc_with_heap(gc_heap_new_growable(TASK_HEAP_SIZE, (int)DEFAULT_MAX_HEAP_SIZE));
+		vm->capture_output = true;
+		vm->tasks = s;
+	}
+	vm_use_module(vm, module);
+	vm->jit_threshold = module->jit_threshold;
+	return vm;
+}
+
+/* Keep the VM of a task whose output and result have been taken for reuse */
+static void pool_vm(Scheduler *s, VM *vm)
+{
+	gc_heap_reset(vm->heap);
+	vm->task = NULL;
+	pthread_mutex_lock(&s->lock);
+	if ( s->num_pooled==s->max_pooled ) {
+		s->max_pooled = s->max_pooled==0 ? 16 : 2*s->max_pooled;
+		s->pool = realloc(s->pool, s->max_pooled * sizeof(VM *));
+	}
+	s->pool[s->num_pooled++] = vm;
+	pthread_mutex_unlock(&s->lock);
+}
+
+void vm_spawn(VM *vm, Function_metadata *func)
+{
+	if ( vm->tasks==NULL ) vm->tasks = scheduler_new(vm);
+	Scheduler *s = vm->tasks;
+	int f = (int)(func - vm->functions);
+	char *types = arg_types(s, vm, f);
+	if ( types==NULL ) {
+		fprintf(stderr, "can't spawn %s, which doesn't verify\n", func->name);
+		vm_fail(vm);
+	}
+
+	Task *t = calloc(1, sizeof(Task));
+	t->func = f;
+	t->vm = task_vm(s, vm);
+	t->vm->task = t;
+	// the args move to the task's stack, strings and vectors into its heap
+	element *args = &vm->stack[vm->sp - func->nargs + 1];
+	Heap_Context *caller_heap = gc_use_heap(t->vm->heap);
+	for (int k = 0; k < func->nargs; k++) t->vm->stack[k] = copy_value(args[k], types[k]);
+	gc_use_heap(caller_heap);
+	t->vm->sp = func->nargs - 1;
+	vm->sp -= func->nargs;
+
+	pthread_mutex_lock(&s->lock);
+	if ( s->num_tasks==s->max_tasks ) {
+		s->max_tasks = s->max_tasks==0 ? 16 : 2*s->max_tasks;
+		s->tasks = realloc(s->tasks, s->max_tasks * sizeof(Task *));
+	}
+	int handle = s->num_tasks++;
+	s->tasks[handle] = t;
+	make_ready(s, t, false);
+	pthread_mutex_unlock(&s->lock);
+	vm->stack[++vm->sp].i = handle;
+}
+
+bool vm_yield(VM *vm)
+{
+	Scheduler *s = vm->tasks;
+	if ( s==NULL ) return false;
+	pthread_mutex_lock(&s->lock);
+	bool suspend = s->ready>0 && vm->task!=NULL && vm->nested_runs==0;
+	if ( !suspend ) run_ready(s);
+	pthread_mutex_unlock(&s->lock);
+	vm->suspended = suspend;
+	return suspend;
+}
+
+bool vm_join(VM *vm, Function_metadata *func)
+{
+	Scheduler *s = vm->tasks;
+	int handle = vm->stack[vm->sp].i;
+	Task *t = NULL;
+	if ( s!=NULL ) pthread_mutex_lock(&s->lock);
+	if ( s!=NULL && handle>=0 && handle<s->num_tasks ) t = s->tasks[handle];
+	bool claimed = t!=NULL && (t->joiner==NULL || (t->joiner==vm && t->vm!=NULL)); // vm may be retrying
+	if ( claimed ) t->joiner = vm;
+	bool done = t!=NULL && t->done;
+	if ( s!=NULL ) pthread_mutex_unlock(&s->lock);
+	if ( t==NULL ) task_error(vm, "unknown", handle);
+	if ( !claimed ) task_error(vm, "already joined", handle);
+	if ( t==vm->task ) task_error(vm, "its own", handle);
+	if ( t->func!=(int)(func - vm->functions) ) task_error(vm, "another function's", handle);
+
+	if ( !done ) {
+		if ( vm->task!=NULL && vm->nested_runs==0 ) {
+			vm->task->joining = t;
+			vm->suspended = true;
+			return false;
+		}
+		wait_for(s, t);
+	}
+
+	VM *task_vm = t->vm;
+	t->vm = NULL;
+	size_t len;
+	char *output = vm_take_output(task_vm, &len);
+	vm_write_output(vm, output, len);
+	free(output);
+	vm->sp--;
+	int type = func->return_type;
+	if ( type>=INT_TYPE && type<=VECTOR_TYPE ) {
+		char letter = type==STRING_TYPE ? 's' : type==VECTOR_TYPE ? 'v' : 0;
+		vm->stack[++vm->sp] = copy_value(task_vm->stack[task_vm->sp], letter);
+	}
+	pool_vm(s, task_vm);
+	return true;
+}
+
+void vm_finish_tasks(VM *vm)
+{
+	Scheduler *s = vm->tasks;
+	for (int i = 0; ; i++) { // only running tasks spawn more, so all are done once the last is
+		pthread_mutex_lock(&s->lock);
+		Task *t = i<s->num_tasks ? s->tasks[i] : NULL;
+		pthread_mutex_unlock(&s->lock);
+		if ( t==NULL ) break;
+		wait_for(s, t);
+	}
+
+	pthread_mutex_lock(&s->lock);
+	s->stopping = true;
+	pthread_cond_broadcast(&s->cond);
+	pthread_mutex_unlock(&s->lock);
+	for (int w = 0; w < s->num_workers; w++) {
+		if ( s->workers[w].running ) pthread_join(s->workers[w].thread, NULL);
+	}
+
+	for (int i = 0; i < s->num_tasks; i++) {
+		Task *t = s->tasks[i];
+		if ( t->vm!=NULL ) {
+			size_t len;
+			char *output = vm_take_output(t->vm, &len);
+			vm_write_output(vm, output, len);
+			free(output);
+			vm_free(t->vm);
+		}
+		free(t);
+	}
+	for (int i = 0; i < s->num_pooled; i++) vm_free(s->pool[i]);
+	for (int d = 0; d <= s->num_workers; d++) {
+		pthread_mutex_destroy(&s->deques[d].lock);
+		free(s->deques[d].tasks);
+	}
+	for (int f = 0; f < vm->num_functions; f++) free(s->arg_types[f]);
+	pthread_mutex_destroy(&s->lock);
+	pthread_cond_destroy(&s->cond);
+	free(s->arg_types);
+	free(s->deques);
+	free(s->workers);
+	free(s->tasks);
+	free(s->pool);
+	free(s);
+	vm->tasks = NULL;
+}
@@ -0,0 +1,79 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2015 Terence Parr, Hanzhou Shi, Shuai Yuan, Yuanyuan Zhang
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+#ifndef TASKS_H_
+#define TASKS_H_
+
+#include "vm.h"
+
+/* Green threads. SPAWN f pops f's args and starts a task running f with
+ * them, pushing an int handle for it. JOIN f pops a handle, waits for that
+ * task, which must be running f, and pushes f's result, if it has one; each
+ * task is joined at most once. YIELD lets other tasks run.
+ *
+ * A task is a VM of its own pointed at the program's code (see
+ * vm_use_module()), so it has its own operand and call stacks, which cost
+ * nothing until used (see vmstack.h), and its own GC heap, which starts
+ * small and grows as needed; once a task is joined, its VM is emptied and
+ * kept for the next SPAWN. Tasks share nothing and run in parallel without
+ * locking: string and vector args are copied into the task's heap at SPAWN,
+ * their types coming from vm_frame_types(), and the result into the
+ * joiner's heap at JOIN. What a task prints is captured and comes out where
+ * it's joined; the output of tasks never joined follows the program's, in
+ * the order they were spawned.
+ *
+ * The first SPAWN starts a scheduler with vm->workers threads. Each worker
+ * has a deque of ready tasks, and threads that aren't workers share one
+ * more. A spawned task goes on the spawning thread's deque; a worker takes
+ * the newest task from its own deque and, once that's empty, steals the
+ * oldest from the others'. A task runs until it finishes, YIELDs or JOINs a
+ * task that isn't done. Its registers are all in its VM, so suspending it
+ * only takes returning from the interpreter: a YIELDing task goes back on
+ * the deque behind the others and a JOINing one waits for the task it
+ * joins to finish. The program's own VM and tasks running under native
+ * code (see vm_jit_call()) can't give up their thread like that, so their
+ * YIELD runs a ready task, if there is one, and their JOIN runs ready tasks
+ * until the one joined is done. The JIT and the register machine leave code
+ * using tasks to the interpreter.
+ */
+
+/* SPAWN func: start a task calling func on the args on top of vm's stack,
+ * replacing them with its handle.
+ */
+extern void vm_spawn(VM *vm, Function_metadata *func);
+
+/* YIELD: true if vm's task is to suspend and resume later */
+extern bool vm_yield(VM *vm);
+
+/* JOIN func: replace the handle on top of vm's stack with the result of the
+ * task it names, once done. False, with the stack untouched, if vm's task is
+ * to suspend and retry the JOIN once the task it joins is done.
+ */
+extern bool vm_join(VM *vm, Function_metadata *func);
+
+/* Run vm's remaining tasks to completion, write out what those never joined
+ * printed and stop the scheduler. vm_exec() calls this as the program ends.
+ */
+extern void vm_finish_tasks(VM *vm);
+
+#endif
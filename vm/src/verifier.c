@@ -0,0 +1,422 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2015 Terence Parr, Hanzhou Shi, Shuai Yuan, Yuanyuan Zhang
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <wich.h>
+#include "vm.h"
+#include "decoder.h"
+#include "superinstructions.h"
+#include "verifier.h"
+
+/* Types are tracked as the characters used in instruction signatures:
+ * 'i' int or boolean, 'f' float, 's' string, 'v' vector. '*' in a signature
+ * matches any type and 0 is the type of a local nothing has stored or loaded.
+ * ICONST 0 has type '0', which is also a float: the compiler uses it for
+ * float zero and the bits are the same.
+ */
+
+static inline bool type_matches(char expected, char actual)
+{
+	return expected=='*' || expected==actual || (actual=='0' && (expected=='i' || expected=='f'));
+}
+
+// state of the verification of one function
+typedef struct {
+	VM *vm;
+	Function_metadata *func;
+	int start, end;		// its instructions in vm->instrs
+	int *depth;			// operand stack depth before each instruction; -1 if not reached
+	char **types;		// operand stack types before each instruction
+	char *locals;		// type of each local
+	int max_depth;
+} Verification;
+
+static bool verify_function(Verification *v, char **local_types);
+static bool verify_instr(Verification *v, int i, char *types, int *d, char **local_types);
+
+/* The type of each local comes from the loads of it, so callers can check
+ * arguments against the types the callee uses them as.
+ */
+static bool load_local_types(VM *vm, char **local_types)
+{
+	bool ok = true;
+	for (int f = 0; ok && f < vm->num_functions; f++) {
+		Function_metadata *func = &vm->functions[f];
+		int end = vm_function_end(vm, func);
+		if ( func->nargs<0 || func->nlocals<0 ) {
+			fprintf(stderr, "verify error in %s: invalid frame of %d args and %d locals\n",
+					func->name, func->nargs, func->nlocals);
+			ok = false;
+			break;
+		}
+		local_types[f] = calloc((size_t)(func->nargs + func->nlocals) + 1, 1);
+		if ( func->return_type<0 || func->return_type>VECTOR_TYPE ) {
+			fprintf(stderr, "verify error in %s: invalid return type %d\n", func->name, func->return_type);
+			ok = false;
+		}
+		for (int i = func->entry; ok && i < end; i++) {
+			const Decoded_Instr *I = &vm->instrs[i];
+			char type;
+			switch ( vm_base_opcode(I->opcode) ) {
+				case ILOAD: type = 'i'; break;
+				case FLOAD: type = 'f'; break;
+				case SLOAD: type = 's'; break;
+				case VLOAD: type = 'v'; break;
+				default: continue;
+			}
+			int n = I->opnd.i;
+			if ( n<0 || n>=func->nargs+func->nlocals ) continue; // reported if reachable
+			if ( local_types[f][n]!=0 && local_types[f][n]!=type ) {
+				fprintf(stderr, "verify error in %s at ip=%d: local %d loaded as %c and %c\n",
+						func->name, I->addr, n, local_types[f][n], type);
+				ok = false;
+			}
+			local_types[f][n] = type;
+		}
+	}
+	return ok;
+}
+
+static void verification_init(Verification *v, VM *vm, int f, char **local_types)
+{
+	v->vm = vm;
+	v->func = &vm->functions[f];
+	v->start = v->func->entry;
+	v->end = vm_function_end(vm, v->func);
+	v->locals = local_types[f];
+	int n = v->end - v->start;
+	v->depth = malloc((n+1) * sizeof(int));
+	v->types = calloc((size_t)n+1, sizeof(char *));
+}
+
+static void verification_free(Verification *v)
+{
+	for (int k = 0; k <= v->end - v->start; k++) free(v->types[k]);
+	free(v->types);
+	free(v->depth);
+}
+
+static void free_local_types(VM *vm, char **local_types)
+{
+	for (int f = 0; f < vm->num_functions; f++) free(local_types[f]);
+	free(local_types);
+}
+
+bool vm_verify(VM *vm)
+{
+	if ( vm->instrs==NULL && !vm_predecode(vm) ) return false;
+
+	char **local_types = calloc((size_t)vm->num_functions, sizeof(char *));
+	bool ok = load_local_types(vm, local_types);
+	for (int f = 0; ok && f < vm->num_functions; f++) {
+		Verification v = {0};
+		verification_init(&v, vm, f, local_types);
+		ok = verify_function(&v, local_types);
+		if ( ok ) v.func->max_stack = v.max_depth;
+		verification_free(&v);
+	}
+	free_local_types(vm, local_types);
+	vm->verified = ok;
+	return ok;
+}
+
+char *vm_frame_types(VM *vm, Function_metadata *func, int i, int *depth)
+{
+	if ( vm->instrs==NULL && !vm_predecode(vm) ) return NULL;
+
+	char **local_types = calloc((size_t)vm->num_functions, sizeof(char *));
+	bool ok = load_local_types(vm, local_types);
+	char *types = NULL;
+	if ( ok ) {
+		Verification v = {0};
+		verification_init(&v, vm, (int)(func - vm->functions), local_types);
+		if ( verify_function(&v, local_types) && i>=v.start && i<v.end && v.depth[i - v.start]>=0 ) {
+			int nvars = func->nargs + func->nlocals;
+			*depth = v.depth[i - v.start];
+			types = malloc((size_t)(nvars + *depth) + 1);
+			memcpy(types, v.locals, (size_t)nvars);
+			memcpy(&types[nvars], v.types[i - v.start], (size_t)*depth);
+		}
+		verification_free(&v);
+	}
+	free_local_types(vm, local_types);
+	return types;
+}
+
+static bool verify_error(Verification *v, int i, const char *fmt, ...)
+{
+	va_list args;
+	fprintf(stderr, "verify error in %s at ip=%d: ", v->func->name, v->vm->instrs[i].addr);
+	va_start(args, fmt);
+	vfprintf(stderr, fmt, args);
+	va_end(args);
+	fprintf(stderr, "\n");
+	return false;
+}
+
+static char return_type(Function_metadata *func)
+{
+	if ( func->return_type==INT_TYPE || func->return_type==BOOLEAN_TYPE ) return 'i';
+	if ( func->return_type==FLOAT_TYPE ) return 'f';
+	if ( func->return_type==STRING_TYPE ) return 's';
+	if ( func->return_type==VECTOR_TYPE ) return 'v';
+	return 0;
+}
+
+/* Record that control reaches instruction j with d operands of the given types */
+static bool flow_to(Verification *v, int i, int j, char *types, int d, int *work, int *nwork)
+{
+	if ( j<v->start || j>=v->end ) {
+		return verify_error(v, i, j==i+1 ? "control falls off the end of the function" :
+											  "branch leaves the function");
+	}
+	int k = j - v->start;
+	if ( v->depth[k]<0 ) {
+		v->depth[k] = d;
+		v->types[k] = malloc((size_t)d+1);
+		memcpy(v->types[k], types, (size_t)d);
+		work[(*nwork)++] = j;
+		return true;
+	}
+	if ( v->depth[k]!=d || memcmp(v->types[k], types, (size_t)d)!=0 ) {
+		return verify_error(v, j, "operand stack differs between paths to this instruction");
+	}
+	return true;
+}
+
+static bool verify_function(Verification *v, char **local_types)
+{
+	const Decoded_Instr *code = v->vm->instrs;
+	int n = v->end - v->start;
+	if ( n<=0 ) {
+		fprintf(stderr, "verify error in %s: no instructions\n", v->func->name);
+		return false;
+	}
+	int *work = malloc(n * sizeof(int));
+	int nwork = 0;
+	char *types = malloc((size_t)n+1); // no deeper than one push per instruction
+	bool ok = true;
+
+	for (int k = 0; k <= n; k++) v->depth[k] = -1;
+	v->depth[0] = 0;
+	v->types[0] = malloc(1);
+	work[nwork++] = v->start;
+	while ( ok && nwork>0 ) {
+		int i = work[--nwork];
+		int d = v->depth[i - v->start];
+		memcpy(types, v->types[i - v->start], (size_t)d);
+		ok = verify_instr(v, i, types, &d, local_types);
+		if ( !ok ) break;
+		if ( d>v->max_depth ) v->max_depth = d;
+		switch ( vm_base_opcode(code[i].opcode) ) {
+			case RET: case HALT:
+				break;
+			case BR:
+				ok = flow_to(v, i, code[i].target, types, d, work, &nwork);
+				break;
+			case BRF:
+				ok = flow_to(v, i, code[i].target, types, d, work, &nwork) &&
+					 flow_to(v, i, i+1, types, d, work, &nwork);
+				break;
+			default:
+				ok = flow_to(v, i, i+1, types, d, work, &nwork);
+				break;
+		}
+	}
+	free(types);
+	free(work);
+	return ok;
+}
+
+/* Operand types popped and pushed by the instructions that don't need more
+ * than their opcode to check: "popped:pushed", top of stack last.
+ */
+static const char *signature(int opcode)
+{
+	switch ( opcode ) {
+		case IADD: case ISUB: case IMUL: case IDIV: case OR: case AND:
+		case IEQ: case INEQ: case ILT: case ILE: case IGT: case IGE:
+			return "ii:i";
+		case FADD: case FSUB: case FMUL: case FDIV:
+			return "ff:f";
+		case FEQ: case FNEQ: case FLT: case FLE: case FGT: case FGE:
+			return "ff:i";
+		case VADD: case VSUB: case VMUL: case VDIV:
+			return "vv:v";
+		case VADDI: case VSUBI: case VMULI: case VDIVI:
+			return "vi:v";
+		case VADDF: case VSUBF: case VMULF: case VDIVF:
+			return "vf:v";
+		case SADD:
+			return "ss:s";
+		case SEQ: case SNEQ: case SGT: case SGE: case SLT: case SLE:
+			return "ss:i";
+		case VEQ: case VNEQ:
+			return "vv:i";
+		case INEG: case NOT:	return "i:i";
+		case FNEG:				return "f:f";
+		case I2F:				return "i:f";
+		case F2I:				return "f:i";
+		case I2S:				return "i:s";
+		case F2S:				return "f:s";
+		case V2S:				return "v:s";
+		case BRF:				return "i:";
+		case ICONST:			return ":i";
+		case FCONST:			return ":f";
+		case SCONST:			return ":s";
+		case ILOAD:				return ":i";
+		case FLOAD:				return ":f";
+		case SLOAD:				return ":s";
+		case VLOAD:				return ":v";
+		case STORE: case POP:	return "*:";
+		case VLOAD_INDEX:		return "vi:f";
+		case STORE_INDEX:		return "vif:";
+		case SLOAD_INDEX:		return "si:s";
+		case IPRINT: case BPRINT: return "i:";
+		case FPRINT:			return "f:";
+		case SPRINT:			return "s:";
+		case VPRINT:			return "v:";
+		case VLEN:				return "v:i";
+		case SLEN:				return "s:i";
+		case COPY_VECTOR:		return "v:v";
+		case HALT: case BR: case NOP: case GC_START: case GC_END: case SNAPSHOT: case YIELD:
+			return ":";
+		default:
+			return NULL;
+	}
+}
+
+/* Pop operands of the types in popped (matched bottom to top) and push pushed */
+static bool apply(Verification *v, int i, const char *popped, const char *pushed, char *types, int *d)
+{
+	int npop = (int)strlen(popped), npush = (int)strlen(pushed);
+	if ( npop>*d ) return verify_error(v, i, "%s needs %d operands but the stack has %d",
+									   vm_handler_name(v->vm->instrs[i].opcode), npop, *d);
+	for (int k = 0; k < npop; k++) {
+		char actual = types[*d - npop + k];
+		if ( !type_matches(popped[k], actual) ) {
+			return verify_error(v, i, "%s operand %d is %c, not %c",
+								vm_handler_name(v->vm->instrs[i].opcode), k+1, actual, popped[k]);
+		}
+	}
+	*d -= npop;
+	if ( *d+npush>=MAX_OPND_STACK ) return verify_error(v, i, "operand stack overflow");
+	memcpy(&types[*d], pushed, (size_t)npush);
+	*d += npush;
+	return true;
+}
+
+static bool verify_local(Verification *v, int i, int n)
+{
+	int nvars = v->func->nargs + v->func->nlocals;
+	if ( n<0 || n>=nvars ) return verify_error(v, i, "local %d out of range 0..%d", n, nvars-1);
+	return true;
+}
+
+static bool verify_instr(Verification *v, int i, char *types, int *d, char **local_types)
+{
+	VM *vm = v->vm;
+	const Decoded_Instr *I = &vm->instrs[i];
+	int opcode = vm_base_opcode(I->opcode);
+	const char *sig = signature(opcode);
+	char popped[4], pushed[2] = {0};
+
+	switch ( opcode ) {
+		case ILOAD: case FLOAD: case SLOAD: case VLOAD:
+			if ( !verify_local(v, i, I->opnd.i) ) return false;
+			break;
+		case STORE: {
+			int n = I->opnd.i;
+			if ( !verify_local(v, i, n) ) return false;
+			if ( *d==0 ) break; // apply() reports it
+			char type = types[*d-1];
+			if ( v->locals[n]!=0 && !type_matches(v->locals[n], type) ) {
+				return verify_error(v, i, "storing %c in local %d of type %c", type, n, v->locals[n]);
+			}
+			if ( type!='0' ) v->locals[n] = type;
+			break;
+		}
+		case ICONST:
+			if ( I->opnd.i==0 ) return apply(v, i, "", "0", types, d);
+			break;
+		case SCONST:
+			if ( I->opnd.i<0 || I->opnd.i>=vm->num_strings ) {
+				return verify_error(v, i, "no string %d", I->opnd.i);
+			}
+			break;
+		case VECTOR: {
+			int n = i>v->start && vm_base_opcode(vm->instrs[i-1].opcode)==ICONST ? vm->instrs[i-1].opnd.i : -1;
+			if ( n<0 || n>=MAX_OPND_STACK ) return verify_error(v, i, "VECTOR needs a constant element count");
+			char *elems = malloc((size_t)n+2);
+			memset(elems, 'f', (size_t)n);
+			elems[n] = 'i';
+			elems[n+1] = '\0';
+			bool ok = apply(v, i, elems, "v", types, d);
+			free(elems);
+			return ok;
+		}
+		case CALL: case SPAWN: {
+			int f = I->opnd.i;
+			if ( f<0 || f>=vm->num_functions ) return verify_error(v, i, "no function %d", f);
+			Function_metadata *callee = &vm->functions[f];
+			char *args = malloc((size_t)callee->nargs+1);
+			for (int k = 0; k < callee->nargs; k++) {
+				args[k] = local_types[f][k]!=0 ? local_types[f][k] : '*';
+			}
+			args[callee->nargs] = '\0';
+			pushed[0] = opcode==SPAWN ? 'i' : return_type(callee); // SPAWN pushes a task handle
+			bool ok = apply(v, i, args, pushed, types, d);
+			free(args);
+			return ok;
+		}
+		case JOIN:
+			if ( I->opnd.i<0 || I->opnd.i>=vm->num_functions ) return verify_error(v, i, "no function %d", I->opnd.i);
+			pushed[0] = return_type(&vm->functions[I->opnd.i]);
+			return apply(v, i, "i", pushed, types, d);
+		case RET:
+			popped[0] = return_type(v->func);
+			popped[1] = '\0';
+			if ( !apply(v, i, popped, "", types, d) ) return false;
+			if ( *d!=0 ) return verify_error(v, i, "%d values left on the stack at RET", *d);
+			return true;
+		case PUSH_DFLT_RETV:
+			pushed[0] = return_type(v->func);
+			return apply(v, i, "", pushed, types, d);
+		case SROOT: case VROOT: // roots the top of the stack, if any
+			if ( *d>0 && types[*d-1]!=(opcode==SROOT ? 's' : 'v') ) {
+				return verify_error(v, i, "%s of a %c", vm_handler_name(I->opcode), types[*d-1]);
+			}
+			return true;
+		case BR: case BRF:
+			break; // flow_to() checks the target
+	}
+	if ( sig==NULL ) return verify_error(v, i, "invalid opcode %d", I->opcode);
+	const char *colon = strchr(sig, ':');
+	size_t npop = (size_t)(colon - sig);
+	memcpy(popped, sig, npop);
+	popped[npop] = '\0';
+	return apply(v, i, popped, colon+1, types, d);
+}
@@ -0,0 +1,54 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2015 Terence Parr, Hanzhou Shi, Shuai Yuan, Yuanyuan Zhang
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+#ifndef VERIFIER_H_
+#define VERIFIER_H_
+
+#include "vm.h"
+
+/* Load-time verification by abstract interpretation of each function's
+ * instructions. Every reachable instruction must see a single operand stack
+ * shape, whatever path leads to it, and that shape must hold what the
+ * instruction expects: the typed opcodes get operands of their type (ints
+ * and booleans share a representation), calls get their callee's arguments
+ * and RET leaves only the return value. Branches must stay inside their
+ * function, locals must be in the function's frame and be used with one
+ * type throughout, and control must not fall off the end of a function.
+ *
+ * On success, each function's max_stack is the deepest its operand stack
+ * gets and vm->verified is set. vm_exec() then only has to check for
+ * overflow at calls; the UNCHECKED build of the interpreter drops its per
+ * instruction stack checks and refuses to run code that doesn't verify.
+ * Errors are reported on stderr.
+ */
+extern bool vm_verify(VM *vm);
+
+/* What the verifier knows of func's frame just before instruction i runs: the
+ * types of its args and locals followed by those of the *depth operands on
+ * its stack, in the letters of the signatures in verifier.c ('s' for a
+ * string, 'v' for a vector and so on). The caller frees the result. NULL if
+ * func doesn't verify or doesn't reach i.
+ */
+extern char *vm_frame_types(VM *vm, Function_metadata *func, int i, int *depth);
+
+#endif
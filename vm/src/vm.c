@@ -24,10 +24,21 @@ SOFTWARE.
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
 #include <wich.h>
+#include <morecore.h>
 #include "vm.h"
 
 #include "wloader.h"
+#include "decoder.h"
+#include "superinstructions.h"
+#include "jit.h"
+#include "verifier.h"
+#include "vmstack.h"
+#include "counters.h"
+#include "output.h"
+#include "snapshot.h"
+#include "tasks.h"
 
 VM_INSTRUCTION vm_instructions[] = {
 		{"HALT", HALT, 0},
@@ -123,23 +134,78 @@ VM_INSTRUCTION vm_instructions[] = {
 		{"SROOT",       SROOT,          0},
 		{"VROOT",       VROOT,          0},
 		{"COPY_VECTOR",  COPY_VECTOR,   0},
+		{"SNAPSHOT",    SNAPSHOT,       0},
+		{"SPAWN",       SPAWN,          2},
+		{"YIELD",       YIELD,          0},
+		{"JOIN",        JOIN,           2},
 };
 
 static void vm_print_instr(VM *vm, addr32 ip);
 static void vm_print_stack(VM *vm);
-static inline int int32(const byte *data, addr32 ip);
-static inline int int16(const byte *data, addr32 ip);
-static inline float float32(const byte *data, addr32 ip);
 static void vm_call(VM *vm, Function_metadata *func);
+static void vm_tail_call(VM *vm, Function_metadata *func);
+static int vm_pop_frame(VM *vm, int sp);
+static void vm_interpret(VM *vm);
+static void vm_interpret_traced(VM *vm);
+static void vm_interpret_counted(VM *vm);
 static void vm_print_stack_value(word p);
-int push_default_value(int index, int sp,  element *stack);
+int push_default_value(VM *vm, int index, int sp, element *stack);
+static void intern_strings(VM *vm);
 
 VM * vm_alloc()
+{
+	return vm_alloc_with_heap(gc_heap_new((int)DEFAULT_MAX_HEAP_SIZE));
+}
+
+/* A VM allocating in heap, which vm_free() frees with it */
+VM *vm_alloc_with_heap(Heap_Context *heap)
 {
 	VM *vm = calloc(1, sizeof(VM));
+	vm->stack = vm_stack_reserve(MAX_OPND_STACK * sizeof(element));
+	vm->call_stack = vm_stack_reserve(MAX_CALL_STACK * sizeof(Activation_Record));
+	vm->output = malloc((size_t)OUTPUT_BUFFER_SIZE);
+	vm->heap = heap;
 	return vm;
 }
 
+static void free_functions(VM *vm)
+{
+	for (int i = 0; i < vm->num_functions; i++) {
+		Function_metadata *f = &vm->functions[i];
+		if ( f->native!=NULL ) munmap(f->native, f->native_size);
+		if ( !vm->shares_code ) free(f->name);
+	}
+	free(vm->functions);
+}
+
+/* Free the VM and everything it holds */
+void vm_free(VM *vm)
+{
+	vm_flush_output(vm);
+	free(vm->output);
+	free(vm->captured);
+	vm_stack_release(vm->stack, MAX_OPND_STACK * sizeof(element));
+	vm_stack_release(vm->call_stack, MAX_CALL_STACK * sizeof(Activation_Record));
+	free_functions(vm);
+	gc_heap_free(vm->heap);
+	if ( vm->shares_code ) {
+		free(vm);
+		return;
+	}
+	free(vm->instrs);
+	if ( vm->image!=NULL ) {
+		munmap(vm->image, vm->image_size);
+	}
+	else {
+		for (int i = 0; i < vm->num_strings; i++) free(vm->strings[i]);
+		free(vm->code);
+	}
+	free(vm->string_objects);
+	free(vm->string_pool);
+	free(vm->strings);
+	free(vm);
+}
+
 void vm_init(VM *vm, byte *code, int code_size)
 {
 	// we are linking in mark-and-compact collector so allocations all occur outside of the VM
@@ -148,16 +214,56 @@ void vm_init(VM *vm, byte *code, int code_size)
 	vm->sp = -1; // grow upwards, stack[sp] is top of stack and valid
 	vm->fp = -1; // frame pointer is invalid initially
 	vm->callsp = -1;
+	intern_strings(vm);
+#ifndef PROFILE_NGRAMS // profile everything in the interpreter
+	vm->jit_threshold = JIT_THRESHOLD;
+#endif
+}
+
+/* Make vm, fresh from vm_alloc() or only ever pointed at modules, run
+ * module's code. The
+ * code, decoded instructions and strings are shared, not copied, so module
+ * must be predecoded and must not change or go away while vm uses them.
+ * vm gets its own copy of the function table; call counts and native code
+ * stay with the VM that made them. Whatever vm ran before is dropped.
+ */
+void vm_use_module(VM *vm, VM *module)
+{
+	free_functions(vm);
+	vm->shares_code = true;
+	vm->code = module->code;
+	vm->code_size = module->code_size;
+	vm->instrs = module->instrs;
+	vm->num_instrs = module->num_instrs;
+	vm->verified = module->verified;
+	vm->data_size = module->data_size;
+	vm->num_strings = module->num_strings;
+	vm->strings = module->strings;
+	vm->string_objects = module->string_objects;
+	vm->empty_string = module->empty_string;
+	vm->num_functions = module->num_functions;
+	vm->max_functions = module->num_functions;
+	vm->functions = malloc(module->num_functions * sizeof(Function_metadata));
+	for (int i = 0; i < module->num_functions; i++) {
+		vm->functions[i] = module->functions[i];
+		vm->functions[i].ncalls = 0;
+		vm->functions[i].native = NULL;
+		vm->functions[i].native_size = 0;
+	}
+	vm->sp = -1;
+	vm->fp = -1;
+	vm->callsp = -1;
 }
 
 int def_function(VM *vm, char *name, int return_type, addr32 address, int nargs, int nlocals)
 {
-	if ( vm->num_functions>=MAX_FUNCTIONS ) {
-		fprintf(stderr, "Exceeded max functions %d\n", MAX_FUNCTIONS);
-		return -1;
+	if ( vm->num_functions>=vm->max_functions ) {
+		vm->max_functions = vm->max_functions==0 ? 16 : vm->max_functions*2;
+		vm->functions = realloc(vm->functions, vm->max_functions * sizeof(Function_metadata));
 	}
 	int i = vm->num_functions++;
 	Function_metadata *f = &vm->functions[i];
+	memset(f, 0, sizeof(Function_metadata));
 	f->name = strdup(name);
 	f->return_type = return_type;
 	f->address = address;
@@ -169,555 +275,574 @@ int def_function(VM *vm, char *name, int return_type, addr32 address, int nargs,
 #define WRITE_BACK_REGISTERS(vm) vm->ip = ip; vm->sp = sp; vm->fp = fp;
 #define LOAD_REGISTERS(vm) ip = vm->ip; sp = vm->sp; fp = vm->fp;
 
+#ifdef UNCHECKED // only verified code runs, and it can't leave the operand stack
+#define validate_stack_address(a)
+#else
 static void inline validate_stack_address(int a)
 {
 	if ((a) < 0 || (a) >= MAX_OPND_STACK) {
 		fprintf(stderr, "%d stack ptr out of range 0..%d\n", a, MAX_OPND_STACK - 1);
 	}
 }
+#endif
 
-static void inline zero_division_error()
+void vm_zero_division_error()
 {
 	fprintf(stderr, "ZeroDivisionError: Divisor cann't be 0\n");
 }
 
-static void gc_check()
+_Thread_local sigjmp_buf *vm_error_jump;
+
+void vm_fail(VM *vm)
+{
+	vm_flush_output(vm);
+	if ( vm_error_jump!=NULL ) siglongjmp(*vm_error_jump, 1);
+	exit(1);
+}
+
+void vm_gc_check()
 {
 	gc();
 	Heap_Info info = get_heap_info();
 	if ( info.live!=0 ) fprintf(stderr, "%d objects remain after collection\n", info.live);
 }
 
-void vm_exec(VM *vm, bool trace)
+/* The interpreter proper. By default (THREADED_DISPATCH), each handler ends
+ * by fetching the next opcode and jumping straight to its handler through
+ * dispatch_table using GCC's labels-as-values; each handler thus has its own
+ * indirect branch that the branch predictor can learn. Build without
+ * THREADED_DISPATCH to get a portable switch-based loop from the same handlers.
+ *
+ * Registers live in C locals and are written back to the VM only when
+ * something outside the loop could look at them: CALL/RET, GC root
+ * management, trace output and HALT.
+ *
+ * The body is in interpreter.inc, included below once for each variant:
+ * vm_interpret() with no instrumentation, vm_interpret_traced() and
+ * vm_interpret_counted(). vm_exec() picks one per run.
+ */
+#if defined(THREADED_DISPATCH) && defined(__GNUC__)
+#define CASE(op)			L_##op:
+#define INVALID_OPCODE		L_INVALID:
+#define DISPATCH()			goto *dispatch_table[opcode]
+#define DISPATCH_LOOP		DISPATCH();
+#define END_DISPATCH_LOOP
+#else
+#define CASE(op)			case op:
+#define INVALID_OPCODE		default:
+#define DISPATCH()			continue
+#define DISPATCH_LOOP		for (;;) switch (opcode) {
+#define END_DISPATCH_LOOP	}
+#endif
+
+#ifdef PROFILE_NGRAMS
+#define PROFILE()			vm_count_ngram(code, ip);
+#else
+#define PROFILE()
+#endif
+
+// TRACE_ and COUNT_ macros are defined per interpreter variant; see interpreter.inc
+#define FETCH()				opcode = code[ip].opcode; PROFILE(); COUNT(); TRACE_INSTR();
+#define JUMP(target)		{ ip = (target); TRACE_STACK(); FETCH(); DISPATCH(); }
+#define NEXT				JUMP(ip+1)
+
+/* Bodies of the instructions that may be fused into superinstructions (see
+ * superinstructions.def); k is the offset of the instruction from ip.
+ * Branches must come last in a superinstruction.
+ */
+#define INT_BINARY(k, op, field)	{ validate_stack_address(sp-1); y = stack[sp--].i; x = stack[sp].i; stack[sp].field = x op y; }
+#define FLOAT_BINARY(k, op, field)	{ validate_stack_address(sp-1); g = stack[sp--].f; f = stack[sp].f; stack[sp].field = f op g; }
+#define BOOL_BINARY(k, op)			{ validate_stack_address(sp-1); b2 = stack[sp--].b; b1 = stack[sp].b; stack[sp].b = b1 op b2; }
+
+#define DO_IADD(k)			INT_BINARY(k, +, i)
+#define DO_ISUB(k)			INT_BINARY(k, -, i)
+#define DO_IMUL(k)			INT_BINARY(k, *, i)
+#define DO_FADD(k)			FLOAT_BINARY(k, +, f)
+#define DO_FSUB(k)			FLOAT_BINARY(k, -, f)
+#define DO_FMUL(k)			FLOAT_BINARY(k, *, f)
+#define DO_OR(k)			BOOL_BINARY(k, ||)
+#define DO_AND(k)			BOOL_BINARY(k, &&)
+#define DO_INEG(k)			{ validate_stack_address(sp); stack[sp].i = -stack[sp].i; }
+#define DO_FNEG(k)			{ validate_stack_address(sp); stack[sp].f = -stack[sp].f; }
+#define DO_NOT(k)			{ validate_stack_address(sp); stack[sp].b = !stack[sp].b; }
+#define DO_I2F(k)			{ validate_stack_address(sp); stack[sp].f = stack[sp].i; }
+#define DO_F2I(k)			{ validate_stack_address(sp); stack[sp].i = (int)stack[sp].f; }
+#define DO_IEQ(k)			INT_BINARY(k, ==, b)
+#define DO_INEQ(k)			INT_BINARY(k, !=, b)
+#define DO_ILT(k)			INT_BINARY(k, <, b)
+#define DO_ILE(k)			INT_BINARY(k, <=, b)
+#define DO_IGT(k)			INT_BINARY(k, >, b)
+#define DO_IGE(k)			INT_BINARY(k, >=, b)
+#define DO_FEQ(k)			FLOAT_BINARY(k, ==, b)
+#define DO_FNEQ(k)			FLOAT_BINARY(k, !=, b)
+#define DO_FLT(k)			FLOAT_BINARY(k, <, b)
+#define DO_FLE(k)			FLOAT_BINARY(k, <=, b)
+#define DO_FGT(k)			FLOAT_BINARY(k, >, b)
+#define DO_FGE(k)			FLOAT_BINARY(k, >=, b)
+#define DO_BR(k)			JUMP(code[ip+(k)].target)
+#define DO_BRF(k)			{ validate_stack_address(sp); if ( !stack[sp--].b ) JUMP(code[ip+(k)].target); }
+#define DO_ICONST(k)		{ stack[++sp].i = code[ip+(k)].opnd.i; }
+#define DO_FCONST(k)		{ stack[++sp].f = code[ip+(k)].opnd.f; }
+#define DO_SCONST(k)		{ i = code[ip+(k)].opnd.i; stack[++sp].s = vm->string_objects[i]; }
+#define DO_ILOAD(k)			{ i = code[ip+(k)].opnd.i; stack[++sp].i = locals[i].i; }
+#define DO_FLOAD(k)			{ i = code[ip+(k)].opnd.i; stack[++sp].f = locals[i].f; }
+#define DO_VLOAD(k)			{ i = code[ip+(k)].opnd.i; stack[++sp] = locals[i]; }
+#define DO_SLOAD(k)			{ i = code[ip+(k)].opnd.i; stack[++sp].s = locals[i].s; }
+#define DO_STORE(k)			{ i = code[ip+(k)].opnd.i; locals[i] = stack[sp--]; /* untyped store; it'll just copy all bits */ }
+#define DO_VLOAD_INDEX(k)	{ i = stack[sp--].i; vptr = VPTR(stack[sp--]); stack[++sp].f = ith(vptr, i-1); }
+#define DO_STORE_INDEX(k)	{ f = stack[sp--].f; i = stack[sp--].i; vptr = VPTR(stack[sp--]); set_ith(vptr, i-1, f); }
+#define DO_POP(k)			{ sp--; }
+#define DO_NOP(k)
+
+/* The TOS_CACHE build caches the top of the operand stack in the C local tos
+ * and runs in one of two states: with the whole stack in memory, dispatching
+ * through dispatch_table, or with stack[sp] held in tos instead, dispatching
+ * through tos_dispatch_table. Pushes of anything but a vector, which doesn't
+ * fit in a register, leave their value in tos; operators and branches with a
+ * handler for the cached state take their top operand from tos rather than
+ * memory. Any other instruction dispatched in the cached state
+ * goes through L_SPILL, which writes tos back to stack[sp] and runs the
+ * ordinary handler, so calls, the GC, library instructions and HALT always
+ * see the stack in memory. Superinstructions also run from memory.
+ */
+#ifdef TOS_CACHE
+#if !defined(THREADED_DISPATCH) || !defined(__GNUC__)
+#error "TOS_CACHE needs THREADED_DISPATCH"
+#endif
+typedef union { int i; float f; bool b; String *s; } Scalar; // what of an element fits in a register
+#define TOS_JUMP(target)	{ ip = (target); TRACE_TOS(); FETCH(); goto *tos_dispatch_table[opcode]; }
+#define TOS_NEXT			TOS_JUMP(ip+1)
+#define TOS_PUSH(field, value)		{ sp++; tos.field = (value); TOS_NEXT; }
+#define TOS_UNARY(op, from, to)		{ tos.to = op tos.from; TOS_NEXT; }
+#define TOS_BINARY(op, from, to)	{ validate_stack_address(sp-1); tos.to = stack[sp-1].from op tos.from; sp--; TOS_NEXT; }
+#endif
+
+/* Instructions that do their work in the runtime library (vectors, strings,
+ * printing) rather than inline. They cost far more than a dispatch, so every
+ * execution engine shares this one implementation instead of carrying its own.
+ * Executes opcode against the operand stack whose top is stack[sp] and returns
+ * the new sp. opnd is the return type of the current function for
+ * PUSH_DFLT_RETV, which otherwise has no operand. Engines that can't
+ * inline vector indexing may send VLOAD_INDEX and STORE_INDEX here too.
+ */
+int vm_exec_slow_op(VM *vm, int opcode, int opnd, element *stack, int sp)
 {
-	int a = 0;
-	int i = 0;
-	bool b1, b2;
-	float f,g;
-	char* c;
+	int i;
+	bool b1;
+	float f;
+	String *c;
 	PVector_ptr vptr,r,l;
-	int x, y;
-	Activation_Record *frame;
 
-	Function_metadata *const main = vm_function(vm, "main");
-	vm_call(vm, main);
-
-	// Define VM registers (C compiler probably ignores 'register' nowadays
-	// but it's good documentation in this case. Keep as locals for
-	// convenience but write them back to the vm object after each decode/execute.
-	register addr32 ip = vm->ip;
-	register int sp = vm->sp;
-	register int fp = vm->fp;
-	const byte *code = vm->code;
-	element *stack = vm->stack;
-
-	int opcode = code[ip];
-
-	while (opcode != HALT && ip < vm->code_size ) {
-		if (trace) vm_print_instr(vm, ip);
-		ip++;
-		switch (opcode) {
-			case IADD:
-				validate_stack_address(sp-1);
-				y = stack[sp--].i;
-				x = stack[sp].i;
-				stack[sp].i = x + y;
-				break;
-			case ISUB:
-				validate_stack_address(sp-1);
-				y = stack[sp--].i;
-				x = stack[sp].i;
-				stack[sp].i = x - y;
-				break;
-			case IMUL:
-				validate_stack_address(sp-1);
-				y = stack[sp--].i;
-				x = stack[sp].i;
-				stack[sp].i = x * y;
-				break;
-			case IDIV:
-				validate_stack_address(sp-1);
-				y = stack[sp--].i;
-				x = stack[sp].i;
-				if (y ==0 ) {
-					zero_division_error();
-					break;
-				}
-				stack[sp].i = x / y;
-				break;
-			case FADD:
-				validate_stack_address(sp-1);
-				f = stack[sp--].f;
-				g = stack[sp].f;
-				stack[sp].f = g + f;
-				break;
-			case FSUB:
-				validate_stack_address(sp-1);
-				f = stack[sp--].f;
-				g = stack[sp].f;
-				stack[sp].f = g - f;
-				break;
-			case FMUL:
-				validate_stack_address(sp-1);
-				f = stack[sp--].f;
-				g = stack[sp].f;
-				stack[sp].f = g * f;
-				break;
-			case FDIV:
-				validate_stack_address(sp-1);
-				f = stack[sp--].f;
-				g = stack[sp].f;
-				if (f == 0) {
-					zero_division_error();
-					break;
-				}
-				stack[sp].f = g / f;
-				break;
-            case VADD:
-				validate_stack_address(sp-1);
-				r = stack[sp--].vptr;
-				l = stack[sp].vptr;
-				vptr = Vector_add(l,r);
-				stack[sp].vptr = vptr;
-                break;
-			case VADDI:
-				validate_stack_address(sp-1);
-				i = stack[sp--].i;
-				vptr = stack[sp].vptr;
-				vptr = Vector_add(vptr,Vector_from_int(i,vptr.vector->length));
-				stack[sp].vptr = vptr;
-				break;
-			case VADDF:
-				validate_stack_address(sp-1);
-				f = stack[sp--].f;
-				vptr = stack[sp].vptr;
-				vptr = Vector_add(vptr,Vector_from_float(f,vptr.vector->length));
-				stack[sp].vptr = vptr;
-				break;
-            case VSUB:
-				validate_stack_address(sp-1);
-				r = stack[sp--].vptr;
-				l = stack[sp].vptr;
-				vptr = Vector_sub(l,r);
-				stack[sp].vptr = vptr;
-                break;
-			case VSUBI:
-				validate_stack_address(sp-1);
-				i = stack[sp--].i;
-				vptr = stack[sp].vptr;
-				vptr = Vector_sub(vptr,Vector_from_int(i,vptr.vector->length));
-				stack[sp].vptr = vptr;
-				break;
-			case VSUBF:
-				validate_stack_address(sp-1);
-				f = stack[sp--].f;
-				vptr = stack[sp].vptr;
-				vptr = Vector_sub(vptr,Vector_from_float(f,vptr.vector->length));
-				stack[sp].vptr = vptr;
-				break;
-            case VMUL:
-				validate_stack_address(sp-1);
-				r = stack[sp--].vptr;
-				l = stack[sp].vptr;
-				vptr = Vector_mul(l,r);
-				stack[sp].vptr = vptr;
-                break;
-			case VMULI:
-				validate_stack_address(sp-1);
-				i = stack[sp--].i;
-				vptr = stack[sp].vptr;
-				vptr = Vector_mul(vptr,Vector_from_int(i,vptr.vector->length));
-				stack[sp].vptr = vptr;
-				break;
-			case VMULF:
-				validate_stack_address(sp-1);
-				f = stack[sp--].f;
-				vptr = stack[sp].vptr;
-				vptr = Vector_mul(vptr,Vector_from_float(f,vptr.vector->length));
-				stack[sp].vptr = vptr;
-				break;
-            case VDIV:
-                validate_stack_address(sp-1);
-				r = stack[sp--].vptr;
-				l = stack[sp].vptr;
-                vptr = Vector_div(l,r);
-                stack[sp].vptr = vptr;
-                break;
-			case VDIVI:
-				validate_stack_address(sp-1);
-				i = stack[sp--].i;
-				if (i == 0) {
-					zero_division_error();
-					break;
-				}
-				vptr = stack[sp].vptr;
-				vptr = Vector_div(vptr,Vector_from_int(i,vptr.vector->length));
-				stack[sp].vptr = vptr;
-				break;
-			case VDIVF:
-				validate_stack_address(sp-1);
-				f = stack[sp--].f;
-				if (f == 0) {
-					zero_division_error();
-					break;
-				}
-				vptr = stack[sp].vptr;
-				vptr = Vector_div(vptr,Vector_from_float(f,vptr.vector->length));
-				stack[sp].vptr = vptr;
-				break;
-            case SADD:
-				validate_stack_address(sp-1);
-				char * right = stack[sp--].s;
-				stack[sp].s = String_add(String_new(stack[sp].s),String_new(right))->str;
-                break;
-			case OR :
-				validate_stack_address(sp-1);
-				b2 = stack[sp--].b;
-				b1 = stack[sp].b;
-				stack[sp].b = b1 || b2;
-				break;
-			case AND :
-				validate_stack_address(sp-1);
-				b2 = stack[sp--].b;
-				b1 = stack[sp].b;
-				stack[sp].b = b1 && b2;
-				break;
-			case INEG:
-				validate_stack_address(sp);
-				stack[sp].i = -stack[sp].i;
-				break;
-			case FNEG:
-				validate_stack_address(sp);
-				stack[sp].f = -stack[sp].f;
-				break;
-			case NOT:
-				validate_stack_address(sp);
-				stack[sp].b = !stack[sp].b;
-				break;
-			case I2F:
-				validate_stack_address(sp);
-				stack[sp].f = stack[sp].i;
-				break;
-			case I2S:
-				validate_stack_address(sp);
-				stack[sp].s = String_from_int(stack[sp].i)->str;
-				break;
-			case F2I:
-				validate_stack_address(sp);
-				stack[sp].i = (int)stack[sp].f;
-				break;
-            case F2S:
-				validate_stack_address(sp);
-				stack[sp].s = String_from_float((float)stack[sp].f)->str;
-                break;
-            case V2S:
-				validate_stack_address(sp);
-				vptr = stack[sp].vptr;
-				stack[sp].s = String_from_vector(vptr)->str;
-                break;
-			case IEQ:
-				validate_stack_address(sp-1);
-				y = stack[sp--].i;
-				x = stack[sp].i;
-				stack[sp].b = x == y;
-				break;
-			case INEQ:
-				validate_stack_address(sp-1);
-				y = stack[sp--].i;
-				x = stack[sp].i;
-				stack[sp].b = x != y;
-				break;
-			case ILT:
-				validate_stack_address(sp-1);
-				y = stack[sp--].i;
-				x = stack[sp].i;
-				stack[sp].b = x < y;
-				break;
-			case ILE:
-				validate_stack_address(sp-1);
-				y = stack[sp--].i;
-				x = stack[sp].i;
-				stack[sp].b = x <= y;
-				break;
-			case IGT:
-				validate_stack_address(sp-1);
-				y = stack[sp--].i;
-				x = stack[sp].i;
-				stack[sp].b = x > y;
-				break;
-			case IGE:
-				validate_stack_address(sp-1);
-				y = stack[sp--].i;
-				x = stack[sp].i;
-				stack[sp].b = x >= y;
-				break;
-			case FEQ:
-				validate_stack_address(sp-1);
-				g = stack[sp--].f;
-				f = stack[sp].f;
-				stack[sp].b = f == g;
-				break;
-			case FNEQ:
-				validate_stack_address(sp-1);
-				g = stack[sp--].f;
-				f = stack[sp].f;
-				stack[sp].b = f != g;
-				break;
-			case FLT:
-				validate_stack_address(sp-1);
-				g = stack[sp--].f;
-				f = stack[sp].f;
-				stack[sp].b = f < g;
-				break;
-			case FLE:
-				validate_stack_address(sp-1);
-				g = stack[sp--].f;
-				f = stack[sp].f;
-				stack[sp].b = f <= g;
-				break;
-			case FGT:
-				validate_stack_address(sp-1);
-				g = stack[sp--].f;
-				f = stack[sp].f;
-				stack[sp].b = f > g;
-				break;
-			case FGE:
-				validate_stack_address(sp-1);
-				g = stack[sp--].f;
-				f = stack[sp].f;
-				stack[sp].b = f >= g;
-				break;
-            case SEQ:
-				validate_stack_address(sp-1);
-				c = stack[sp--].s;
-				b1 = String_eq(String_new(stack[sp--].s),String_new(c));
-				stack[++sp].b = b1;
-                break;
-            case SNEQ:
-				validate_stack_address(sp-1);
-				c = stack[sp--].s;
-				b1 = String_neq(String_new(stack[sp--].s),String_new(c));
-				stack[++sp].b = b1;
-                break;
-            case SGT:
-				validate_stack_address(sp-1);
-				c = stack[sp--].s;
-				b1 = String_gt(String_new(stack[sp--].s),String_new(c));
-				stack[++sp].b = b1;
-                break;
-            case SGE:
-				validate_stack_address(sp-1);
-				c = stack[sp--].s;
-				b1 = String_ge(String_new(stack[sp--].s),String_new(c));
-				stack[++sp].b = b1;
-                break;
-            case SLT:
-				validate_stack_address(sp-1);
-				c = stack[sp--].s;
-				b1 = String_lt(String_new(stack[sp--].s),String_new(c));
-				stack[++sp].b = b1;
-                break;
-            case SLE:
-				validate_stack_address(sp-1);
-				c = stack[sp--].s;
-				b1 = String_le(String_new(stack[sp--].s),String_new(c));
-				stack[++sp].b = b1;
-                break;
-			case VEQ:
-				validate_stack_address(sp-1);
-				l = stack[sp--].vptr;
-				r = stack[sp--].vptr;
-				b1 = Vector_eq(l,r);
-				stack[++sp].b = b1;
-				break;
-			case VNEQ:
-				validate_stack_address(sp-1);
-				l = stack[sp--].vptr;
-				r = stack[sp--].vptr;
-				b1 = Vector_neq(l,r);
-				stack[++sp].b = b1;
-				break;
-			case BR:
-				ip += int16(code,ip) - 1;
-				break;
-			case BRF:
-				validate_stack_address(sp);
-				if ( !stack[sp--].b ) {
-					int offset = int16(code,ip);
-					ip += offset - 1;
-				}
-				else {
-					ip += 2;
-				}
-				break;
-			case ICONST:
-				stack[++sp].i = int32(code,ip);
-				ip += 4;
-				break;
-			case FCONST:
-				stack[++sp].f = float32(code,ip);
-				ip += 4;
-				break;
-			case SCONST :
-				i = int16(code,ip);
-				ip += 2;
-				stack[++sp].s = vm->strings[i];
-				break;
-			case ILOAD:
-				i = int16(code,ip);
-				ip += 2;
-				stack[++sp].i = vm->call_stack[vm->callsp].locals[i].i;
-				break;
-			case FLOAD:
-				i = int16(code,ip);
-				ip += 2;
-				stack[++sp].f = vm->call_stack[vm->callsp].locals[i].f;
-				break;
-            case VLOAD:
-                i = int16(code,ip);
-                ip += 2;
-                stack[++sp].vptr = vm->call_stack[vm->callsp].locals[i].vptr;
-                break;
-            case SLOAD:
-                i = int16(code,ip);
-                ip += 2;
-                stack[++sp].s = vm->call_stack[vm->callsp].locals[i].s;
-				break;
-			case STORE:
-				i = int16(code,ip);
-				ip += 2;
-				vm->call_stack[vm->callsp].locals[i] = stack[sp--]; // untyped store; it'll just copy all bits
-				break;
-			case VECTOR:
-				i = stack[sp--].i;
-				validate_stack_address(sp-i+1);
-				double *data = (double*)malloc(i*sizeof(double));
-				for (int j = i-1; j >= 0;j--) { data[j] = stack[sp--].f; }
-				vptr = Vector_new(data,i);
-				stack[++sp].vptr = vptr;
-				break;
-			case VLOAD_INDEX:
-				i = stack[sp--].i;
-				vptr = stack[sp--].vptr;
-				vm->stack[++sp].f = ith(vptr, i-1);
-				break;
-			case STORE_INDEX:
-				f = stack[sp--].f;
-				i = stack[sp--].i;
-				vptr = stack[sp--].vptr;
-				set_ith(vptr, i-1, f);
-				break;
-			case SLOAD_INDEX:
-				i = stack[sp--].i;
-				if (i-1 >= strlen(stack[sp].s))
-				{
-					fprintf(stderr, "StringIndexOutOfRange: %d\n",(int)strlen(stack[sp].s));
-					break;
-				}
-				c = String_from_char(stack[sp--].s[i-1])->str;
-				stack[++sp].s = c;
-				break;
-			case PUSH_DFLT_RETV:
-				i = *&vm->call_stack[vm->callsp].func->return_type;
-				sp = push_default_value(i, sp, stack);
-				break;
-			case POP:
-				sp--;
-				break;
-			case CALL:
-				a = int16(code,ip); // load index of function from code memory
-				WRITE_BACK_REGISTERS(vm); // (ip has been updated)
-				vm_call(vm, &vm->functions[a]);
-				LOAD_REGISTERS(vm);
-				break;
-			case RET:
-				frame = &vm->call_stack[vm->callsp--];
-				ip = frame->retaddr;
-				break;
-			case IPRINT:
-				validate_stack_address(sp);
-				printf("%d\n", stack[sp--].i);
-				break;
-			case FPRINT:
-				validate_stack_address(sp);
-				printf("%1.2f\n", stack[sp--].f);
-				break;
-			case BPRINT:
-				validate_stack_address(sp);
-				printf("%d\n", stack[sp--].b);
-				break;
-			case SPRINT:
-				validate_stack_address(sp);
-				printf("%s\n", stack[sp--].s);
-				break;
-			case VPRINT:
-				validate_stack_address(sp);
-				print_vector(stack[sp--].vptr);
-				break;
-			case VLEN:
-				vptr = stack[sp--].vptr;
-				i = Vector_len(vptr);
-				stack[++sp].i = i;
-				break;
-			case SLEN:
-				c = stack[sp--].s;
-				i = String_len(String_new(c));
-				stack[++sp].i = i;
-				break;
-			case GC_START:
-				vm->call_stack[vm->callsp].save_gc_roots = gc_num_roots();
-				break;
-			case GC_END:
-				gc_set_num_roots(vm->call_stack[vm->callsp].save_gc_roots);
-				break;
-			case SROOT:
-				gc_add_root((void **)&stack[sp].s);
-				break;
-			case VROOT:
-				gc_add_root((void **)&stack[sp].vptr);
-				break;
-			case COPY_VECTOR:
-				if (vm->call_stack[vm->callsp].locals[i].vptr.vector != NULL) {
-					stack[sp].vptr = Vector_copy(vm->call_stack[vm->callsp].locals[i].vptr);
-				}
-				else if (stack[sp].vptr.vector != NULL) {
-					stack[sp].vptr = Vector_copy(stack[sp].vptr);
-				}
-				else {
-					fprintf(stderr, "Vector reference cannot be found\n");
-				}
-				break;
-			case NOP : break;
-			default:
-				printf("invalid opcode: %d at ip=%d\n", opcode, (ip - 1));
-				exit(1);
-		}
-		WRITE_BACK_REGISTERS(vm);
-		if (trace) vm_print_stack(vm);
-		opcode = code[ip];
+	switch (opcode) {
+		case VADD:
+			validate_stack_address(sp-1);
+			r = VPTR(stack[sp--]);
+			l = VPTR(stack[sp]);
+			vptr = Vector_add(l,r);
+			SET_VPTR(stack[sp], vptr);
+			break;
+		case VADDI:
+			validate_stack_address(sp-1);
+			i = stack[sp--].i;
+			vptr = VPTR(stack[sp]);
+			vptr = Vector_add_scalar(vptr, i);
+			SET_VPTR(stack[sp], vptr);
+			break;
+		case VADDF:
+			validate_stack_address(sp-1);
+			f = stack[sp--].f;
+			vptr = VPTR(stack[sp]);
+			vptr = Vector_add_scalar(vptr, f);
+			SET_VPTR(stack[sp], vptr);
+			break;
+		case VSUB:
+			validate_stack_address(sp-1);
+			r = VPTR(stack[sp--]);
+			l = VPTR(stack[sp]);
+			vptr = Vector_sub(l,r);
+			SET_VPTR(stack[sp], vptr);
+			break;
+		case VSUBI:
+			validate_stack_address(sp-1);
+			i = stack[sp--].i;
+			vptr = VPTR(stack[sp]);
+			vptr = Vector_sub_scalar(vptr, i);
+			SET_VPTR(stack[sp], vptr);
+			break;
+		case VSUBF:
+			validate_stack_address(sp-1);
+			f = stack[sp--].f;
+			vptr = VPTR(stack[sp]);
+			vptr = Vector_sub_scalar(vptr, f);
+			SET_VPTR(stack[sp], vptr);
+			break;
+		case VMUL:
+			validate_stack_address(sp-1);
+			r = VPTR(stack[sp--]);
+			l = VPTR(stack[sp]);
+			vptr = Vector_mul(l,r);
+			SET_VPTR(stack[sp], vptr);
+			break;
+		case VMULI:
+			validate_stack_address(sp-1);
+			i = stack[sp--].i;
+			vptr = VPTR(stack[sp]);
+			vptr = Vector_mul_scalar(vptr, i);
+			SET_VPTR(stack[sp], vptr);
+			break;
+		case VMULF:
+			validate_stack_address(sp-1);
+			f = stack[sp--].f;
+			vptr = VPTR(stack[sp]);
+			vptr = Vector_mul_scalar(vptr, f);
+			SET_VPTR(stack[sp], vptr);
+			break;
+		case VDIV:
+			validate_stack_address(sp-1);
+			r = VPTR(stack[sp--]);
+			l = VPTR(stack[sp]);
+			vptr = Vector_div(l,r);
+			SET_VPTR(stack[sp], vptr);
+			break;
+		case VDIVI:
+			validate_stack_address(sp-1);
+			i = stack[sp--].i;
+			if (i == 0) {
+				vm_zero_division_error();
+				break;
+			}
+			vptr = VPTR(stack[sp]);
+			vptr = Vector_div_scalar(vptr, i);
+			SET_VPTR(stack[sp], vptr);
+			break;
+		case VDIVF:
+			validate_stack_address(sp-1);
+			f = stack[sp--].f;
+			if (f == 0) {
+				vm_zero_division_error();
+				break;
+			}
+			vptr = VPTR(stack[sp]);
+			vptr = Vector_div_scalar(vptr, f);
+			SET_VPTR(stack[sp], vptr);
+			break;
+		case SADD:
+			validate_stack_address(sp-1);
+			c = stack[sp--].s;
+			stack[sp].s = String_add(stack[sp].s, c);
+			break;
+		case I2S:
+			validate_stack_address(sp);
+			stack[sp].s = String_from_int(stack[sp].i);
+			break;
+		case F2S:
+			validate_stack_address(sp);
+			stack[sp].s = String_from_float((float)stack[sp].f);
+			break;
+		case V2S:
+			validate_stack_address(sp);
+			vptr = VPTR(stack[sp]);
+			stack[sp].s = String_from_vector(vptr);
+			break;
+		case SEQ:
+			validate_stack_address(sp-1);
+			c = stack[sp--].s;
+			b1 = String_eq(stack[sp--].s, c);
+			stack[++sp].b = b1;
+			break;
+		case SNEQ:
+			validate_stack_address(sp-1);
+			c = stack[sp--].s;
+			b1 = String_neq(stack[sp--].s, c);
+			stack[++sp].b = b1;
+			break;
+		case SGT:
+			validate_stack_address(sp-1);
+			c = stack[sp--].s;
+			b1 = String_gt(stack[sp--].s, c);
+			stack[++sp].b = b1;
+			break;
+		case SGE:
+			validate_stack_address(sp-1);
+			c = stack[sp--].s;
+			b1 = String_ge(stack[sp--].s, c);
+			stack[++sp].b = b1;
+			break;
+		case SLT:
+			validate_stack_address(sp-1);
+			c = stack[sp--].s;
+			b1 = String_lt(stack[sp--].s, c);
+			stack[++sp].b = b1;
+			break;
+		case SLE:
+			validate_stack_address(sp-1);
+			c = stack[sp--].s;
+			b1 = String_le(stack[sp--].s, c);
+			stack[++sp].b = b1;
+			break;
+		case VEQ:
+			validate_stack_address(sp-1);
+			l = VPTR(stack[sp--]);
+			r = VPTR(stack[sp--]);
+			b1 = Vector_eq(l,r);
+			stack[++sp].b = b1;
+			break;
+		case VNEQ:
+			validate_stack_address(sp-1);
+			l = VPTR(stack[sp--]);
+			r = VPTR(stack[sp--]);
+			b1 = Vector_neq(l,r);
+			stack[++sp].b = b1;
+			break;
+		case VECTOR:
+			i = stack[sp--].i;
+			validate_stack_address(sp-i+1);
+			sp -= i;
+			vptr = Vector_new_strided(&stack[sp+1].f, sizeof(element), i);
+			SET_VPTR(stack[++sp], vptr);
+			break;
+		case SLOAD_INDEX:
+			i = stack[sp--].i;
+			if (i-1 >= stack[sp].s->length)
+			{
+				fprintf(stderr, "StringIndexOutOfRange: %d\n",(int)stack[sp].s->length);
+				break;
+			}
+			c = String_from_char(stack[sp--].s->str[i-1]);
+			stack[++sp].s = c;
+			break;
+		case IPRINT:
+			validate_stack_address(sp);
+			vm_print_int(vm, stack[sp--].i);
+			break;
+		case FPRINT:
+			validate_stack_address(sp);
+			vm_print_float(vm, stack[sp--].f);
+			break;
+		case BPRINT:
+			validate_stack_address(sp);
+			vm_print_int(vm, stack[sp--].b);
+			break;
+		case SPRINT:
+			validate_stack_address(sp);
+			vm_print_string(vm, stack[sp--].s);
+			break;
+		case VPRINT:
+			validate_stack_address(sp);
+			vm_print_vector(vm, VPTR(stack[sp--]));
+			break;
+		case VLEN:
+			vptr = VPTR(stack[sp--]);
+			i = Vector_len(vptr);
+			stack[++sp].i = i;
+			break;
+		case SLEN:
+			c = stack[sp--].s;
+			i = String_len(c);
+			stack[++sp].i = i;
+			break;
+		case VLOAD_INDEX:
+			i = stack[sp--].i;
+			vptr = VPTR(stack[sp--]);
+			stack[++sp].f = ith(vptr, i-1);
+			break;
+		case STORE_INDEX:
+			f = stack[sp--].f;
+			i = stack[sp--].i;
+			vptr = VPTR(stack[sp--]);
+			set_ith(vptr, i-1, f);
+			break;
+		case PUSH_DFLT_RETV:
+			sp = push_default_value(vm, opnd, sp, stack);
+			break;
+		case COPY_VECTOR: // copy on assignment of the vector on top of the stack
+			if (VPTR(stack[sp]).vector != NULL) {
+				SET_VPTR(stack[sp], Vector_copy(VPTR(stack[sp])));
+			}
+			else {
+				fprintf(stderr, "Vector reference cannot be found\n");
+			}
+			break;
+		default:
+			fprintf(stderr, "invalid opcode: %d\n", opcode);
+			vm_fail(vm);
+	}
+	return sp;
+}
+
+/* Run vm from entry, or from where its registers are if entry is NULL */
+static void vm_run(VM *vm, Function_metadata *entry, bool trace)
+{
+	if ( vm->instrs==NULL && !vm_predecode(vm) ) return;
+#ifdef UNCHECKED
+	if ( !vm->verified && !vm_verify(vm) ) {
+		fprintf(stderr, "can't run code that doesn't verify\n");
+		return;
+	}
+#endif
+
+	Heap_Context *caller_heap = gc_use_heap(vm->heap);
+	int save_gc_roots = entry!=NULL ? gc_num_roots() : 0; // a resumed run's roots are all the program's
+	int jit_threshold = vm->jit_threshold;
+	if ( trace || vm->counters!=NULL ) vm->jit_threshold = 0; // native code isn't traced or counted
+	char base;
+	vm->c_stack_base = (uintptr_t)&base;
+
+	if ( entry!=NULL ) vm_call(vm, entry);
+	if ( trace ) vm_interpret_traced(vm);
+	else if ( vm->counters!=NULL ) {
+		vm_count_call(vm);
+		vm_interpret_counted(vm);
 	}
-	if (trace) vm_print_instr(vm, ip);
+	else vm_interpret(vm);
+	if ( vm->tasks!=NULL ) vm_finish_tasks(vm);
+
+	vm->jit_threshold = jit_threshold;
 	if (trace) vm_print_stack(vm);
+	vm_flush_output(vm);
+
+	vm_gc_check();
+	gc_set_num_roots(save_gc_roots); // don't leave roots into the stack for the next run
+	gc_use_heap(caller_heap);
+}
+
+void vm_exec(VM *vm, bool trace)
+{
+	Function_metadata *const main = vm_function(vm, "main");
+	if ( main==NULL ) {
+		fprintf(stderr, "no main function\n");
+		return;
+	}
+	vm_run(vm, main, trace);
+}
+
+/* Carry on running vm from its registers, such as a VM from vm_restore() */
+void vm_resume(VM *vm, bool trace)
+{
+	vm_run(vm, NULL, trace);
+}
 
-	gc_check();
+/* Run task VM vm, calling entry first if it's not NULL, until it returns to
+ * the HALT sentinel or suspends; see tasks.h. Returns true if it finished.
+ */
+bool vm_run_task(VM *vm, Function_metadata *entry)
+{
+	Heap_Context *caller_heap = gc_use_heap(vm->heap);
+	char base;
+	vm->c_stack_base = (uintptr_t)&base;
+	vm->suspended = false;
+	if ( entry!=NULL ) {
+		vm->ip = (addr32)vm->num_instrs; // entry returns to the HALT sentinel
+		vm_call(vm, entry);
+	}
+	if ( vm->ip!=vm->num_instrs ) vm_interpret(vm);
+	vm_flush_output(vm);
+	gc_use_heap(caller_heap);
+	return !vm->suspended;
 }
 
+#define INTERPRETER vm_interpret
+#include "interpreter.inc"
+
+#define INTERPRETER vm_interpret_traced
+#define INTERPRETER_TRACES
+#include "interpreter.inc"
+
+#define INTERPRETER vm_interpret_counted
+#define INTERPRETER_COUNTS
+#include "interpreter.inc"
+
 void vm_call(VM *vm, Function_metadata *func)
 {
+	// the whole frame's worth of operand stack is checked here rather than at each push
+	if ( vm->callsp+1>=MAX_CALL_STACK ||
+		 vm->sp+func->nlocals+1+func->max_stack>=MAX_OPND_STACK ) {
+		fprintf(stderr, "stack overflow calling %s\n", func->name);
+		vm_fail(vm);
+	}
 	Activation_Record *r = &vm->call_stack[++vm->callsp];
 	r->func = func;
-	r->retaddr = vm->ip + 2; // save return address (assume ip is 1st byte of operand)
-	// copy args to frame activation record
-	for (int i = func->nargs-1; i>=0 ; --i) {
-		r->locals[i] = vm->stack[vm->sp--];
+	r->retaddr = vm->ip; // save return address (assume ip is instruction following CALL)
+	// the args stay where the caller pushed them and the locals go on top. One
+	// more null element below the callee's operands is what SROOT and VROOT
+	// root when the operand stack is empty.
+	r->locals = &vm->stack[vm->sp - func->nargs + 1];
+	memset(&vm->stack[vm->sp + 1], 0, (size_t)(func->nlocals + 1) * sizeof(element));
+	vm->sp += func->nlocals + 1;
+	if ( func->native==NULL && vm->jit_threshold>0 && ++func->ncalls==vm->jit_threshold ) {
+		vm_jit_compile(vm, func);
 	}
-	for (int i = 0; i<func->nlocals; i++) {
-		r->locals[func->nargs+i].i = 0; // init locals
+	if ( func->native!=NULL ) { // run it to completion and return
+		((Native_Function)func->native)(vm, r);
+		vm->ip = r->retaddr;
+		vm->sp = vm_pop_frame(vm, vm->sp);
+		return;
 	}
-	vm->ip = func->address; // jump!
+	vm->ip = func->entry; // jump!
 }
 
-int push_default_value(int i, int sp, element *stack) {
+/* Call func in place of the current function, which returns whatever func
+ * returns: func's args replace the current frame's and func returns straight
+ * to our caller, so tail recursion runs in constant stack space. vm->ip is the
+ * instruction after the CALL; the GC_END there, if any, is done up front as
+ * the frame's roots are about to be overwritten.
+ */
+void vm_tail_call(VM *vm, Function_metadata *func)
+{
+	if ( func->native!=NULL || (vm->jit_threshold>0 && func->ncalls+1==vm->jit_threshold) ) {
+		vm_call(vm, func); // native code returns here; the GC_END and RET run as usual
+		return;
+	}
+	Activation_Record *r = &vm->call_stack[vm->callsp];
+	int base = (int)(r->locals - vm->stack);
+	if ( base+func->nargs+func->nlocals+func->max_stack>=MAX_OPND_STACK ) {
+		fprintf(stderr, "stack overflow calling %s\n", func->name);
+		vm_fail(vm);
+	}
+	if ( vm->instrs[vm->ip].opcode==GC_END ) gc_set_num_roots(r->save_gc_roots);
+	if ( vm->jit_threshold>0 ) func->ncalls++;
+	memmove(r->locals, &vm->stack[vm->sp - func->nargs + 1], (size_t)func->nargs * sizeof(element));
+	memset(&r->locals[func->nargs], 0, (size_t)(func->nlocals + 1) * sizeof(element));
+	r->func = func;
+	vm->sp = base + func->nargs + func->nlocals;
+	vm->ip = func->entry;
+}
+
+/* Discard the top frame, moving the return value, if any, down to where the
+ * callee's first arg was; returns the caller's stack pointer.
+ */
+int vm_pop_frame(VM *vm, int sp)
+{
+	Activation_Record *r = &vm->call_stack[vm->callsp--];
+	int base = (int)(r->locals - vm->stack);
+	int type = r->func->return_type;
+	if ( type>=INT_TYPE && type<=VECTOR_TYPE ) {
+		vm->stack[base] = vm->stack[sp];
+		return base;
+	}
+	return base - 1;
+}
+
+void vm_jit_call(VM *vm, int f)
+{
+	// calls between native functions nest on the C stack, which is smaller than the VM's
+	char here;
+	if ( vm->c_stack_base - (uintptr_t)&here>(uintptr_t)MAX_NATIVE_STACK ) {
+		fprintf(stderr, "stack overflow calling %s\n", vm->functions[f].name);
+		vm_fail(vm);
+	}
+	addr32 ip = vm->ip;
+	vm->ip = (addr32)vm->num_instrs; // callee returns to the HALT sentinel...
+	vm_call(vm, &vm->functions[f]);
+	if ( vm->ip!=vm->num_instrs ) {
+		vm->nested_runs++;
+		vm_interpret(vm);            // ...which ends this nested run
+		vm->nested_runs--;
+	}
+	vm->ip = ip;
+}
+
+int push_default_value(VM *vm, int i, int sp, element *stack) {
 	switch (i) {
 		case INT_TYPE:
 			stack[++sp].i = DEFAULT_INT_VALUE;
@@ -729,10 +854,10 @@ int push_default_value(int i, int sp, element *stack) {
 			stack[++sp].b = DEFAULT_BOOLEAN_VALUE;
 			break;
 		case STRING_TYPE:
-			stack[++sp].s = DEFAULT_STRING_VALUE;
+			stack[++sp].s = vm->empty_string;
 			break;
 		case VECTOR_TYPE:
-			stack[++sp].vptr = PVector_init(0, 0);
+			SET_VPTR(stack[++sp], PVector_init(0, 0));
 			break;
 		default:
 			break;
@@ -740,40 +865,15 @@ int push_default_value(int i, int sp, element *stack) {
 	return sp;
 }
 
-static inline int int32(const byte *data, addr32 ip)
-{
-	return *((word32 *)&data[ip]);
-}
-
-static inline float float32(const byte *data, addr32 ip)
-{
-	return *((float *)&data[ip]);
-}
-
-static inline int int16(const byte *data, addr32 ip)
-{
-	return *((short *)&data[ip]); // could be negative value
-}
-
 static void vm_print_instr(VM *vm, addr32 ip)
 {
-	int op_code = vm->code[ip];
-	VM_INSTRUCTION *inst = &vm_instructions[op_code];
-	switch (inst->opnd_size) {
-		case 0:
-			fprintf(stderr, "%04d:  %-25s", ip, inst->name);
-			break;
-		case 1:
-			fprintf(stderr, "%04d:  %-15s%-10d", ip, inst->name, vm->code[ip+1]);
-			break;
-		case 2:
-			fprintf(stderr, "%04d:  %-15s%-10d", ip, inst->name, int16(vm->code, ip + 1));
-			break;
-		case 4:
-			fprintf(stderr, "%04d:  %-15s%-10d", ip, inst->name, int32(vm->code, ip + 1));
-			break;
-		default:
-			break;
+	Decoded_Instr *I = &vm->instrs[ip];
+	char *name = vm_handler_name(I->opcode);
+	if ( vm_instructions[vm_base_opcode(I->opcode)].opnd_size==0 ) {
+		fprintf(stderr, "%04d:  %-25s", I->addr, name);
+	}
+	else {
+		fprintf(stderr, "%04d:  %-15s%-10d", I->addr, name, I->opnd.i);
 	}
 }
 
@@ -798,6 +898,52 @@ static void vm_print_stack(VM *vm) {
 	fprintf(stderr, " ] fp=%d sp=%d\n", vm->fp, vm->sp);
 }
 
+static size_t pooled_size(size_t length)
+{
+	return (sizeof(String) + length + 1 + sizeof(void *) - 1) & ~(sizeof(void *) - 1);
+}
+
+/* Lay out the string table, and DEFAULT_STRING_VALUE, as Strings packed into
+ * vm->string_pool. The pool is outside the GC heap, so the collector never
+ * moves or frees them, and SCONST pushes them without allocating. Equal
+ * constants share one String, so comparing two of them comes down to
+ * comparing pointers.
+ */
+static void intern_strings(VM *vm)
+{
+	int n = vm->num_strings + 1;
+	size_t size = 0;
+	for (int i = 0; i < vm->num_strings; i++) size += pooled_size(strlen(vm->strings[i]));
+	size += pooled_size(strlen(DEFAULT_STRING_VALUE));
+	vm->string_pool = calloc(1, size);
+	vm->string_objects = calloc((size_t)n, sizeof(String *));
+
+	int nbuckets = 2*n; // open addressing; always has empty buckets
+	String **buckets = calloc((size_t)nbuckets, sizeof(String *));
+	char *next = vm->string_pool;
+	for (int i = 0; i < n; i++) {
+		char *s = i < vm->num_strings ? vm->strings[i] : DEFAULT_STRING_VALUE;
+		size_t length = strlen(s);
+		unsigned int h = 5381;
+		for (size_t k = 0; k < length; k++) h = h*33 + (unsigned char)s[k];
+		int b = (int)(h % (unsigned int)nbuckets);
+		while ( buckets[b]!=NULL &&
+				(buckets[b]->length!=length || memcmp(buckets[b]->str, s, length)!=0) ) {
+			b = (b+1) % nbuckets;
+		}
+		if ( buckets[b]==NULL ) {
+			String *p = (String *)next;
+			p->length = length;
+			memcpy(p->str, s, length+1);
+			next += pooled_size(length);
+			buckets[b] = p;
+		}
+		vm->string_objects[i] = buckets[b];
+	}
+	vm->empty_string = vm->string_objects[n-1];
+	free(buckets);
+}
+
 void vm_print_stack_value(word p) {
 	if ( ((long)p) >= 0 ) {
 		fprintf(stderr, " %lu", (long)p);
@@ -25,15 +25,17 @@ SOFTWARE.
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <setjmp.h>
 
 #ifndef VM_H_
 #define VM_H_
 
-static const int MAX_FUNCTIONS	= 1000;
-static const int MAX_LOCALS		= 10;	// max locals/args in activation record
-static const int MAX_CALL_STACK = 1000;
-static const int MAX_OPND_STACK = 1000;
-static const int NUM_INSTRS		= 83;
+static const int MAX_CALL_STACK = 64*1024;		// frames; reserved, not allocated (see vmstack.h)
+static const int MAX_OPND_STACK = 1024*1024;	// elements; ditto
+static const int MAX_NATIVE_STACK = 4*1024*1024;	// bytes of C stack calls between native functions may use
+static const int NUM_INSTRS		= 87;
+static const int MAX_SUPER_LEN	= 4;	// max instructions fused into a superinstruction
+static const int JIT_THRESHOLD	= 1000;	// calls before a function is compiled to native code
 static const int    DEFAULT_INT_VALUE = 0;
 static const float  DEFAULT_FLOAT_VALUE = 0.0;
 static const bool   DEFAULT_BOOLEAN_VALUE = true;
@@ -153,64 +155,159 @@ typedef enum {
 	SROOT,
 	VROOT,
 
-	COPY_VECTOR
+	COPY_VECTOR,
+	SNAPSHOT,		// save the VM's state to vm->snapshot_path, if set; see snapshot.h
+
+	SPAWN,			// start a function running as a task; see tasks.h
+	YIELD,
+	JOIN
 } BYTECODE;
 
+// Superinstructions exist only in Decoded_Instr streams, never in byte code;
+// their handler ids follow the bytecodes. See superinstructions.h.
+typedef enum {
+	LAST_BYTECODE = JOIN,
+#define SUPER(name, n, ops, body) name,
+#include "superinstructions.def"
+#undef SUPER
+	TAIL_CALL,		// CALL whose result is returned as is; reuses the caller's frame
+	NUM_HANDLERS
+} SUPERINSTRUCTION;
+
 typedef struct {
 	char *name;
 	BYTECODE opcode;
     int opnd_size; // size in bytes
 } VM_INSTRUCTION;
 
+#ifdef PACKED_ELEMENTS
+// One machine word per slot: a vector's version rides in the top bits of its
+// pointer (see PVector_pack()), halving the operand stack and locals.
 typedef union {
 	int i;
 	float f;
 	bool b;
-	char *s;
+	String *s;
+	PVector_packed v;
+} element;
+
+#define VPTR(e)				PVector_unpack((e).v)
+#define SET_VPTR(e,p)		((e).v = PVector_pack(p))
+#define VPTR_ROOT(e)		((void **)&(e).v)
+#else
+typedef union {
+	int i;
+	float f;
+	bool b;
+	String *s;
 	PVector_ptr vptr;
 //	char ba[sizeof(double)];
 } element;
 
+#define VPTR(e)				((e).vptr)
+#define SET_VPTR(e,p)		((e).vptr = (p))
+#define VPTR_ROOT(e)		((void **)&(e).vptr)
+#endif
+
+// Instructions pre-decoded from the byte code at load time; see vm_predecode()
+typedef struct {
+	int opcode;			// handler to run
+	union {
+		int i;
+		float f;
+	} opnd;				// decoded operand, if any (branch offsets are kept as is)
+	addr32 target;		// BR/BRF: index of target instruction
+	addr32 addr;		// address of instruction in byte code
+} Decoded_Instr;
+
 // to call a func, we use index into table of Function descriptors
 typedef struct function {
 	char *name;
 	int return_type;
 	addr32 address; // index into code array
+	addr32 entry;   // index into decoded instruction array
 	int nargs;
 	int nlocals;
+	int ncalls;		// calls so far, counted until the function is compiled
+	void *native;	// compiled code, if any; see jit.h
+	size_t native_size;	// bytes mapped for native
+	int max_stack;	// deepest the function's operand stack gets; set by vm_verify()
 } Function_metadata;
 
 typedef struct activation_record {
 	Function_metadata *func;
 	addr32 retaddr;
 	int save_gc_roots;
-	element locals[MAX_LOCALS]; // args + locals go here per func def
+	element *locals;	// args + locals, in place on the operand stack below the callee's operands
 } Activation_Record;
 
 typedef struct {
 	// registers
-	addr32 ip;        	// instruction pointer register
+	addr32 ip;        	// instruction pointer register; index into instrs
     int sp;             // stack pointer register
     int fp;             // frame pointer register
 	int callsp;			// call stack pointer register
 
 	byte *code;   		// byte-addressable code memory.
 	int code_size;
-	element stack[MAX_OPND_STACK]; 	// operand stack, grows upwards; word addressable
-	Activation_Record call_stack[MAX_CALL_STACK];
+	Decoded_Instr *instrs;	// code decoded into fixed-width instructions; ip indexes this
+	int num_instrs;
+	int jit_threshold;	// compile functions called this many times; 0 turns the JIT off
+	bool verified;		// vm_verify() accepted the code
+	uintptr_t c_stack_base;	// C stack pointer when vm_exec() started
+	struct exec_counters *counters;	// what vm_exec() counts, if anything; see counters.h
+	Heap_Context *heap;	// this VM's own GC heap and roots; VMs share nothing so each can run on its own thread
+	element *stack; 	// operand stack, grows upwards; word addressable
+	Activation_Record *call_stack;
 
 	int data_size;
 	int num_strings;
 	int num_functions;
+	int max_functions;	// room in functions
 	char **strings;
-
-	Function_metadata functions[MAX_FUNCTIONS]; // array of function defs
+	String **string_objects;	// strings as interned Strings in string_pool; SCONST pushes these
+	String *empty_string;		// what PUSH_DFLT_RETV pushes for a string, also in string_pool
+	void *string_pool;			// immortal Strings outside the GC heap, made by vm_init()
+	void *image;		// mapped .wbc file holding code and strings, if any
+	size_t image_size;
+	char *output;		// program output not yet written to stdout; see output.h
+	int output_len;
+	bool capture_output;	// flushed output collects in captured instead of going to stdout
+	char *captured;			// see vm_take_output()
+	size_t captured_len;
+	size_t captured_max;
+	bool shares_code;	// code, instrs and strings belong to another VM; see vm_use_module()
+	char *snapshot_path;	// where SNAPSHOT saves the VM's state; NULL makes it a no-op
+	int workers;		// threads running the tasks SPAWN starts; 0 means one per processor
+	struct scheduler *tasks;	// the program's tasks, shared by the VMs running them; see tasks.h
+	struct task *task;	// the task this VM runs, if any
+	bool suspended;		// a task's YIELD or JOIN stopped vm_interpret() so others could run
+	int nested_runs;	// interpreter runs native code is waiting on; a task can't suspend under them
+
+	Function_metadata *functions; // array of function defs
 } VM;
 
 extern VM *vm_alloc();
+extern VM *vm_alloc_with_heap(Heap_Context *heap);
+extern void vm_free(VM *vm);
 extern void vm_init(VM *vm, byte *code, int code_size);
+extern void vm_use_module(VM *vm, VM *module);
 extern void vm_exec(VM *vm, bool trace);
+extern void vm_resume(VM *vm, bool trace);
+extern bool vm_run_task(VM *vm, Function_metadata *entry);
 extern int def_function(VM *vm, char *name, int return_type, addr32 address, int nargs, int nlocals);
 extern VM_INSTRUCTION vm_instructions[];
 
+/* Support for execution engines other than vm_exec() */
+extern int vm_exec_slow_op(VM *vm, int opcode, int opnd, element *stack, int sp);
+extern void vm_zero_division_error();
+extern void vm_gc_check();
+
+/* Stop vm after a run-time error that has already been reported on stderr:
+ * flush its output, then jump to vm_error_jump if this thread has set one,
+ * else exit(1).
+ */
+extern void vm_fail(VM *vm);
+extern _Thread_local sigjmp_buf *vm_error_jump;
+
 #endif
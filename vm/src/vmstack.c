@@ -0,0 +1,147 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2015 Terence Parr, Hanzhou Shi, Shuai Yuan, Yuanyuan Zhang
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <setjmp.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include "vmstack.h"
+
+#if !defined(MAP_ANONYMOUS) && defined(MAP_ANON)
+#define MAP_ANONYMOUS MAP_ANON
+#endif
+#ifndef MAP_NORESERVE
+#define MAP_NORESERVE 0
+#endif
+
+static const int GUARDS_PER_CHUNK = 4096;
+static const int MAX_GUARD_CHUNKS = 1024;	// live stacks whose overflow can be reported as such
+
+/* Guard pages of live stacks, in chunks allocated as more stacks go live and
+ * never freed, so the signal handler can walk them without locking. Slots
+ * and chunks are claimed with atomic swaps.
+ */
+static char *volatile *volatile guard_chunks[MAX_GUARD_CHUNKS];
+static size_t page_size;
+static struct sigaction default_segv;
+static pthread_once_t setup_once = PTHREAD_ONCE_INIT;
+
+_Thread_local sigjmp_buf *vm_stack_overflow_jump;
+
+static void overflow_handler(int sig, siginfo_t *info, void *context)
+{
+	char *addr = (char *)info->si_addr;
+	for (int c = 0; c < MAX_GUARD_CHUNKS; c++) {
+		char *volatile *guards = guard_chunks[c];
+		if ( guards==NULL ) break; // chunks are allocated in order
+		for (int k = 0; k < GUARDS_PER_CHUNK; k++) {
+			char *guard = guards[k];
+			if ( guard!=NULL && addr>=guard && addr<guard+page_size ) {
+				static const char msg[] = "VM stack overflow\n";
+				write(2, msg, sizeof(msg)-1);
+				if ( vm_stack_overflow_jump!=NULL ) siglongjmp(*vm_stack_overflow_jump, 1);
+				_exit(1);
+			}
+		}
+	}
+	// not ours; let the fault happen again with the previous handling
+	sigaction(SIGSEGV, &default_segv, NULL);
+}
+
+static void setup()
+{
+	page_size = (size_t)sysconf(_SC_PAGESIZE);
+	struct sigaction sa;
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_sigaction = overflow_handler;
+	sa.sa_flags = SA_SIGINFO;
+	sigemptyset(&sa.sa_mask);
+	sigaction(SIGSEGV, &sa, &default_segv);
+#ifdef __APPLE__
+	sigaction(SIGBUS, &sa, NULL); // macOS reports protection faults as SIGBUS
+#endif
+}
+
+/* Chunk c of the guard table, allocating it if this is the first stack to need it */
+static char *volatile *guard_chunk(int c)
+{
+	if ( guard_chunks[c]==NULL ) {
+		char *volatile *guards = calloc((size_t)GUARDS_PER_CHUNK, sizeof(char *));
+		if ( guards==NULL ) return NULL;
+		if ( !__sync_bool_compare_and_swap(&guard_chunks[c], NULL, guards) ) free((void *)guards);
+	}
+	return guard_chunks[c];
+}
+
+static void add_guard(char *guard)
+{
+	for (int c = 0; c < MAX_GUARD_CHUNKS; c++) {
+		char *volatile *guards = guard_chunk(c);
+		if ( guards==NULL ) break;
+		for (int k = 0; k < GUARDS_PER_CHUNK; k++) {
+			if ( __sync_bool_compare_and_swap(&guards[k], NULL, guard) ) return;
+		}
+	}
+	fprintf(stderr, "too many live VM stacks to catch their overflow\n");
+	exit(1);
+}
+
+static void remove_guard(char *guard)
+{
+	for (int c = 0; c < MAX_GUARD_CHUNKS && guard_chunks[c]!=NULL; c++) {
+		char *volatile *guards = guard_chunks[c];
+		for (int k = 0; k < GUARDS_PER_CHUNK; k++) {
+			if ( __sync_bool_compare_and_swap(&guards[k], guard, NULL) ) return;
+		}
+	}
+}
+
+void *vm_stack_reserve(size_t size)
+{
+	pthread_once(&setup_once, setup);
+	size = (size + page_size - 1) & ~(page_size - 1);
+	char *region = mmap(NULL, page_size + size + page_size, PROT_READ|PROT_WRITE,
+						MAP_PRIVATE|MAP_ANONYMOUS|MAP_NORESERVE, -1, 0);
+	if ( region==MAP_FAILED ) {
+		fprintf(stderr, "can't reserve %zu bytes of VM stack\n", size);
+		exit(1);
+	}
+	char *guard = region + page_size + size;
+	mprotect(guard, page_size, PROT_NONE);
+	add_guard(guard);
+	return region + page_size;
+}
+
+void vm_stack_release(void *stack, size_t size)
+{
+	if ( stack==NULL ) return;
+	size = (size + page_size - 1) & ~(page_size - 1);
+	char *region = (char *)stack - page_size;
+	char *guard = region + page_size + size;
+	remove_guard(guard);
+	munmap(region, page_size + size + page_size);
+}
@@ -0,0 +1,46 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2015 Terence Parr, Hanzhou Shi, Shuai Yuan, Yuanyuan Zhang
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+#ifndef VMSTACK_H_
+#define VMSTACK_H_
+
+#include <stddef.h>
+#include <setjmp.h>
+
+/* Memory for the VM's operand and call stacks. vm_stack_reserve() maps size
+ * bytes of address space with an inaccessible guard page just past the end.
+ * Nothing is committed up front: the system supplies zeroed pages as the
+ * stack first touches them, so a VM is cheap to create however large its
+ * stacks may grow. Running into the guard page stops the program with a
+ * stack overflow error rather than overwriting whatever lies beyond, or,
+ * if the thread has set vm_stack_overflow_jump, jumps there once the error
+ * is reported.
+ *
+ * There is one readable page below the start of the stack because rooting
+ * the top of an empty stack (SROOT/VROOT) takes the address of stack[-1].
+ */
+extern void *vm_stack_reserve(size_t size);
+extern void vm_stack_release(void *stack, size_t size);
+extern _Thread_local sigjmp_buf *vm_stack_overflow_jump;
+
+#endif
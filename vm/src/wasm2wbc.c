@@ -0,0 +1,78 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2015 Terence Parr, Hanzhou Shi, Shuai Yuan, Yuanyuan Zhang
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+#include <stdio.h>
+#include <string.h>
+#include <wich.h>
+#include "vm.h"
+#include "wloader.h"
+#include "optimizer.h"
+
+/* Convert a .wasm file to the binary .wbc format that vm_load_wbc() maps:
+
+	wasm2wbc [--optimize] file.wasm [file.wbc]
+
+The output defaults to the input name with a .wbc extension. --optimize saves
+the code as the load-time optimizer (see optimizer.h) leaves it.
+ */
+int main(int argc, char *argv[])
+{
+    bool optimize = argc>1 && strcmp(argv[1], "--optimize")==0;
+    if ( optimize ) {
+        argc--;
+        argv++;
+    }
+    if ( argc<2 || argc>3 ) {
+        fprintf(stderr, "usage: wasm2wbc [--optimize] file.wasm [file.wbc]\n");
+        return 1;
+    }
+    char output[2000];
+    if ( argc==3 ) {
+        snprintf(output, sizeof(output), "%s", argv[2]);
+    }
+    else {
+        snprintf(output, sizeof(output)-4, "%s", argv[1]);
+        char *ext = strrchr(output, '.');
+        if ( ext!=NULL && strchr(ext, '/')==NULL ) *ext = '\0';
+        strcat(output, ".wbc");
+    }
+    FILE *f = fopen(argv[1], "r");
+    if ( f==NULL ) {
+        fprintf(stderr, "can't open %s\n", argv[1]);
+        return 1;
+    }
+    VM *vm = vm_load(f);
+    if ( optimize && !vm_optimize(vm) ) {
+        fprintf(stderr, "can't optimize %s\n", argv[1]);
+        return 1;
+    }
+    FILE *out = fopen(output, "wb");
+    if ( out==NULL ) {
+        fprintf(stderr, "can't write %s\n", output);
+        return 1;
+    }
+    bool ok = vm_save_wbc(vm, out);
+    ok = fclose(out)==0 && ok;
+    if ( !ok ) fprintf(stderr, "error writing %s\n", output);
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,66 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2015 Terence Parr, Hanzhou Shi, Shuai Yuan, Yuanyuan Zhang
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+#include <stdio.h>
+#include <string.h>
+#include <wich.h>
+#include "vm.h"
+#include "wloader.h"
+#include "cgen.h"
+
+/* Compile a .wasm program ahead of time to C (see cgen.h):
+
+	wcc [-o file.c] file.wasm
+
+The C goes to stdout unless -o is given. Build it against the runtime:
+
+	cc -std=c99 -DMARK_AND_COMPACT -I<wich>/include file.c \
+		-L<wich>/lib -lwlib_mark_and_compact -lgc_mark_and_compact -lmark_and_compact -lmalloc_common
+ */
+int main(int argc, char *argv[])
+{
+    char *output = NULL;
+    int arg = 1;
+    if ( arg+1<argc && strcmp(argv[arg], "-o")==0 ) {
+        output = argv[arg+1];
+        arg += 2;
+    }
+    if ( arg>=argc ) {
+        fprintf(stderr, "usage: wcc [-o file.c] file.wasm\n");
+        return 1;
+    }
+    FILE *f = fopen(argv[arg], "r");
+    if ( f==NULL ) {
+        fprintf(stderr, "can't open %s\n", argv[arg]);
+        return 1;
+    }
+    VM *vm = vm_load(f);
+    FILE *out = output!=NULL ? fopen(output, "w") : stdout;
+    if ( out==NULL ) {
+        fprintf(stderr, "can't write %s\n", output);
+        return 1;
+    }
+    bool ok = vm_generate_c(vm, out);
+    if ( out!=stdout ) fclose(out);
+    return ok ? 0 : 1;
+}
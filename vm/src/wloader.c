@@ -22,12 +22,17 @@ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
 SOFTWARE.
 */
 #include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
 #include <wich.h>
 #include "vm.h"
 #include "wloader.h"
+#include "decoder.h"
 
 static void vm_write16(byte *data, unsigned int n);
 static void vm_write32(byte *data, unsigned int n);
+static unsigned int vm_read32(const byte *data);
 /*
 Create a VM from a Wich object/asm file, .wasm; files look like:
 
@@ -75,7 +80,7 @@ VM *vm_load(FILE *f)
     int ninstr, nbytes;
     element e;
     fscanf(f, "%d instr, %d bytes\n", &ninstr, &nbytes);
-    byte *code = calloc((size_t)nbytes, sizeof(byte));
+    byte *code = calloc((size_t)nbytes+1, sizeof(byte)); // trailing 0 is a HALT sentinel
     addr32 ip = 0;
     for (int i=1; i<=ninstr; i++) {
         char instr[80+1];
@@ -112,6 +117,151 @@ VM *vm_load(FILE *f)
     }
     fclose(f);
     vm_init(vm, code, nbytes);
+    vm_predecode(vm);
+    return vm;
+}
+
+/*
+Binary object files, .wbc, hold the same information as .wasm files in a form
+that can be used where it lies. All numbers are 32-bit little-endian words and
+every section starts on a word boundary:
+
+	header		"WBC\0" version nstrings nfunctions code_size
+				strings_offset functions_offset code_offset
+	strings		per string: length, chars, '\0', padding
+	functions	per function: addr args locals type, then its name as a string
+	code		code_size bytes of byte code and a trailing 0 (HALT sentinel)
+
+vm_load_wbc() maps the file and points vm->code and vm->strings straight into
+the mapping, which lives as long as the process; nothing is parsed but the
+function table.
+ */
+static const byte WBC_MAGIC[4] = {'W', 'B', 'C', '\0'};
+static const int WBC_VERSION = 1;
+static const int WBC_HEADER_SIZE = 8*4;
+
+static inline size_t wbc_align(size_t n) { return (n + 3) & ~(size_t)3; }
+
+static void wbc_put32(FILE *f, unsigned int n)
+{
+    byte word[4];
+    vm_write32(word, n);
+    fwrite(word, 1, 4, f);
+}
+
+static size_t wbc_put_string(FILE *f, char *s)
+{
+    size_t len = strlen(s);
+    wbc_put32(f, (unsigned int)len);
+    fwrite(s, 1, len+1, f);
+    for (size_t k = len+1; k < wbc_align(len+1); k++) fputc(0, f);
+    return 4 + wbc_align(len+1);
+}
+
+bool vm_save_wbc(VM *vm, FILE *f)
+{
+    size_t strings_size = 0, functions_size = 0;
+    for (int i = 0; i < vm->num_strings; i++) strings_size += 4 + wbc_align(strlen(vm->strings[i])+1);
+    for (int i = 0; i < vm->num_functions; i++) functions_size += 4*4 + 4 + wbc_align(strlen(vm->functions[i].name)+1);
+
+    fwrite(WBC_MAGIC, 1, 4, f);
+    wbc_put32(f, (unsigned int)WBC_VERSION);
+    wbc_put32(f, (unsigned int)vm->num_strings);
+    wbc_put32(f, (unsigned int)vm->num_functions);
+    wbc_put32(f, (unsigned int)vm->code_size);
+    wbc_put32(f, (unsigned int)WBC_HEADER_SIZE);
+    wbc_put32(f, (unsigned int)(WBC_HEADER_SIZE + strings_size));
+    wbc_put32(f, (unsigned int)(WBC_HEADER_SIZE + strings_size + functions_size));
+    for (int i = 0; i < vm->num_strings; i++) wbc_put_string(f, vm->strings[i]);
+    for (int i = 0; i < vm->num_functions; i++) {
+        Function_metadata *func = &vm->functions[i];
+        wbc_put32(f, func->address);
+        wbc_put32(f, (unsigned int)func->nargs);
+        wbc_put32(f, (unsigned int)func->nlocals);
+        wbc_put32(f, (unsigned int)func->return_type);
+        wbc_put_string(f, func->name);
+    }
+    fwrite(vm->code, 1, (size_t)vm->code_size, f);
+    fputc(HALT, f);
+    return !ferror(f);
+}
+
+/* The string at offset in a mapping of size bytes, or NULL if it doesn't fit */
+static char *wbc_string(byte *map, size_t size, size_t offset, size_t *next)
+{
+    if ( offset+4>size ) return NULL;
+    size_t len = vm_read32(&map[offset]);
+    if ( len>size || offset+4+len>=size || map[offset+4+len]!='\0' ) return NULL;
+    *next = offset + 4 + wbc_align(len+1);
+    return (char *)&map[offset+4];
+}
+
+VM *vm_load_wbc(char *filename)
+{
+    int fd = open(filename, O_RDONLY);
+    if ( fd<0 ) {
+        fprintf(stderr, "can't open %s\n", filename);
+        return NULL;
+    }
+    struct stat st;
+    byte *map = MAP_FAILED;
+    if ( fstat(fd, &st)==0 && st.st_size>0 ) {
+        // private and writable, like strings from vm_load(); pages are copied only if written
+        map = mmap(NULL, (size_t)st.st_size, PROT_READ|PROT_WRITE, MAP_PRIVATE, fd, 0);
+    }
+    close(fd);
+    if ( map==MAP_FAILED ) {
+        fprintf(stderr, "can't map %s\n", filename);
+        return NULL;
+    }
+    if ( st.st_size<WBC_HEADER_SIZE ) {
+        fprintf(stderr, "%s isn't a valid .wbc file\n", filename);
+        munmap(map, (size_t)st.st_size);
+        return NULL;
+    }
+    size_t size = (size_t)st.st_size;
+    size_t nstrings = vm_read32(&map[8]);
+    size_t nfuncs = vm_read32(&map[12]);
+    size_t code_size = vm_read32(&map[16]);
+    size_t offset = vm_read32(&map[20]);
+    size_t functions_offset = vm_read32(&map[24]);
+    size_t code_offset = vm_read32(&map[28]);
+    if ( memcmp(map, WBC_MAGIC, 4)!=0 || vm_read32(&map[4])!=(unsigned int)WBC_VERSION ||
+         nfuncs>size || nstrings>size || code_offset>size || code_size>=size-code_offset ||
+         map[code_offset+code_size]!=HALT )
+    {
+        fprintf(stderr, "%s isn't a valid .wbc file\n", filename);
+        munmap(map, size);
+        return NULL;
+    }
+
+    VM *vm = vm_alloc();
+    vm->image = map;
+    vm->image_size = size;
+    vm->strings = (char **)calloc(nstrings, sizeof(char *));
+    vm->num_strings = (int)nstrings;
+    bool ok = true;
+    for (size_t i = 0; ok && i < nstrings; i++) {
+        vm->strings[i] = wbc_string(map, size, offset, &offset);
+        ok = vm->strings[i]!=NULL;
+    }
+    ok = ok && offset==functions_offset;
+    for (size_t i = 0; ok && i < nfuncs; i++) {
+        byte *F = &map[offset];
+        char *name = offset+4*4<=size ? wbc_string(map, size, offset+4*4, &offset) : NULL;
+        if ( name!=NULL ) {
+            def_function(vm, name, (int)vm_read32(&F[12]), vm_read32(&F[0]),
+                         (int)vm_read32(&F[4]), (int)vm_read32(&F[8]));
+        }
+        ok = name!=NULL;
+    }
+    if ( !ok || offset!=code_offset ) {
+        fprintf(stderr, "%s isn't a valid .wbc file\n", filename);
+        vm_free(vm);
+        return NULL;
+    }
+    vm_init(vm, &map[code_offset], (int)code_size);
+    vm_predecode(vm);
     return vm;
 }
 
@@ -124,6 +274,11 @@ static void vm_write32(byte *data, unsigned int n)
     data[0] = (byte)(n & 0xFF);
 }
 
+static unsigned int vm_read32(const byte *data)
+{
+    return (unsigned int)data[0] | (unsigned int)data[1]<<8 | (unsigned int)data[2]<<16 | (unsigned int)data[3]<<24;
+}
+
 static void vm_write16(byte *data, unsigned int n)
 {
     // assume little-endian!
@@ -27,6 +27,13 @@ SOFTWARE.
 #include "vm.h"
 
 extern VM *vm_load(FILE *f);
+
+/* Binary object files (.wbc); see wloader.c for the layout. vm_load_wbc()
+ * returns NULL if filename can't be mapped or isn't a .wbc file.
+ */
+extern VM *vm_load_wbc(char *filename);
+extern bool vm_save_wbc(VM *vm, FILE *f);
+
 extern BYTECODE vm_opcode(char *name);
 extern VM_INSTRUCTION *vm_instr(char *name);
 extern Function_metadata *vm_function(VM *vm, char *name);
@@ -22,16 +22,153 @@ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
 SOFTWARE.
 */
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 #include <wich.h>
 #include "vm.h"
 #include "wloader.h"
+#include "regvm.h"
+#include "optimizer.h"
+#include "profiler.h"
+#include "counters.h"
+#include "batch.h"
+#include "snapshot.h"
 
+static const int MAX_PATH_LEN = 4096;
+
+/* Paths in file list, one per line; blank lines are skipped. Returns NULL if list can't be read. */
+static char **read_list(char *list, int *n)
+{
+    FILE *f = fopen(list, "r");
+    if ( f==NULL ) return NULL;
+    int max = 16;
+    char **paths = malloc(max * sizeof(char *));
+    char line[MAX_PATH_LEN];
+    *n = 0;
+    while ( fgets(line, sizeof(line), f)!=NULL ) {
+        line[strcspn(line, "\r\n")] = '\0';
+        if ( line[0]=='\0' ) continue;
+        if ( *n==max ) {
+            max *= 2;
+            paths = realloc(paths, max * sizeof(char *));
+        }
+        paths[(*n)++] = strdup(line);
+    }
+    fclose(f);
+    return paths;
+}
+
+/* usage: wrun [--registers] [--jit=N] [--optimize] [--profile=file] [--count=file] [--snapshot=file] [--workers=N] file.wasm|file.wbc|file.snap
+ *        wrun [--registers] [--jit=N] [--optimize] --batch list.txt [-j N]
+ *
+ * --registers runs the program on the register machine (see regvm.h) if it
+ * can be translated. --jit=N compiles functions to native code after N calls;
+ * 0 turns the JIT off. --optimize runs the load-time optimizer (see
+ * optimizer.h) first. --profile samples the call stack PROFILE_HZ times a
+ * second (see profiler.h) and writes folded stacks to file; the register
+ * machine keeps its own frames, so it isn't profiled. --count runs the
+ * counting interpreter instead (see counters.h) and writes instruction, pair
+ * and function counts to file as JSON. .wbc files (see wasm2wbc) are mapped
+ * rather than parsed.
+ *
+ * --snapshot saves the VM's state to file when the program executes SNAPSHOT
+ * and carries on; running the .snap file picks up from there (see
+ * snapshot.h). A snapshot runs as saved, so --optimize and --registers don't
+ * apply to it.
+ *
+ * --workers=N runs the tasks the program SPAWNs on N threads, one per
+ * processor by default; see tasks.h.
+ *
+ * --batch runs every script listed in list.txt, one path per line, on N
+ * threads (1 by default) in this one process and prints their output in
+ * list order; see batch.h. It can't be combined with --profile or --count.
+ * A script that can't be loaded or fails as it runs, with a stack overflow
+ * say, doesn't stop the others; wrun exits with status 1 at the end.
+ */
 int main(int argc, char *argv[])
 {
-    FILE *f = fopen(argv[1], "r");
-    if ( f!=NULL ) {
-        VM *vm = vm_load(f);
-        vm_exec(vm, false);
+    bool registers = false;
+    bool optimize = false;
+    char *profile = NULL;
+    char *count = NULL;
+    int jit_threshold = JIT_THRESHOLD;
+    char *batch = NULL;
+    char *snapshot = NULL;
+    int workers = 1;
+    int task_workers = 0;
+    int arg = 1;
+    for (; arg<argc && argv[arg][0]=='-'; arg++) {
+        if ( strcmp(argv[arg], "--registers")==0 ) registers = true;
+        else if ( strncmp(argv[arg], "--jit=", 6)==0 ) jit_threshold = atoi(argv[arg]+6);
+        else if ( strcmp(argv[arg], "--optimize")==0 ) optimize = true;
+        else if ( strncmp(argv[arg], "--profile=", 10)==0 ) profile = argv[arg]+10;
+        else if ( strncmp(argv[arg], "--count=", 8)==0 ) count = argv[arg]+8;
+        else if ( strncmp(argv[arg], "--snapshot=", 11)==0 ) snapshot = argv[arg]+11;
+        else if ( strncmp(argv[arg], "--workers=", 10)==0 ) task_workers = atoi(argv[arg]+10);
+        else if ( strcmp(argv[arg], "--batch")==0 && arg+1<argc ) batch = argv[++arg];
+        else if ( strcmp(argv[arg], "-j")==0 && arg+1<argc ) workers = atoi(argv[++arg]);
+        else break;
+    }
+    if ( batch!=NULL && arg==argc && profile==NULL && count==NULL ) {
+        int n;
+        char **scripts = read_list(batch, &n);
+        if ( scripts==NULL ) {
+            fprintf(stderr, "can't read %s\n", batch);
+            return 1;
+        }
+        Batch_Options options = {workers, jit_threshold, optimize, registers};
+        int failures = vm_run_batch(scripts, n, &options, stdout);
+        for (int i = 0; i < n; i++) free(scripts[i]);
+        free(scripts);
+        return failures==0 ? 0 : 1;
+    }
+    if ( arg>=argc || batch!=NULL ) {
+        fprintf(stderr, "usage: wrun [--registers] [--jit=N] [--optimize] [--profile=file] [--count=file] [--snapshot=file] [--workers=N] file.wasm|file.wbc|file.snap\n");
+        fprintf(stderr, "       wrun [--registers] [--jit=N] [--optimize] --batch list.txt [-j N]\n");
+        return 1;
+    }
+    char *ext = strrchr(argv[arg], '.');
+    VM *vm = NULL;
+    bool restored = ext!=NULL && strcmp(ext, ".snap")==0;
+    if ( restored ) {
+        vm = vm_restore(argv[arg]);
+        optimize = registers = false;
+    }
+    else if ( ext!=NULL && strcmp(ext, ".wbc")==0 ) {
+        vm = vm_load_wbc(argv[arg]);
+    }
+    else {
+        FILE *f = fopen(argv[arg], "r");
+        if ( f!=NULL ) vm = vm_load(f);
+    }
+    if ( vm!=NULL && optimize && !vm_optimize(vm) ) {
+        fprintf(stderr, "can't optimize %s\n", argv[arg]);
+    }
+    if ( vm!=NULL ) {
+        vm->jit_threshold = jit_threshold;
+        vm->snapshot_path = snapshot;
+        vm->workers = task_workers;
+        Reg_Program *prog = registers ? vm_translate_registers(vm) : NULL;
+        if ( prog!=NULL ) {
+            vm_exec_registers(prog);
+            vm_free_registers(prog);
+        }
+        else {
+            FILE *out = profile!=NULL ? fopen(profile, "w") : NULL;
+            if ( profile!=NULL && (out==NULL || !vm_profile_start(vm, PROFILE_HZ)) ) {
+                fprintf(stderr, "can't profile to %s\n", profile);
+            }
+            FILE *counts = count!=NULL ? fopen(count, "w") : NULL;
+            if ( counts!=NULL ) vm_count(vm, counts);
+            else if ( count!=NULL ) fprintf(stderr, "can't write counts to %s\n", count);
+            if ( restored ) vm_resume(vm, false);
+            else vm_exec(vm, false);
+            if ( out!=NULL ) {
+                vm_profile_stop(out);
+                fclose(out);
+            }
+            if ( counts!=NULL ) fclose(counts);
+        }
     }
     return 0;
-}
\ No newline at end of file
+}
@@ -0,0 +1,203 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2015 Terence Parr, Hanzhou Shi, Shuai Yuan, Yuanyuan Zhang
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+#include <stdio.h>
+#include <string.h>
+#include <wich.h>
+#include "vm.h"
+#include "wloader.h"
+#include "superinstructions.h"
+
+/* Derive superinstructions from a corpus of .wasm files:
+
+	wsuper [-k num-superinstructions] [-o superinstructions.def] file.wasm...
+
+Runs each file, counting how often each sequence of 2..MAX_SUPER_LEN
+adjacent instructions executes, prints the most frequent sequences and,
+with -o, writes a superinstructions.def selecting the sequences that save
+the most dispatches. Program output is discarded.
+ */
+
+static const int DEFAULT_NUM_SUPER = 12;
+static const int REPORT_SIZE = 30;
+
+static void ngram_name(char *buf, Ngram *g)
+{
+	buf[0] = '\0';
+	for (int j = 0; j < g->n; j++) {
+		if ( j>0 ) strcat(buf, "_");
+		strcat(buf, vm_instructions[g->ops[j]].name);
+	}
+}
+
+// dispatches saved by fusing
+static unsigned long savings(Ngram *g)
+{
+	return g->count * (g->n - 1);
+}
+
+static int by_savings(const void *a, const void *b)
+{
+	unsigned long x = savings((Ngram *)a), y = savings((Ngram *)b);
+	return x < y ? 1 : (x > y ? -1 : 0);
+}
+
+// all instructions must have DO_ bodies and only the last may branch
+static bool can_fuse(Ngram *g)
+{
+	for (int j = 0; j < g->n; j++) {
+		int op = g->ops[j];
+		if ( !vm_fusable(op) ) return false;
+		if ( (op==BR || op==BRF) && j<g->n-1 ) return false;
+	}
+	return true;
+}
+
+// how many times does sequence a occur inside sequence b?
+static int occurrences(Ngram *a, Ngram *b)
+{
+	int times = 0;
+	for (int j = 0; j + a->n <= b->n; j++) {
+		if ( memcmp(a->ops, &b->ops[j], a->n*sizeof(int))==0 ) times++;
+	}
+	return times;
+}
+
+/* Dispatches saved by adding g to those already chosen. Executions of g
+ * inside a chosen longer sequence are already fused and a shorter chosen
+ * sequence inside g loses the executions g takes over.
+ */
+static long marginal_savings(Ngram *g, Ngram **chosen, int nchosen)
+{
+	long saved = (long)savings(g);
+	for (int c = 0; c < nchosen; c++) {
+		Ngram *s = chosen[c];
+		if ( s->n>g->n ) saved -= (long)(s->count * (g->n - 1) * occurrences(g, s));
+		else saved -= (long)(g->count * (s->n - 1) * occurrences(s, g));
+	}
+	return saved;
+}
+
+static void write_def(FILE *f, Ngram *ngrams, int n, int k, int argc, char *argv[], int first_file)
+{
+	fprintf(f, "/* Superinstructions generated by wsuper from an n-gram profile of:\n *");
+	int col = 2;
+	for (int i = first_file; i < argc; i++) {
+		char *base = strrchr(argv[i], '/');
+		base = base!=NULL ? base+1 : argv[i];
+		if ( col + 1 + strlen(base) > 80 ) {
+			fprintf(f, "\n *");
+			col = 2;
+		}
+		col += fprintf(f, " %s", base);
+	}
+	fprintf(f, "\n *\n * SUPER(name, length, (instructions), fused handler body)\n */\n");
+
+	// greedily pick the sequence that saves the most on top of those already picked
+	Ngram *chosen[k];
+	int nchosen = 0;
+	while ( nchosen<k ) {
+		Ngram *best = NULL;
+		long best_saved = 0;
+		for (int i = 0; i < n; i++) {
+			Ngram *g = &ngrams[i];
+			if ( !can_fuse(g) ) continue;
+			bool taken = false;
+			for (int c = 0; c < nchosen; c++) taken |= chosen[c]==g;
+			if ( taken ) continue;
+			long saved = marginal_savings(g, chosen, nchosen);
+			if ( saved>best_saved ) {
+				best = g;
+				best_saved = saved;
+			}
+		}
+		if ( best==NULL ) break;
+		chosen[nchosen++] = best;
+	}
+
+	char name[200];
+	for (int i = 0; i < nchosen; i++) {
+		Ngram *g = chosen[i];
+		ngram_name(name, g);
+		fprintf(f, "SUPER(%s, %d, (", name, g->n);
+		for (int j = 0; j < g->n; j++) {
+			fprintf(f, "%s%s", j>0 ? ", " : "", vm_instructions[g->ops[j]].name);
+		}
+		fprintf(f, "),");
+		for (int j = 0; j < g->n; j++) {
+			fprintf(f, " DO_%s(%d)", vm_instructions[g->ops[j]].name, j);
+		}
+		fprintf(f, ")\n");
+	}
+}
+
+int main(int argc, char *argv[])
+{
+	int k = DEFAULT_NUM_SUPER;
+	char *outfile = NULL;
+	int i = 1;
+	for (; i < argc && argv[i][0]=='-'; i++) {
+		if ( strcmp(argv[i], "-k")==0 && i+1<argc ) k = atoi(argv[++i]);
+		else if ( strcmp(argv[i], "-o")==0 && i+1<argc ) outfile = argv[++i];
+		else {
+			fprintf(stderr, "usage: wsuper [-k num-superinstructions] [-o superinstructions.def] file.wasm...\n");
+			return 1;
+		}
+	}
+	int first_file = i;
+
+	freopen("/dev/null", "w", stdout);
+	for (; i < argc; i++) {
+		FILE *f = fopen(argv[i], "r");
+		if ( f==NULL ) {
+			fprintf(stderr, "can't open %s\n", argv[i]);
+			continue;
+		}
+		VM *vm = vm_load(f);
+		vm_exec(vm, false);
+	}
+
+	int n;
+	Ngram *ngrams = vm_ngrams(&n);
+	qsort(ngrams, (size_t)n, sizeof(Ngram), by_savings);
+
+	char name[200];
+	fprintf(stderr, "%-40s %12s %12s\n", "sequence", "count", "saved");
+	for (int j = 0; j < n && j < REPORT_SIZE; j++) {
+		ngram_name(name, &ngrams[j]);
+		fprintf(stderr, "%-40s %12lu %12lu%s\n", name, ngrams[j].count, savings(&ngrams[j]),
+		        can_fuse(&ngrams[j]) ? "" : "  (not fusable)");
+	}
+
+	if ( outfile!=NULL ) {
+		FILE *f = fopen(outfile, "w");
+		if ( f==NULL ) {
+			fprintf(stderr, "can't write %s\n", outfile);
+			return 1;
+		}
+		write_def(f, ngrams, n, k, argc, argv, first_file);
+		fclose(f);
+	}
+	free(ngrams);
+	return 0;
+}
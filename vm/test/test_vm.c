@@ -29,15 +29,28 @@ SOFTWARE.
 
 #include <cunit.h>
 #include <wloader.h>
+#include <superinstructions.h>
+#include <profiler.h>
+#include <counters.h>
+#include <output.h>
+#include <batch.h>
+#include <snapshot.h>
+#include <vmstack.h>
+#include <unistd.h>
+#include <sys/wait.h>
 
 static void setup()		{ }
 static void teardown()	{ }
 
-static void run(char *code) {
+// vm_load() closes the file
+static VM *load(char *code) {
 	save_string("/tmp/t.wasm", code);
 	FILE *f = fopen("/tmp/t.wasm", "r");
-	VM *vm = vm_load(f);
-	fclose(f);
+	return vm_load(f);
+}
+
+static void run(char *code) {
+	VM *vm = load(code);
 	vm_exec(vm,false);
 }
 
@@ -785,7 +798,658 @@ void test_bubblesort() {
     run(code);
 }
 
+/*
+ * only the first instruction of a fused sequence changes
+ */
+void test_superinstructions() {
+    VM_SUPERINSTRUCTION *super = &vm_superinstructions[0];
+    VM *vm = vm_alloc();
+    vm->num_instrs = super->length+1;
+    vm->instrs = calloc((size_t)vm->num_instrs+1, sizeof(Decoded_Instr));
+    vm->instrs[0].opcode = NOP;
+    for (int i = 0; i < super->length; i++) {
+        vm->instrs[i+1].opcode = super->ops[i];
+    }
+    vm_fuse_superinstructions(vm);
+    assert_equal(vm->instrs[0].opcode, NOP);
+    assert_equal(vm->instrs[1].opcode, super->opcode);
+    for (int i = 1; i < super->length; i++) {
+        assert_equal(vm->instrs[i+1].opcode, super->ops[i]);
+    }
+    assert_equal(vm_base_opcode(super->opcode), super->ops[0]);
+}
+
+/*
+ * func f(n:int):int { if (n==0) { return 0 } return n + f(n-1) }
+ * f(5000)
+ */
+void deep_recursion() {
+    char *code =
+        "0 strings\n"
+        "2 functions\n"
+        "0: addr=0 args=1 locals=0 type=1 1/f\n"
+        "1: addr=35 args=0 locals=0 type=0 4/main\n"
+        "16 instr, 44 bytes\n"
+        "ILOAD 0\n"
+        "ICONST 0\n"
+        "IEQ\n"
+        "BRF 9\n"
+        "ICONST 0\n"
+        "RET\n"
+        "ILOAD 0\n"
+        "ILOAD 0\n"
+        "ICONST 1\n"
+        "ISUB\n"
+        "CALL 0\n"
+        "IADD\n"
+        "RET\n"
+        "ICONST 5000\n"
+        "CALL 0\n"
+        "HALT\n";
+    VM *vm = load(code);
+    vm_exec(vm, false);
+    assert_equal(vm->stack[vm->sp].i, 12502500);
+    assert_equal(vm->callsp, 0);
+    vm_free(vm);
+}
+
+/*
+ * func f(n:int, acc:int):int { if (n==0) { return acc } return f(n-1, acc+1) }
+ * f(200000, 0)
+ *
+ * far deeper than MAX_CALL_STACK but the tail call reuses f's frame
+ */
+void tail_recursion() {
+    char *code =
+        "0 strings\n"
+        "2 functions\n"
+        "0: addr=0 args=2 locals=0 type=1 1/f\n"
+        "1: addr=43 args=0 locals=0 type=0 4/main\n"
+        "24 instr, 58 bytes\n"
+        "GC_START\n"
+        "ILOAD 0\n"
+        "ICONST 0\n"
+        "IEQ\n"
+        "BRF 8\n"
+        "ILOAD 1\n"
+        "GC_END\n"
+        "RET\n"
+        "ILOAD 0\n"
+        "ICONST 1\n"
+        "ISUB\n"
+        "ILOAD 1\n"
+        "ICONST 1\n"
+        "IADD\n"
+        "CALL 0\n"
+        "GC_END\n"
+        "RET\n"
+        "PUSH_DFLT_RETV\n"
+        "RET\n"
+        "GC_START\n"
+        "ICONST 200000\n"
+        "ICONST 0\n"
+        "CALL 0\n"
+        "HALT\n";
+    VM *vm = load(code);
+    vm_exec(vm, false);
+    assert_equal(vm_base_opcode(vm->instrs[14].opcode), CALL);
+    assert_equal(vm->instrs[14].opcode, TAIL_CALL);
+    assert_equal(vm->instrs[22].opcode, CALL); // its result isn't returned
+    assert_equal(vm->stack[vm->sp].i, 200000);
+    vm_free(vm);
+}
+
+/*
+ * frames are as big as the function needs; the result replaces the args
+ */
+void many_locals() {
+    char *code =
+        "0 strings\n"
+        "2 functions\n"
+        "0: addr=0 args=3 locals=9 type=1 1/f\n"
+        "1: addr=18 args=0 locals=0 type=0 4/main\n"
+        "13 instr, 37 bytes\n"
+        "ILOAD 0\n"
+        "ILOAD 1\n"
+        "IADD\n"
+        "ILOAD 2\n"
+        "IADD\n"
+        "STORE 11\n"
+        "ILOAD 11\n"
+        "RET\n"
+        "ICONST 1\n"
+        "ICONST 2\n"
+        "ICONST 3\n"
+        "CALL 0\n"
+        "HALT\n";
+    VM *vm = load(code);
+    vm_exec(vm, false);
+    assert_equal(vm->stack[vm->sp].i, 6);
+    assert_equal(vm->stack[vm->sp-1].i, 0);
+    vm_free(vm);
+}
+
+/*
+ * func f(n:int):int { var i = 0 while ( i<n ) { i = i + 1 } return i }
+ * f(5000000)
+ *
+ * samples land in f, called from main
+ */
+void profile() {
+    char *code =
+        "0 strings\n"
+        "2 functions\n"
+        "0: addr=0 args=1 locals=1 type=1 1/f\n"
+        "1: addr=37 args=0 locals=0 type=0 4/main\n"
+        "15 instr, 47 bytes\n"
+        "ICONST 0\n"
+        "STORE 1\n"
+        "ILOAD 1\n"
+        "ILOAD 0\n"
+        "ILT\n"
+        "BRF 18\n"
+        "ILOAD 1\n"
+        "ICONST 1\n"
+        "IADD\n"
+        "STORE 1\n"
+        "BR -22\n"
+        "ILOAD 1\n"
+        "RET\n"
+        "ICONST 5000000\n"
+        "CALL 0\n"
+        "POP\n"
+        "HALT\n";
+    VM *vm = load(code);
+    vm->jit_threshold = 0;
+    assert_true(vm_profile_start(vm, PROFILE_HZ));
+    vm_exec(vm, false);
+    FILE *out = fopen("/tmp/t.folded", "w");
+    vm_profile_stop(out);
+    fclose(out);
+    assert_equal(vm->stack[vm->sp].i, 5000000);
+    vm_free(vm);
+
+    char folded[1000] = "";
+    FILE *f = fopen("/tmp/t.folded", "r");
+    fread(folded, 1, sizeof(folded)-1, f);
+    fclose(f);
+    assert_addr_not_equal(strstr(folded, "main;f "), NULL);
+}
+
+/*
+ * func f(n:int):int { if ( n<1 ) { return 0 } return f(n-1)+1 }
+ * f(3)
+ */
+void count() {
+    char *code =
+        "0 strings\n"
+        "2 functions\n"
+        "0: addr=0 args=1 locals=0 type=1 1/f\n"
+        "1: addr=37 args=0 locals=0 type=0 4/main\n"
+        "17 instr, 47 bytes\n"
+        "ILOAD 0\n"
+        "ICONST 1\n"
+        "ILT\n"
+        "BRF 9\n"
+        "ICONST 0\n"
+        "RET\n"
+        "ILOAD 0\n"
+        "ICONST 1\n"
+        "ISUB\n"
+        "CALL 0\n"
+        "ICONST 1\n"
+        "IADD\n"
+        "RET\n"
+        "ICONST 3\n"
+        "CALL 0\n"
+        "POP\n"
+        "HALT\n";
+    VM *vm = load(code);
+    FILE *out = fopen("/tmp/t.json", "w");
+    vm_count(vm, out);
+    vm_exec(vm, false);
+    fclose(out);
+    assert_addr_equal(vm->counters, NULL);
+    assert_equal(vm->functions[0].native, NULL);
+    vm_free(vm);
+
+    char json[4000] = "";
+    FILE *f = fopen("/tmp/t.json", "r");
+    fread(json, 1, sizeof(json)-1, f);
+    fclose(f);
+    // f's instructions include its recursive calls' just once; main's include f's
+    assert_addr_not_equal(strstr(json, "\"instructions\": 36,"), NULL);
+    assert_addr_not_equal(strstr(json, "\"ILT BRF\": 4"), NULL);
+    assert_addr_not_equal(strstr(json, "\"f\": { \"calls\": 4, \"instructions\": 32 }"), NULL);
+    assert_addr_not_equal(strstr(json, "\"main\": { \"calls\": 1, \"instructions\": 36 }"), NULL);
+}
+
+/*
+ * var s = "abc" ; len(s+"de") ; "de"=="de"
+ *
+ * strings on the stack are String objects; constants live outside the GC
+ * heap, so the collection at HALT must leave the root to s alone
+ */
+void string_objects() {
+    char *code =
+        "2 strings\n"
+        "0: 3/abc\n"
+        "1: 2/de\n"
+        "1 functions\n"
+        "0: addr=0 args=0 locals=0 type=0 4/main\n"
+        "11 instr, 21 bytes\n"
+        "GC_START\n"
+        "SCONST 0\n"
+        "SROOT\n"
+        "SCONST 0\n"
+        "SCONST 1\n"
+        "SADD\n"
+        "SLEN\n"
+        "SCONST 1\n"
+        "SCONST 1\n"
+        "SEQ\n"
+        "HALT\n";
+    VM *vm = load(code);
+    vm_exec(vm, false);
+    gc_set_num_roots(0);
+    assert_equal(vm->sp, 3); // above main's frame
+    assert_addr_equal(vm->stack[1].s, vm->string_objects[0]);
+    assert_equal(vm->stack[1].s->length, 3);
+    assert_equal(vm->stack[2].i, 5);
+    assert_equal(vm->stack[3].b, true);
+    vm_free(vm);
+}
+
+/*
+ * "ab"=="ab"
+ *
+ * equal constants are one String, as is "" with the default string value
+ */
+void interned_strings() {
+    char *code =
+        "3 strings\n"
+        "0: 2/ab\n"
+        "1: 2/ab\n"
+        "2: 0/\n"
+        "1 functions\n"
+        "0: addr=0 args=0 locals=0 type=0 4/main\n"
+        "4 instr, 8 bytes\n"
+        "SCONST 0\n"
+        "SCONST 1\n"
+        "SEQ\n"
+        "HALT\n";
+    VM *vm = load(code);
+    assert_addr_equal(vm->string_objects[0], vm->string_objects[1]);
+    assert_addr_equal(vm->string_objects[2], vm->empty_string);
+    assert_str_equal(vm->string_objects[0]->str, "ab");
+    assert_false(ptr_is_in_heap((heap_object *)vm->string_objects[0]));
+    vm_exec(vm, false);
+    assert_true(vm->stack[vm->sp].b);
+    vm_free(vm);
+}
+
+/*
+ * IPRINT and FPRINT write exactly what printf("%d\n") and printf("%1.2f\n") would
+ */
+void print_formats() {
+    VM *vm = vm_alloc();
+    int ints[] = {0, 7, -7, 10, 2147483647, -2147483647-1};
+    float floats[] = {0.0f, -0.0f, 0.005f, 0.015f, 0.025f, 0.125f, 0.375f, -0.004f, 2.5f, 9.995f,
+                      1e-40f, -1e-30f, 16777216.0f, 123456.789f, 1e20f, 3.4e38f, 1.0f/0.0f, -1.0f/0.0f};
+    char expected[400];
+    int mismatches = 0;
+    for (int i = 0; i < sizeof(ints)/sizeof(ints[0]); i++) {
+        vm->output_len = 0;
+        vm_print_int(vm, ints[i]);
+        int n = snprintf(expected, sizeof(expected), "%d\n", ints[i]);
+        if ( vm->output_len!=n || strncmp(vm->output, expected, n)!=0 ) mismatches++;
+    }
+    for (int i = 0; i < sizeof(floats)/sizeof(floats[0]); i++) {
+        vm->output_len = 0;
+        vm_print_float(vm, floats[i]);
+        int n = snprintf(expected, sizeof(expected), "%1.2f\n", floats[i]);
+        if ( vm->output_len!=n || strncmp(vm->output, expected, n)!=0 ) mismatches++;
+    }
+    for (int k = -200000; k <= 200000; k++) { // every thousandth, halfway cases included
+        float f = k / 1000.0f;
+        vm->output_len = 0;
+        vm_print_float(vm, f);
+        int n = snprintf(expected, sizeof(expected), "%1.2f\n", f);
+        if ( vm->output_len!=n || strncmp(vm->output, expected, n)!=0 ) mismatches++;
+    }
+    assert_equal(mismatches, 0);
+    vm->output_len = 0;
+    vm_free(vm);
+}
+
+/*
+ * scripts run on several threads but their output comes out in list order
+ */
+void batch() {
+    save_string("/tmp/t_hello.wasm",
+        "1 strings\n"
+        "0: 5/hello\n"
+        "1 functions\n"
+        "0: addr=0 args=0 locals=0 type=0 4/main\n"
+        "5 instr, 7 bytes\n"
+        "GC_START\n"
+        "SCONST 0\n"
+        "SPRINT\n"
+        "GC_END\n"
+        "HALT\n");
+    save_string("/tmp/t_int.wasm",
+        "0 strings\n"
+        "1 functions\n"
+        "0: addr=0 args=0 locals=0 type=0 4/main\n"
+        "3 instr, 7 bytes\n"
+        "ICONST 42\n"
+        "IPRINT\n"
+        "HALT\n");
+    char *scripts[] = {"/tmp/t_hello.wasm", "/tmp/t_int.wasm", "/tmp/t_hello.wasm", "/tmp/nosuch.wasm",
+                       "/tmp/t_int.wasm", "/tmp/t_int.wasm", "/tmp/t_hello.wasm"};
+    Batch_Options options = {3, JIT_THRESHOLD, false, false};
+    FILE *out = fopen("/tmp/t.out", "w");
+    int failures = vm_run_batch(scripts, 7, &options, out);
+    fclose(out);
+    assert_equal(failures, 1);
+
+    char output[100] = "";
+    FILE *f = fopen("/tmp/t.out", "r");
+    fread(output, 1, sizeof(output)-1, f);
+    fclose(f);
+    assert_str_equal(output, "hello\n42\nhello\n42\n42\nhello\n");
+}
+
+/*
+ * a script that fails as it runs stops there, keeping what it printed, and
+ * the worker carries on with the scripts after it
+ */
+void batch_failure() {
+    save_string("/tmp/t_recurse.wasm",
+        "0 strings\n"
+        "2 functions\n"
+        "0: addr=0 args=0 locals=0 type=0 1/f\n"
+        "1: addr=5 args=0 locals=0 type=0 4/main\n"
+        "7 instr, 15 bytes\n"
+        "CALL 0\n"
+        "NOP\n" // not a tail call, which would recurse for ever
+        "RET\n"
+        "ICONST 7\n"
+        "IPRINT\n"
+        "CALL 0\n"
+        "HALT\n");
+    char *scripts[] = {"/tmp/t_hello.wasm", "/tmp/t_recurse.wasm", "/tmp/t_hello.wasm",
+                       "/tmp/t_recurse.wasm", "/tmp/t_hello.wasm"};
+    for (int registers = 0; registers <= 1; registers++) {
+        Batch_Options options = {1, JIT_THRESHOLD, false, registers};
+        FILE *out = fopen("/tmp/t.out", "w");
+        int failures = vm_run_batch(scripts, 5, &options, out);
+        fclose(out);
+        assert_equal(failures, 2);
+
+        char output[100] = "";
+        FILE *f = fopen("/tmp/t.out", "r");
+        fread(output, 1, sizeof(output)-1, f);
+        fclose(f);
+        assert_str_equal(output, "hello\n7\nhello\n7\nhello\n");
+    }
+}
+
+/* Restore /tmp/t.snap with the int at byte field of its state, counting
+ * from the SNAP magic, set to value.
+ */
+static VM *restore_patched(int field, int32_t value) {
+    FILE *f = fopen("/tmp/t.snap", "rb");
+    char buf[4096];
+    size_t n = fread(buf, 1, sizeof(buf), f);
+    fclose(f);
+    size_t at = 0;
+    while ( at+4<=n && memcmp(&buf[at], "SNAP", 4)!=0 ) at += 8; // the state is 8-byte aligned
+    memcpy(&buf[at+field], &value, sizeof(value));
+    f = fopen("/tmp/t_bad.snap", "wb");
+    fwrite(buf, 1, n, f);
+    fclose(f);
+    return vm_restore("/tmp/t_bad.snap");
+}
+
+/*
+ * print(7)
+ * var v = [1,2]
+ * var s = "ab"+"cd"
+ * v[1] = 5
+ * <snapshot>
+ * print(v)
+ * print(s)
+ * print("ab")
+ *
+ * the restored VM picks up after the SNAPSHOT with its vector and strings intact
+ */
+void snapshot() {
+    char *code =
+        "2 strings\n"
+        "0: 2/ab\n"
+        "1: 2/cd\n"
+        "1 functions\n"
+        "0: addr=0 args=0 locals=2 type=0 4/main\n"
+        "29 instr, 69 bytes\n"
+        "GC_START\n"
+        "ICONST 7\n"
+        "IPRINT\n"
+        "ICONST 1\n"
+        "I2F\n"
+        "ICONST 2\n"
+        "I2F\n"
+        "ICONST 2\n"
+        "VECTOR\n"
+        "STORE 0\n"
+        "VROOT\n"
+        "SCONST 0\n"
+        "SCONST 1\n"
+        "SADD\n"
+        "STORE 1\n"
+        "SROOT\n"
+        "VLOAD 0\n"
+        "ICONST 1\n"
+        "FCONST 5.0\n"
+        "STORE_INDEX\n"
+        "SNAPSHOT\n"
+        "VLOAD 0\n"
+        "VPRINT\n"
+        "SLOAD 1\n"
+        "SPRINT\n"
+        "SCONST 0\n"
+        "SPRINT\n"
+        "GC_END\n"
+        "HALT\n";
+    VM *vm = load(code);
+    vm->snapshot_path = "/tmp/t.snap";
+    vm->capture_output = true;
+    vm_exec(vm, false);
+    size_t len;
+    char *output = vm_take_output(vm, &len);
+    assert_equal(len, strlen("7\n[5.00, 2.00]\nabcd\nab\n"));
+    assert_true(strncmp(output, "7\n[5.00, 2.00]\nabcd\nab\n", len)==0);
+    free(output);
+    vm_free(vm);
+
+    vm = vm_restore("/tmp/t.snap");
+    assert_addr_not_equal(vm, NULL);
+    vm->capture_output = true;
+    vm_resume(vm, false);
+    output = vm_take_output(vm, &len);
+    assert_equal(len, strlen("[5.00, 2.00]\nabcd\nab\n"));
+    assert_true(strncmp(output, "[5.00, 2.00]\nabcd\nab\n", len)==0);
+    free(output);
+    vm_free(vm);
+
+    // a bad fp, a frame whose roots or locals run past what was saved
+    assert_addr_equal(restore_patched(24, 1000000), NULL);
+    assert_addr_equal(restore_patched(56+8, 1000), NULL);
+    assert_addr_equal(restore_patched(56+12, 2), NULL);
+}
+
+/*
+ * func f(v : [], n : int) : [] { print(n); <yield>; return v*n }
+ * func g(n : int) { print(n) }
+ * func k(n : int) : int { <join(spawn(g(n+1)))>; return n*2 }
+ * var a = <spawn(f([1,2], 3))>
+ * var b = <spawn(f([1,2], 10))>
+ * print(<join(b)>)
+ * print(<join(a)>)
+ * print(<join(spawn(k(20)))>)
+ * <spawn(g(7))>
+ * <yield>
+ *
+ * a task's output comes out where it's joined, even from a task it joined,
+ * and that of tasks never joined at the end, however many threads run them
+ */
+void tasks() {
+    char *code =
+        "0 strings\n"
+        "4 functions\n"
+        "0: addr=0 args=0 locals=2 type=0 4/main\n"
+        "1: addr=95 args=2 locals=0 type=5 1/f\n"
+        "2: addr=108 args=1 locals=0 type=0 1/g\n"
+        "3: addr=113 args=1 locals=0 type=1 1/k\n"
+        "52 instr, 138 bytes\n"
+        "ICONST 1\n"
+        "I2F\n"
+        "ICONST 2\n"
+        "I2F\n"
+        "ICONST 2\n"
+        "VECTOR\n"
+        "ICONST 3\n"
+        "SPAWN 1\n"
+        "STORE 0\n"
+        "ICONST 1\n"
+        "I2F\n"
+        "ICONST 2\n"
+        "I2F\n"
+        "ICONST 2\n"
+        "VECTOR\n"
+        "ICONST 10\n"
+        "SPAWN 1\n"
+        "STORE 1\n"
+        "ILOAD 1\n"
+        "JOIN 1\n"
+        "VPRINT\n"
+        "ILOAD 0\n"
+        "JOIN 1\n"
+        "VPRINT\n"
+        "ICONST 20\n"
+        "SPAWN 3\n"
+        "JOIN 3\n"
+        "IPRINT\n"
+        "ICONST 7\n"
+        "SPAWN 2\n"
+        "POP\n"
+        "YIELD\n"
+        "HALT\n"
+        "ILOAD 1\n"
+        "IPRINT\n"
+        "YIELD\n"
+        "VLOAD 0\n"
+        "ILOAD 1\n"
+        "VMULI\n"
+        "RET\n"
+        "ILOAD 0\n"
+        "IPRINT\n"
+        "RET\n"
+        "ILOAD 0\n"
+        "ICONST 1\n"
+        "IADD\n"
+        "SPAWN 2\n"
+        "JOIN 2\n"
+        "ILOAD 0\n"
+        "ICONST 2\n"
+        "IMUL\n"
+        "RET\n";
+    char *expected = "10\n[10.00, 20.00]\n3\n[3.00, 6.00]\n21\n40\n7\n";
+    for (int workers = 1; workers <= 4; workers += 3) {
+        VM *vm = load(code);
+        vm->workers = workers;
+        vm->capture_output = true;
+        vm_exec(vm, false);
+        assert_addr_equal(vm->tasks, NULL);
+        size_t len;
+        char *output = vm_take_output(vm, &len);
+        assert_equal(len, strlen(expected));
+        assert_true(strncmp(output, expected, len)==0);
+        free(output);
+        vm_free(vm);
+    }
+}
+
+/*
+ * stacks are reserved, not allocated, so VMs are cheap to make and free
+ */
+void many_vms() {
+    for (int i = 0; i < 10000; i++) {
+        VM *vm = vm_alloc();
+        assert_addr_not_equal(vm->stack, NULL);
+        vm->stack[0].i = i;
+        vm->call_stack[0].func = NULL;
+        vm_free(vm);
+    }
+}
+
+static char *test_vm_path;
+
+/* Overflow the last of more stacks than fit in one chunk of guard pages */
+static void overflow_many_stacks() {
+    char *stack = NULL;
+    for (int i = 0; i < 10000; i++) stack = vm_stack_reserve(4096);
+    stack[4096] = 1;
+    exit(2);
+}
+
+/*
+ * overflowing a stack is reported as such however many stacks are live;
+ * it's done in a fresh process since cunit traps SIGSEGV itself
+ */
+void stack_overflow() {
+    fflush(NULL);
+    pid_t pid = fork();
+    if ( pid==0 ) {
+        freopen("/dev/null", "w", stderr);
+        execl(test_vm_path, test_vm_path, "overflow_many_stacks", (char *)NULL);
+        _exit(3);
+    }
+    int status;
+    waitpid(pid, &status, 0);
+    assert_true(WIFEXITED(status) && WEXITSTATUS(status)==1);
+}
+
+static void overflow_caught() {
+    char *stack = vm_stack_reserve(4096);
+    sigjmp_buf on_overflow;
+    if ( sigsetjmp(on_overflow, 1)!=0 ) exit(4);
+    vm_stack_overflow_jump = &on_overflow;
+    stack[4096] = 1;
+    exit(2);
+}
+
+/*
+ * a thread that has set vm_stack_overflow_jump goes there on overflowing a
+ * stack rather than exiting
+ */
+void stack_overflow_caught() {
+    fflush(NULL);
+    pid_t pid = fork();
+    if ( pid==0 ) {
+        freopen("/dev/null", "w", stderr);
+        execl(test_vm_path, test_vm_path, "overflow_caught", (char *)NULL);
+        _exit(3);
+    }
+    int status;
+    waitpid(pid, &status, 0);
+    assert_true(WIFEXITED(status) && WEXITSTATUS(status)==4);
+}
+
 int main(int argc, char *argv[]) {
+    if ( argc>1 && strcmp(argv[1], "overflow_many_stacks")==0 ) overflow_many_stacks();
+    if ( argc>1 && strcmp(argv[1], "overflow_caught")==0 ) overflow_caught();
+    test_vm_path = argv[0];
     cunit_setup = setup;
     cunit_teardown = teardown;
 
@@ -812,6 +1476,22 @@ int main(int argc, char *argv[]) {
     test(test_div_error);
     test(test_index_out_of_range);
     test(test_need_default_return);
+    test(test_superinstructions);
+    test(deep_recursion);
+    test(tail_recursion);
+    test(many_locals);
+    test(profile);
+    test(count);
+    test(print_formats);
+    test(string_objects);
+    test(interned_strings);
+    test(batch);
+    test(batch_failure);
+    test(snapshot);
+    test(tasks);
+    test(many_vms);
+    test(stack_overflow);
+    test(stack_overflow_caught);
     return 0;
 }
 
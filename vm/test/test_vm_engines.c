@@ -0,0 +1,212 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2015 Terence Parr, Hanzhou Shi, Shuai Yuan, Yuanyuan Zhang
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <dirent.h>
+#include <wich.h>
+#include "vm.h"
+
+#include <cunit.h>
+#include <wloader.h>
+#include <regvm.h>
+#include <cgen.h>
+#include <optimizer.h>
+
+/* Every execution engine must print exactly what vm_exec() prints for each
+ * program in the samples directory.
+ */
+
+static char samplesdir[2000];
+
+// scratch files, named for this process as ctest may run the variants at once
+static char out_path[100];
+static char wbc_path[100];
+#ifdef WCC_CC
+static char c_path[100];
+static char bin_path[100];
+#endif
+
+static void setup()		{ }
+static void teardown()	{ }
+
+static void run_stack(VM *vm) {
+	vm_exec(vm, false);
+}
+
+static int num_compiled = 0;
+
+static void run_jit(VM *vm) {
+	vm->jit_threshold = 1; // compile everything on first call
+	vm_exec(vm, false);
+	for (int f = 0; f < vm->num_functions; f++) {
+		if ( vm->functions[f].native!=NULL ) num_compiled++;
+	}
+}
+
+static void run_registers(VM *vm) {
+	Reg_Program *prog = vm_translate_registers(vm);
+	assert_addr_not_equal(prog, NULL);
+	vm_exec_registers(prog);
+	vm_free_registers(prog);
+}
+
+/* Round trip through a .wbc file and run what vm_load_wbc() maps */
+static void run_wbc(VM *vm) {
+	FILE *f = fopen(wbc_path, "wb");
+	assert_addr_not_equal(f, NULL);
+	assert_true(vm_save_wbc(vm, f));
+	fclose(f);
+	VM *mapped = vm_load_wbc(wbc_path);
+	assert_addr_not_equal(mapped, NULL);
+	vm_exec(mapped, false);
+	vm_free(mapped);
+}
+
+static void run_optimized(VM *vm) {
+	assert_true(vm_optimize(vm));
+	vm_exec(vm, false);
+}
+
+#ifdef WCC_CC
+/* Compile to C, build that with the runtime libraries and run it */
+static void run_wcc(VM *vm) {
+	FILE *c = fopen(c_path, "w");
+	assert_addr_not_equal(c, NULL);
+	bool ok = vm_generate_c(vm, c);
+	fclose(c);
+	assert_true(ok);
+	char cmd[4000];
+	snprintf(cmd, sizeof(cmd), "%s -o %s %s%s", WCC_CC, bin_path, c_path, WCC_LIBS);
+	int status = system(cmd);
+	assert_equal(status, 0);
+	status = system(bin_path);
+	assert_equal(status, 0);
+}
+#endif
+
+/* Load filename, run it with engine and return what it wrote to stdout */
+static char *run_sample(char *filename, void (*engine)(VM *)) {
+	char path[2000];
+	snprintf(path, sizeof(path), "%s/%s", samplesdir, filename);
+	FILE *f = fopen(path, "r");
+	VM *vm = vm_load(f);
+
+	fflush(stdout);
+	int saved_stdout = dup(1);
+	int out = open(out_path, O_WRONLY|O_CREAT|O_TRUNC, 0644);
+	dup2(out, 1);
+	close(out);
+	engine(vm);
+	fflush(stdout);
+	dup2(saved_stdout, 1);
+	close(saved_stdout);
+
+	FILE *results = fopen(out_path, "r");
+	char *output = calloc(100000, 1);
+	fread(output, 1, 100000-1, results);
+	fclose(results);
+	vm_free(vm);
+	return output;
+}
+
+static void compare_engines(void (*engine)(VM *)) {
+	DIR *dir = opendir(samplesdir);
+	assert_addr_not_equal(dir, NULL);
+	struct dirent *dp;
+	while ( (dp = readdir(dir))!=NULL ) {
+		char *filename = dp->d_name;
+		if ( strstr(filename, ".wasm")==NULL ) continue;
+		fprintf(stderr, "comparing %s\n", filename);
+		char *expected = run_sample(filename, run_stack);
+		char *result = run_sample(filename, engine);
+		assert_str_equal(result, expected);
+		free(expected);
+		free(result);
+	}
+	closedir(dir);
+}
+
+void registers() {
+	compare_engines(run_registers);
+}
+
+void jit() {
+	compare_engines(run_jit);
+#if defined(__x86_64__)
+	assert_true(num_compiled>0);
+#endif
+}
+
+void wbc() {
+	compare_engines(run_wbc);
+}
+
+void optimized() {
+	compare_engines(run_optimized);
+}
+
+void wcc() {
+#ifdef WCC_CC
+	compare_engines(run_wcc);
+#endif
+}
+
+int main(int argc, char *argv[]) {
+	cunit_setup = setup;
+	cunit_teardown = teardown;
+
+	char* wichruntime = getenv("WICHRUNTIME");
+	if ( wichruntime==NULL ) {
+		fprintf(stderr, "environment variable WICHRUNTIME not set to root of runtime area\n");
+		return -1;
+	}
+	strcpy(samplesdir, wichruntime);
+	strcat(samplesdir, "/vm/test/samples");
+	int pid = (int)getpid();
+	snprintf(out_path, sizeof(out_path), "/tmp/engine_%d.out", pid);
+	snprintf(wbc_path, sizeof(wbc_path), "/tmp/engine_%d.wbc", pid);
+#ifdef WCC_CC
+	snprintf(c_path, sizeof(c_path), "/tmp/engine_%d.c", pid);
+	snprintf(bin_path, sizeof(bin_path), "/tmp/engine_%d.bin", pid);
+#endif
+
+	test(registers);
+	test(jit);
+	test(wbc);
+	test(optimized);
+	test(wcc);
+
+	unlink(out_path);
+	unlink(wbc_path);
+#ifdef WCC_CC
+	unlink(c_path);
+	unlink(bin_path);
+#endif
+	return 0;
+}
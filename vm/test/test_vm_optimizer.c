@@ -0,0 +1,202 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2015 Terence Parr, Hanzhou Shi, Shuai Yuan, Yuanyuan Zhang
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <dirent.h>
+#include <wich.h>
+#include "vm.h"
+
+#include <cunit.h>
+#include <wloader.h>
+#include <verifier.h>
+#include <optimizer.h>
+
+static char samplesdir[2000];
+static char wasm_path[100];	// named for this process as ctest may run the other tests at once
+
+static void setup()		{ }
+static void teardown()	{ }
+
+static VM *load(char *code) {
+	save_string(wasm_path, code);
+	FILE *f = fopen(wasm_path, "r");
+	return vm_load(f);
+}
+
+/* Optimized compiler output must still verify and can only shrink */
+void samples() {
+	DIR *dir = opendir(samplesdir);
+	assert_addr_not_equal(dir, NULL);
+	struct dirent *dp;
+	while ( (dp = readdir(dir))!=NULL ) {
+		char path[2000];
+		if ( strstr(dp->d_name, ".wasm")==NULL ) continue;
+		snprintf(path, sizeof(path), "%s/%s", samplesdir, dp->d_name);
+		fprintf(stderr, "optimizing %s\n", dp->d_name);
+		VM *vm = vm_load(fopen(path, "r"));
+		int size = vm->code_size;
+		assert_true(vm_optimize(vm));
+		assert_true(vm->code_size<=size);
+		assert_true(vm_verify(vm));
+		vm_free(vm);
+	}
+	closedir(dir);
+}
+
+/*
+ * if ( (2+3)*4==20 ) print(1) else print(0)
+ */
+void folds_constants() {
+	char *code =
+		"0 strings\n"
+		"1 functions\n"
+		"0: addr=0 args=0 locals=0 type=0 4/main\n"
+		"13 instr, 40 bytes\n"
+		"ICONST 2\n"
+		"ICONST 3\n"
+		"IADD\n"
+		"ICONST 4\n"
+		"IMUL\n"
+		"ICONST 20\n"
+		"IEQ\n"
+		"BRF 10\n"
+		"ICONST 1\n"
+		"IPRINT\n"
+		"HALT\n"
+		"ICONST 0\n"
+		"IPRINT\n"
+		"HALT\n";
+	VM *vm = load(code);
+	assert_true(vm_optimize(vm));
+	assert_equal(vm->num_instrs, 3);
+	assert_equal(vm->code_size, 7);
+	assert_equal(vm->instrs[0].opnd.i, 1);
+	assert_equal(vm->instrs[1].opcode, IPRINT);
+	vm_free(vm);
+}
+
+/* A branch to a branch goes straight to the final target */
+void threads_jumps() {
+	char *code =
+		"0 strings\n"
+		"1 functions\n"
+		"0: addr=0 args=0 locals=1 type=0 4/main\n"
+		"10 instr, 24 bytes\n"
+		"ILOAD 0\n"
+		"BRF 10\n"
+		"ICONST 1\n"
+		"IPRINT\n"
+		"HALT\n"
+		"BR 3\n"
+		"NOP\n"
+		"ICONST 2\n"
+		"IPRINT\n"
+		"HALT\n";
+	VM *vm = load(code);
+	assert_true(vm_optimize(vm));
+	assert_equal(vm->num_instrs, 8);
+	assert_equal(vm->code_size, 20);
+	assert_equal(vm->instrs[1].opcode, BRF);
+	assert_equal(vm->instrs[1].target, 5);
+	assert_equal(vm->instrs[5].opnd.i, 2);
+	assert_true(vm_verify(vm));
+	vm_free(vm);
+}
+
+/*
+ * func f(x : int) : int { return x }
+ * f(6*7)
+ *
+ * f's address moves down; its default return is unreachable
+ */
+void relocates_functions() {
+	char *code =
+		"0 strings\n"
+		"2 functions\n"
+		"0: addr=0 args=0 locals=0 type=0 4/main\n"
+		"1: addr=15 args=1 locals=0 type=1 1/f\n"
+		"9 instr, 21 bytes\n"
+		"ICONST 6\n"
+		"ICONST 7\n"
+		"IMUL\n"
+		"CALL 1\n"
+		"HALT\n"
+		"ILOAD 0\n"
+		"RET\n"
+		"PUSH_DFLT_RETV\n"
+		"RET\n";
+	VM *vm = load(code);
+	assert_true(vm_optimize(vm));
+	assert_equal(vm->functions[1].address, 9);
+	assert_equal(vm->code_size, 13);
+	assert_equal(vm->num_instrs, 5);
+	vm_exec(vm, false);
+	assert_equal(vm->stack[vm->sp].i, 42);
+	vm_free(vm);
+}
+
+/* Division by zero is left for run time to report */
+void keeps_division_by_zero() {
+	char *code =
+		"0 strings\n"
+		"1 functions\n"
+		"0: addr=0 args=0 locals=0 type=0 4/main\n"
+		"5 instr, 13 bytes\n"
+		"ICONST 1\n"
+		"ICONST 0\n"
+		"IDIV\n"
+		"IPRINT\n"
+		"HALT\n";
+	VM *vm = load(code);
+	assert_true(vm_optimize(vm));
+	assert_equal(vm->num_instrs, 5);
+	vm_free(vm);
+}
+
+int main(int argc, char *argv[]) {
+	cunit_setup = setup;
+	cunit_teardown = teardown;
+
+	char* wichruntime = getenv("WICHRUNTIME");
+	if ( wichruntime==NULL ) {
+		fprintf(stderr, "environment variable WICHRUNTIME not set to root of runtime area\n");
+		return -1;
+	}
+	strcpy(samplesdir, wichruntime);
+	strcat(samplesdir, "/vm/test/samples");
+	snprintf(wasm_path, sizeof(wasm_path), "/tmp/t_optimizer_%d.wasm", (int)getpid());
+
+	test(samples);
+	test(folds_constants);
+	test(threads_jumps);
+	test(relocates_functions);
+	test(keeps_division_by_zero);
+
+	unlink(wasm_path);
+	return 0;
+}
@@ -61,9 +61,8 @@ int main(int argc, char *argv[]) {
 				strcat(samplesfile, "/");
 				strcat(samplesfile, filename);
 				FILE *f = fopen(samplesfile, "r");
-				VM *vm = vm_load(f);
+				VM *vm = vm_load(f); // closes f
 				vm_exec(vm, false);
-				fclose(f);
 			}
 			dp = readdir(dir);
 		}
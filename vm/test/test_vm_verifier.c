@@ -0,0 +1,260 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2015 Terence Parr, Hanzhou Shi, Shuai Yuan, Yuanyuan Zhang
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <dirent.h>
+#include <wich.h>
+#include "vm.h"
+
+#include <cunit.h>
+#include <wloader.h>
+#include <verifier.h>
+
+static char samplesdir[2000];
+static char wasm_path[100];	// named for this process as ctest may run the other tests at once
+
+static void setup()		{ }
+static void teardown()	{ }
+
+static VM *load(char *code) {
+	save_string(wasm_path, code);
+	FILE *f = fopen(wasm_path, "r");
+	return vm_load(f);
+}
+
+/* Everything the compiler produced must verify */
+void samples() {
+	DIR *dir = opendir(samplesdir);
+	assert_addr_not_equal(dir, NULL);
+	struct dirent *dp;
+	while ( (dp = readdir(dir))!=NULL ) {
+		char path[2000];
+		if ( strstr(dp->d_name, ".wasm")==NULL ) continue;
+		snprintf(path, sizeof(path), "%s/%s", samplesdir, dp->d_name);
+		fprintf(stderr, "verifying %s\n", dp->d_name);
+		VM *vm = vm_load(fopen(path, "r"));
+		assert_true(vm_verify(vm));
+		assert_true(vm->verified);
+	}
+	closedir(dir);
+}
+
+/*
+ * func f(x : int) : int { return x+1 }
+ * print(f(1))
+ */
+void max_stack() {
+	char *code =
+		"0 strings\n"
+		"2 functions\n"
+		"0: addr=0 args=1 locals=0 type=1 1/f\n"
+		"1: addr=10 args=0 locals=0 type=0 4/main\n"
+		"8 instr, 20 bytes\n"
+		"ILOAD 0\n"
+		"ICONST 1\n"
+		"IADD\n"
+		"RET\n"
+		"ICONST 1\n"
+		"CALL 0\n"
+		"IPRINT\n"
+		"HALT\n";
+	VM *vm = load(code);
+	assert_true(vm_verify(vm));
+	assert_equal(vm->functions[0].max_stack, 2);
+	assert_equal(vm->functions[1].max_stack, 1);
+}
+
+/* The compiler's locals count can be short; frames cover every local used */
+void widens_locals() {
+	char *code =
+		"0 strings\n"
+		"1 functions\n"
+		"0: addr=0 args=0 locals=1 type=0 4/main\n"
+		"3 instr, 9 bytes\n"
+		"ICONST 1\n"
+		"STORE 2\n"
+		"HALT\n";
+	VM *vm = load(code);
+	assert_true(vm_verify(vm));
+	assert_equal(vm->functions[0].nlocals, 3);
+}
+
+void type_mismatch() {
+	char *code =
+		"0 strings\n"
+		"1 functions\n"
+		"0: addr=0 args=0 locals=0 type=0 4/main\n"
+		"5 instr, 13 bytes\n"
+		"ICONST 1\n"
+		"FCONST 2.0\n"
+		"IADD\n"
+		"IPRINT\n"
+		"HALT\n";
+	assert_false(vm_verify(load(code)));
+}
+
+void vector_index_needs_vector() {
+	char *code =
+		"0 strings\n"
+		"1 functions\n"
+		"0: addr=0 args=0 locals=0 type=0 4/main\n"
+		"5 instr, 13 bytes\n"
+		"ICONST 1\n"
+		"ICONST 1\n"
+		"VLOAD_INDEX\n"
+		"FPRINT\n"
+		"HALT\n";
+	assert_false(vm_verify(load(code)));
+}
+
+void stack_underflow() {
+	char *code =
+		"0 strings\n"
+		"1 functions\n"
+		"0: addr=0 args=0 locals=0 type=0 4/main\n"
+		"4 instr, 8 bytes\n"
+		"ICONST 1\n"
+		"IADD\n"
+		"IPRINT\n"
+		"HALT\n";
+	assert_false(vm_verify(load(code)));
+}
+
+void local_out_of_range() {
+	char *code =
+		"0 strings\n"
+		"1 functions\n"
+		"0: addr=0 args=0 locals=1 type=0 4/main\n"
+		"3 instr, 9 bytes\n"
+		"ICONST 1\n"
+		"STORE -1\n"
+		"HALT\n";
+	assert_false(vm_verify(load(code)));
+}
+
+void local_used_as_two_types() {
+	char *code =
+		"0 strings\n"
+		"1 functions\n"
+		"0: addr=0 args=0 locals=1 type=0 4/main\n"
+		"5 instr, 13 bytes\n"
+		"FCONST 1.0\n"
+		"STORE 0\n"
+		"ILOAD 0\n"
+		"IPRINT\n"
+		"HALT\n";
+	assert_false(vm_verify(load(code)));
+}
+
+/* if true then push 1 twice, else once */
+void inconsistent_stack() {
+	char *code =
+		"0 strings\n"
+		"1 functions\n"
+		"0: addr=0 args=0 locals=0 type=0 4/main\n"
+		"5 instr, 19 bytes\n"
+		"ICONST 1\n"
+		"BRF 8\n"
+		"ICONST 1\n"
+		"ICONST 1\n"
+		"HALT\n";
+	assert_false(vm_verify(load(code)));
+}
+
+void branch_leaves_function() {
+	char *code =
+		"0 strings\n"
+		"2 functions\n"
+		"0: addr=0 args=0 locals=0 type=0 1/f\n"
+		"1: addr=4 args=0 locals=0 type=0 4/main\n"
+		"4 instr, 8 bytes\n"
+		"BR 4\n"
+		"RET\n"
+		"CALL 0\n"
+		"HALT\n";
+	assert_false(vm_verify(load(code)));
+}
+
+void falls_off_end() {
+	char *code =
+		"0 strings\n"
+		"2 functions\n"
+		"0: addr=0 args=0 locals=0 type=0 1/f\n"
+		"1: addr=1 args=0 locals=0 type=0 4/main\n"
+		"3 instr, 5 bytes\n"
+		"NOP\n"
+		"CALL 0\n"
+		"HALT\n";
+	assert_false(vm_verify(load(code)));
+}
+
+void call_argument_type() {
+	char *code =
+		"0 strings\n"
+		"2 functions\n"
+		"0: addr=0 args=1 locals=0 type=0 1/f\n"
+		"1: addr=5 args=0 locals=0 type=0 4/main\n"
+		"6 instr, 14 bytes\n"
+		"FLOAD 0\n"
+		"FPRINT\n"
+		"RET\n"
+		"ICONST 1\n"
+		"CALL 0\n"
+		"HALT\n";
+	assert_false(vm_verify(load(code)));
+}
+
+int main(int argc, char *argv[]) {
+	cunit_setup = setup;
+	cunit_teardown = teardown;
+
+	char* wichruntime = getenv("WICHRUNTIME");
+	if ( wichruntime==NULL ) {
+		fprintf(stderr, "environment variable WICHRUNTIME not set to root of runtime area\n");
+		return -1;
+	}
+	strcpy(samplesdir, wichruntime);
+	strcat(samplesdir, "/vm/test/samples");
+	snprintf(wasm_path, sizeof(wasm_path), "/tmp/t_verifier_%d.wasm", (int)getpid());
+
+	test(samples);
+	test(max_stack);
+	test(widens_locals);
+	test(type_mismatch);
+	test(vector_index_needs_vector);
+	test(stack_underflow);
+	test(local_out_of_range);
+	test(local_used_as_two_types);
+	test(inconsistent_stack);
+	test(branch_leaves_function);
+	test(falls_off_end);
+	test(call_argument_type);
+
+	unlink(wasm_path);
+	return 0;
+}
@@ -78,6 +78,34 @@ PVector_ptr PVector_new(double *data, size_t n) {
 	return p;
 }
 
+/* Like PVector_new() but the n values are floats stride bytes apart, such as
+ * the f fields of consecutive VM stack slots; nothing needs to be staged.
+ */
+PVector_ptr PVector_new_strided(const float *data, size_t stride, size_t n) {
+	PVector *v = PVector_alloc(n);
+	v->version_count = -1; // first version is 0
+	PVector_ptr p = {++v->version_count, v};
+	const char *src = (const char *)data;
+	for (int i = 0; i < n; i++) {
+		v->nodes[i].data = *(const float *)src;
+		v->nodes[i].head = NULL;
+		src += stride;
+	}
+	return p;
+}
+
+/* A new vector, at version 0, holding v's elements */
+PVector_ptr PVector_flatten(PVector_ptr v) {
+	size_t n = v.vector->length;
+	double *data = malloc(n * sizeof(double));
+	for (int i = 0; i < n; i++) {
+		data[i] = ith(v, i);
+	}
+	PVector_ptr p = PVector_new(data, n);
+	free(data);
+	return p;
+}
+
 double ith(PVector_ptr vptr, int i) {
 	if (i<0 || i>= vptr.vector->length) {
 		vector_index_error((int)vptr.vector->length);
@@ -122,14 +150,12 @@ void set_ith(PVector_ptr vptr, int i, double value) {
 
 char *PVector_as_string(PVector_ptr a) {
 	char *s = calloc(a.vector->length*20, sizeof(char));
-	char buf[50];
-	strcat(s, "[");
+	int n = sprintf(s, "[");
 	for (int i=0; i<a.vector->length; i++) {
-		if ( i>0 ) strcat(s, ", ");
-		sprintf(buf, "%1.2f", ith(a, i));
-		strcat(s, buf);
+		if ( i>0 ) n += sprintf(s+n, ", ");
+		n += sprintf(s+n, "%1.2f", ith(a, i)); // append at the end rather than strcat from the start
 	}
-	strcat(s, "]");
+	sprintf(s+n, "]");
 	return s;
 }
 
@@ -24,6 +24,8 @@ SOFTWARE.
 #ifndef RUNTIME_PERSISTENT_VECTOR_H
 #define RUNTIME_PERSISTENT_VECTOR_H
 
+#include <stdint.h>
+
 /*
  * A DEREF(v) will have to deallocate all element linked-lists as well.
  * We can make DEREF_String and DEREF_Vector.
@@ -57,12 +59,36 @@ typedef struct {                // can't use "PVector *" since we need a version
 	PVector *vector;
 } PVector_ptr;
 
+/* A PVector_ptr packed into one 64-bit word, for value representations
+ * that can't afford the 16-byte pair: the vector pointer in the low 48 bits,
+ * which hold any user space address, and the version plus one in the top 16.
+ * NIL_VECTOR packs to 0. Versions stay packable because PVector_copy()
+ * starts a fresh vector rather than go past PVECTOR_MAX_VERSION.
+ */
+typedef uint64_t PVector_packed;
+
+#define PVECTOR_POINTER_BITS	48
+#define PVECTOR_MAX_VERSION		((1 << (64 - PVECTOR_POINTER_BITS)) - 2)
+
+static inline PVector_packed PVector_pack(PVector_ptr v) {
+	return (PVector_packed)(v.version + 1) << PVECTOR_POINTER_BITS | (uintptr_t)v.vector;
+}
+
+static inline PVector_ptr PVector_unpack(PVector_packed p) {
+	return (PVector_ptr){(int)(p >> PVECTOR_POINTER_BITS) - 1,
+						 (PVector *)(uintptr_t)(p & (((PVector_packed)1 << PVECTOR_POINTER_BITS) - 1))};
+}
+
+PVector_ptr PVector_flatten(PVector_ptr v);
+
 static inline PVector_ptr PVector_copy(PVector_ptr v) {
+	if ( v.vector->version_count>=PVECTOR_MAX_VERSION ) return PVector_flatten(v);
 	return (PVector_ptr){++v.vector->version_count, v.vector};
 }
 
 PVector_ptr PVector_init(double val, size_t n);
 PVector_ptr PVector_new(double *data, size_t n);
+PVector_ptr PVector_new_strided(const float *data, size_t stride, size_t n);
 void print_pvector(PVector_ptr a);
 double ith(PVector_ptr vptr, int i);
 void set_ith(PVector_ptr vptr, int i, double value);
@@ -32,8 +32,9 @@ SOFTWARE.
 //          during free.
 
 static const int MAX_ROOTS = 1024;
-static int sp = -1; // grow upwards; inc then set for push.
-static heap_object **roots[MAX_ROOTS];
+// each thread has its own root stack
+static _Thread_local int sp = -1; // grow upwards; inc then set for push.
+static _Thread_local heap_object **roots[MAX_ROOTS];
 
 PVector *PVector_alloc(size_t length) {
 	PVector *p = (PVector *)calloc(1, sizeof(PVector) + length * sizeof(PVectorFatNode));
@@ -69,6 +69,11 @@ PVector_ptr Vector_new(double *data, size_t n)
 	return PVector_new(data, n);
 }
 
+PVector_ptr Vector_new_strided(const float *data, size_t stride, size_t n)
+{
+	return PVector_new_strided(data, stride, n);
+}
+
 PVector_ptr Vector_copy(PVector_ptr v)
 {
 	REF((heap_object *)v.vector);
@@ -180,6 +185,69 @@ PVector_ptr Vector_div(PVector_ptr a, PVector_ptr b)
 	return c;
 }
 
+/* Each element of a op s; what Vector_add() and friends would compute with a
+ * vector of s's but without making one
+ */
+PVector_ptr Vector_add_scalar(PVector_ptr a, double s)
+{
+	if ( a.vector==NULL ) {
+		null_pointer_error("Addition operator cannot be applied to NULL Vectors\n");
+		return NIL_VECTOR;
+	}
+	REF((heap_object *)a.vector);
+	size_t n = a.vector->length;
+	PVector_ptr c = PVector_init(0, n);
+	for (int i=0; i<n; i++) c.vector->nodes[i].data = ith(a, i) + s;
+	DEREF((heap_object *)a.vector);
+	return c;
+}
+
+PVector_ptr Vector_sub_scalar(PVector_ptr a, double s)
+{
+	if ( a.vector==NULL ) {
+		null_pointer_error("Subtraction operator cannot be applied to NULL Vectors\n");
+		return NIL_VECTOR;
+	}
+	REF((heap_object *)a.vector);
+	size_t n = a.vector->length;
+	PVector_ptr c = PVector_init(0, n);
+	for (int i=0; i<n; i++) c.vector->nodes[i].data = ith(a, i) - s;
+	DEREF((heap_object *)a.vector);
+	return c;
+}
+
+PVector_ptr Vector_mul_scalar(PVector_ptr a, double s)
+{
+	if ( a.vector==NULL ) {
+		null_pointer_error("Multiplication operator cannot be applied to NULL Vectors\n");
+		return NIL_VECTOR;
+	}
+	REF((heap_object *)a.vector);
+	size_t n = a.vector->length;
+	PVector_ptr c = PVector_init(0, n);
+	for (int i=0; i<n; i++) c.vector->nodes[i].data = ith(a, i) * s;
+	DEREF((heap_object *)a.vector);
+	return c;
+}
+
+PVector_ptr Vector_div_scalar(PVector_ptr a, double s)
+{
+	if ( a.vector==NULL ) {
+		null_pointer_error("Division operator cannot be applied to NULL Vectors\n");
+		return NIL_VECTOR;
+	}
+	if ( s==0 ) {
+		fprintf(stderr, "ZeroDivisionError: Divisor cann't be 0\n");
+		return NIL_VECTOR;
+	}
+	REF((heap_object *)a.vector);
+	size_t n = a.vector->length;
+	PVector_ptr c = PVector_init(0, n);
+	for (int i=0; i<n; i++) c.vector->nodes[i].data = ith(a, i) / s;
+	DEREF((heap_object *)a.vector);
+	return c;
+}
+
 bool Vector_eq(PVector_ptr a, PVector_ptr b) {
 	REF((heap_object *)a.vector);
 	REF((heap_object *)b.vector);
@@ -251,19 +319,15 @@ String *String_from_vector(PVector_ptr v) {
 }
 
 String *String_from_int(int value) {
-	char *s = calloc(20, sizeof(char));
 	char buf[50];
 	sprintf(buf,"%d",value);
-	strcat(s, buf);
-	return String_new(s);
+	return String_new(buf);
 }
 
 String *String_from_float(double value) {
-	char *s = calloc(20, sizeof(char));
-	char buf[50];
+	char buf[400]; // room for any double
 	sprintf(buf,"%1.2f",value);
-	strcat(s, buf);
-	return String_new(s);
+	return String_new(buf);
 }
 
 int String_len(String *s) {
@@ -295,10 +359,10 @@ String *String_add(String *s, String *t)
 	if ( t == NULL ) return s;
 	REF((heap_object *)s);
 	REF((heap_object *)t);
-	size_t n = strlen(s->str) + strlen(t->str);
+	size_t n = s->length + t->length;
 	String *u = String_alloc(n);
-	strcpy(u->str, s->str);
-	strcat(u->str, t->str);
+	memcpy(u->str, s->str, s->length);
+	memcpy(u->str + s->length, t->str, t->length + 1);
 	DEREF((heap_object *)s);
 	DEREF((heap_object *)t);
 	return u;
@@ -307,7 +371,7 @@ String *String_add(String *s, String *t)
 bool String_eq(String *s, String *t) {
 	assert(s);
 	assert(t);
-	return strncmp(s->str, t->str, s->length > t->length ? s->length : t->length) == 0;
+	return s == t || (s->length == t->length && memcmp(s->str, t->str, s->length) == 0);
 }
 
 bool String_neq(String *s, String *t) {
@@ -80,6 +80,7 @@ void print_string(String *s);
 PVector_ptr Vector_empty(size_t n);
 PVector_ptr Vector_copy(PVector_ptr v);
 PVector_ptr Vector_new(double *data, size_t n);
+PVector_ptr Vector_new_strided(const float *data, size_t stride, size_t n);
 PVector_ptr Vector_append(PVector_ptr a, double value);
 PVector_ptr Vector_append_vector(PVector_ptr a, PVector_ptr b);
 PVector_ptr Vector_from_int(int value, size_t len);
@@ -89,6 +90,10 @@ PVector_ptr Vector_add(PVector_ptr a, PVector_ptr b);
 PVector_ptr Vector_sub(PVector_ptr a, PVector_ptr b);
 PVector_ptr Vector_mul(PVector_ptr a, PVector_ptr b);
 PVector_ptr Vector_div(PVector_ptr a, PVector_ptr b);
+PVector_ptr Vector_add_scalar(PVector_ptr a, double s);
+PVector_ptr Vector_sub_scalar(PVector_ptr a, double s);
+PVector_ptr Vector_mul_scalar(PVector_ptr a, double s);
+PVector_ptr Vector_div_scalar(PVector_ptr a, double s);
 
 bool Vector_eq(PVector_ptr a, PVector_ptr b);
 bool Vector_neq(PVector_ptr a, PVector_ptr b);
@@ -38,6 +38,33 @@ int main(int argc, char *argv[])
 	assert_float_equal(ith(x,1), 102.0);
 	assert_float_equal(ith(y,1), 902.0);
 
+	// packing into one word keeps the version and pointer
+	PVector_ptr p = PVector_unpack(PVector_pack(y));
+	assert_equal(p.version, y.version);
+	assert_addr_equal(p.vector, y.vector);
+	p = PVector_unpack(PVector_pack(NIL_VECTOR));
+	assert_equal(p.version, -1);
+	assert_addr_equal(p.vector, NULL);
+	assert_equal(PVector_pack(NIL_VECTOR), 0);
+
+	// out of packable versions, a copy is a fresh vector with the same elements
+	y.vector->version_count = PVECTOR_MAX_VERSION;
+	PVector_ptr z = PVector_copy(y);
+	assert_equal(z.version, 0);
+	assert_addr_not_equal(z.vector, y.vector);
+	assert_float_equal(ith(z,0), 1.0);
+	assert_float_equal(ith(z,1), 902.0);
+	assert_float_equal(ith(z,2), 3.0);
+
+	// built from every other float of a strided source
+	float src[] = {1, -1, 2, -1, 3};
+	PVector_ptr w = PVector_new_strided(src, 2*sizeof(float), 3);
+	assert_equal(w.version, 0);
+	assert_equal(w.vector->length, 3);
+	assert_float_equal(ith(w,0), 1.0);
+	assert_float_equal(ith(w,1), 2.0);
+	assert_float_equal(ith(w,2), 3.0);
+
 	printf("done\n");
 
 	return 0;
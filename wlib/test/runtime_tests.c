@@ -89,12 +89,31 @@ void test_strings() {
 	assert_equal(true, String_eq(s7,s8));
 }
 
+void test_vector_scalar_ops() {
+	PVector_ptr v = Vector_from_int(3, 4);
+	set_ith(v, 1, 6);
+	PVector_ptr sum = Vector_add_scalar(v, 1.5);
+	PVector_ptr diff = Vector_sub_scalar(v, 1);
+	PVector_ptr prod = Vector_mul_scalar(v, 2);
+	PVector_ptr quot = Vector_div_scalar(v, 3);
+	assert_equal(4, sum.vector->length);
+	assert_equal(4.5, ith(sum, 0));
+	assert_equal(7.5, ith(sum, 1));
+	assert_equal(5.0, ith(diff, 1));
+	assert_equal(12.0, ith(prod, 1));
+	assert_equal(1.0, ith(quot, 3));
+	assert_equal(3.0, ith(v, 0)); // operand is left alone
+	assert_equal(NULL, Vector_div_scalar(v, 0).vector);
+	assert_equal(NULL, Vector_add_scalar(NIL_VECTOR, 1).vector);
+}
+
 
 int main(int argc, char *argv[]) {
 	cunit_setup = setup;
 	cunit_teardown = teardown;
 
 	test(test_strings);
+	test(test_vector_scalar_ops);
 
 	return 0;
 }
\ No newline at end of file